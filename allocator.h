@@ -0,0 +1,436 @@
+#pragma once
+
+// Device memory sub-allocation and a persistently mapped staging ring.
+//
+// DeviceAllocator grabs large VkDeviceMemory blocks per memory type and hands
+// out aligned ranges from a first-fit free list, so the number of
+// vkAllocateMemory calls stays small no matter how many buffers exist.
+// StagingRing is one host-visible, coherent buffer used as a ring for
+// CPU -> GPU copies, reclaimed per frame once that frame's fence signals.
+// UniformRing is the same idea for uniform data read in place by shaders.
+
+#include <vulkan/vulkan.h>
+
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#define ALLOCATOR_BLOCK_SIZE (64ull * 1024 * 1024)
+
+struct Allocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void* mapped = nullptr;   // non-null for host-visible memory
+  uint32_t pool = 0;
+  uint32_t block = 0;
+};
+
+struct AllocatorStats {
+  uint64_t deviceAllocations = 0;   // live vkAllocateMemory blocks
+  uint64_t totalDeviceAllocations = 0;
+  uint64_t subAllocations = 0;      // live ranges handed out
+  uint64_t totalSubAllocations = 0;
+  VkDeviceSize bytesReserved = 0;
+  VkDeviceSize bytesInUse = 0;
+};
+
+class DeviceAllocator {
+public:
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = ALLOCATOR_BLOCK_SIZE) {
+    this->device = device;
+    this->blockSize = blockSize;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physicalDevice, &props);
+    granularity = props.limits.bufferImageGranularity;
+    maxAllocations = props.limits.maxMemoryAllocationCount;
+
+    // Buffers and optimal-tiling images never share a pool, so bufferImageGranularity cannot bite
+    pools.resize(memProps.memoryTypeCount * 2);
+  }
+
+  // Picks a memory type satisfying both the resource and `properties`, then sub-allocates from it
+  VkResult allocate(const VkMemoryRequirements& reqs, VkMemoryPropertyFlags properties, bool optimalImage, Allocation* out) {
+    uint32_t type = UINT32_MAX;
+    for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+      if ((reqs.memoryTypeBits & (1u << i)) && (memProps.memoryTypes[i].propertyFlags & properties) == properties) {
+        type = i;
+        break;
+      }
+    }
+    if (type == UINT32_MAX)
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+
+    uint32_t poolIndex = type * 2 + (optimalImage ? 1 : 0);
+    Pool& pool = pools[poolIndex];
+
+    VkDeviceSize alignment = std::max<VkDeviceSize>(reqs.alignment, optimalImage ? granularity : 1);
+
+    for (uint32_t b = 0; b < pool.blocks.size(); b++) {
+      if (pool.blocks[b].memory != VK_NULL_HANDLE && takeRange(pool.blocks[b], reqs.size, alignment, out)) {
+        finish(poolIndex, b, out);
+        return VK_SUCCESS;
+      }
+    }
+
+    // Oversized requests get a block of their own
+    VkDeviceSize size = std::max(blockSize, reqs.size);
+    Block block;
+    VkResult result = allocateBlock(type, size, &block);
+    if (result != VK_SUCCESS)
+      return result;
+
+    // Reuse an empty slot left behind by a freed dedicated block
+    uint32_t b = 0;
+    while (b < pool.blocks.size() && pool.blocks[b].memory != VK_NULL_HANDLE) b++;
+    if (b == pool.blocks.size())
+      pool.blocks.push_back(block);
+    else
+      pool.blocks[b] = block;
+
+    takeRange(pool.blocks[b], reqs.size, alignment, out);
+    finish(poolIndex, b, out);
+    return VK_SUCCESS;
+  }
+
+  void free(const Allocation& alloc) {
+    if (alloc.memory == VK_NULL_HANDLE)
+      return;
+
+    Block& block = pools[alloc.pool].blocks[alloc.block];
+    block.used -= alloc.size;
+    stats.subAllocations--;
+    stats.bytesInUse -= alloc.size;
+
+    // Insert back sorted by offset and merge with neighbours
+    auto it = std::lower_bound(block.freeRanges.begin(), block.freeRanges.end(), alloc.offset,
+                               [](const Range& r, VkDeviceSize offset) { return r.offset < offset; });
+    it = block.freeRanges.insert(it, {alloc.offset, alloc.size});
+    if (it + 1 != block.freeRanges.end() && it->offset + it->size == (it + 1)->offset) {
+      it->size += (it + 1)->size;
+      block.freeRanges.erase(it + 1);
+    }
+    if (it != block.freeRanges.begin() && (it - 1)->offset + (it - 1)->size == it->offset) {
+      (it - 1)->size += it->size;
+      block.freeRanges.erase(it);
+    }
+
+    // Dedicated blocks go back to the driver as soon as they are empty
+    if (block.used == 0 && block.size > blockSize) {
+      releaseBlock(&block);
+    }
+  }
+
+  // More than one of `families` makes the buffer concurrent across them, for
+  // buffers several queue families use without ownership transfers
+  VkResult createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+                        VkBuffer* buffer, Allocation* alloc, const std::vector<uint32_t>& families = {}) {
+    VkBufferCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    info.usage = usage;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (families.size() > 1) {
+      info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+      info.queueFamilyIndexCount = (uint32_t)families.size();
+      info.pQueueFamilyIndices = families.data();
+    }
+
+    VkResult result = vkCreateBuffer(device, &info, nullptr, buffer);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(device, *buffer, &reqs);
+
+    result = allocate(reqs, properties, false, alloc);
+    if (result == VK_SUCCESS)
+      result = vkBindBufferMemory(device, *buffer, alloc->memory, alloc->offset);
+
+    if (result != VK_SUCCESS) {
+      free(*alloc);
+      vkDestroyBuffer(device, *buffer, nullptr);
+      *buffer = VK_NULL_HANDLE;
+    }
+    return result;
+  }
+
+  void destroyBuffer(VkBuffer buffer, const Allocation& alloc) {
+    vkDestroyBuffer(device, buffer, nullptr);
+    free(alloc);
+  }
+
+  const AllocatorStats& getStats() const { return stats; }
+
+  void printStats() const {
+    logLine() << "Allocator: " << stats.deviceAllocations << " device blocks ("
+              << stats.totalDeviceAllocations << " vkAllocateMemory calls, limit " << maxAllocations << "), "
+              << stats.subAllocations << " live sub-allocations (" << stats.totalSubAllocations << " total), "
+              << stats.bytesInUse / 1024 << " / " << stats.bytesReserved / 1024 << " KiB in use";
+  }
+
+  void destroy() {
+    for (auto& pool : pools) {
+      for (auto& block : pool.blocks) {
+        releaseBlock(&block);
+      }
+      pool.blocks.clear();
+    }
+  }
+
+private:
+  struct Range {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    VkDeviceSize used = 0;
+    void* mapped = nullptr;
+    std::vector<Range> freeRanges;
+  };
+
+  struct Pool {
+    std::vector<Block> blocks;
+  };
+
+  VkResult allocateBlock(uint32_t type, VkDeviceSize size, Block* block) {
+    VkMemoryAllocateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    info.allocationSize = size;
+    info.memoryTypeIndex = type;
+
+    VkResult result = vkAllocateMemory(device, &info, nullptr, &block->memory);
+    if (result != VK_SUCCESS)
+      return result;
+
+    // Host-visible blocks stay mapped for their whole life
+    if (memProps.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+      result = vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+      if (result != VK_SUCCESS) {
+        vkFreeMemory(device, block->memory, nullptr);
+        block->memory = VK_NULL_HANDLE;
+        return result;
+      }
+    }
+
+    block->size = size;
+    block->used = 0;
+    block->freeRanges = {{0, size}};
+
+    stats.deviceAllocations++;
+    stats.totalDeviceAllocations++;
+    stats.bytesReserved += size;
+    return VK_SUCCESS;
+  }
+
+  void releaseBlock(Block* block) {
+    if (block->memory == VK_NULL_HANDLE)
+      return;
+    if (block->mapped)
+      vkUnmapMemory(device, block->memory);
+    vkFreeMemory(device, block->memory, nullptr);
+
+    stats.deviceAllocations--;
+    stats.bytesReserved -= block->size;
+    *block = Block{};
+  }
+
+  // First fit; the alignment padding in front of the range stays in the free list
+  static bool takeRange(Block& block, VkDeviceSize size, VkDeviceSize alignment, Allocation* out) {
+    for (size_t i = 0; i < block.freeRanges.size(); i++) {
+      Range range = block.freeRanges[i];
+      VkDeviceSize offset = (range.offset + alignment - 1) / alignment * alignment;
+      VkDeviceSize padding = offset - range.offset;
+      if (padding + size > range.size)
+        continue;
+
+      block.freeRanges.erase(block.freeRanges.begin() + i);
+      VkDeviceSize tail = range.size - padding - size;
+      if (tail > 0)
+        block.freeRanges.insert(block.freeRanges.begin() + i, {offset + size, tail});
+      if (padding > 0)
+        block.freeRanges.insert(block.freeRanges.begin() + i, {range.offset, padding});
+
+      block.used += size;
+      out->memory = block.memory;
+      out->offset = offset;
+      out->size = size;
+      out->mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+      return true;
+    }
+    return false;
+  }
+
+  void finish(uint32_t pool, uint32_t block, Allocation* out) {
+    out->pool = pool;
+    out->block = block;
+    stats.subAllocations++;
+    stats.totalSubAllocations++;
+    stats.bytesInUse += out->size;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memProps{};
+  VkDeviceSize blockSize = ALLOCATOR_BLOCK_SIZE;
+  VkDeviceSize granularity = 1;
+  uint32_t maxAllocations = 0;
+  std::vector<Pool> pools;
+  AllocatorStats stats;
+};
+
+// Frame-retired ring over a persistently mapped staging buffer. Space written
+// while frame slot N is open is reclaimed by the next beginFrame(N), which the
+// caller issues right after waiting on that slot's fence.
+#define STAGING_RING_SIZE (32ull * 1024 * 1024)
+
+class StagingRing {
+public:
+  VkResult init(DeviceAllocator* allocator, VkDeviceSize capacity = STAGING_RING_SIZE) {
+    this->capacity = capacity;
+    VkResult result = allocator->createBuffer(
+      capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      &buffer, &alloc
+    );
+    base = static_cast<char*>(alloc.mapped);
+    return result;
+  }
+
+  void destroy(DeviceAllocator* allocator) {
+    if (buffer != VK_NULL_HANDLE)
+      allocator->destroyBuffer(buffer, alloc);
+    buffer = VK_NULL_HANDLE;
+  }
+
+  void beginFrame(uint32_t slot) {
+    if (slot >= frameEnd.size())
+      frameEnd.resize(slot + 1, 0);
+    tail = std::max(tail, frameEnd[slot]);
+    currentSlot = slot;
+  }
+
+  void endFrame() {
+    if (currentSlot >= frameEnd.size())
+      frameEnd.resize(currentSlot + 1, 0);
+    frameEnd[currentSlot] = head;
+  }
+
+  // Everything submitted so far is known to be complete (e.g. after a queue wait)
+  void reset() {
+    tail = head;
+  }
+
+  // Returns a mapped pointer and the matching offset into `buffer`, or nullptr when the ring is full
+  void* allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset) {
+    VkDeviceSize start = (head + alignment - 1) / alignment * alignment;
+    // Never let an allocation straddle the end of the buffer
+    if (start % capacity + size > capacity)
+      start = (start / capacity + 1) * capacity;
+    if (start + size - tail > capacity)
+      return nullptr;
+
+    head = start + size;
+    bytesStaged += size;
+    *offset = start % capacity;
+    return base + *offset;
+  }
+
+  // Stages `data` and records a copy into dst. Returns false when the ring is full.
+  bool upload(VkCommandBuffer cmd, VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    VkDeviceSize srcOffset;
+    void* ptr = allocate(size, 16, &srcOffset);
+    if (!ptr)
+      return false;
+    memcpy(ptr, data, size);
+
+    VkBufferCopy copy{srcOffset, dstOffset, size};
+    vkCmdCopyBuffer(cmd, buffer, dst, 1, &copy);
+    return true;
+  }
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize capacity = 0;
+  uint64_t bytesStaged = 0;
+
+private:
+  Allocation alloc;
+  char* base = nullptr;
+  // Monotonic byte counters, wrapped by `capacity` when addressing
+  VkDeviceSize head = 0;
+  VkDeviceSize tail = 0;
+  uint32_t currentSlot = 0;
+  std::vector<VkDeviceSize> frameEnd;
+};
+
+// Per-frame linear allocator over one persistently mapped uniform buffer. The
+// buffer holds one region per frame in flight and beginFrame(N) rewinds region
+// N, so call it right after waiting on that slot's fence. Returned offsets are
+// absolute and meant for VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, or for
+// indexing the buffer as a storage buffer from the bindless path. The sprite
+// renderer uses a second ring with vertex buffer usage for its quads.
+#define UNIFORM_RING_FRAME_SIZE (1ull * 1024 * 1024)
+
+class UniformRing {
+public:
+  VkResult init(DeviceAllocator* allocator, VkDeviceSize minAlignment, uint32_t frameCount,
+                VkDeviceSize frameSize = UNIFORM_RING_FRAME_SIZE,
+                VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+    alignment = std::max<VkDeviceSize>(minAlignment, 16);
+    this->frameSize = (frameSize + alignment - 1) / alignment * alignment;
+    VkResult result = allocator->createBuffer(
+      this->frameSize * frameCount, usage,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      &buffer, &alloc
+    );
+    base = static_cast<char*>(alloc.mapped);
+    return result;
+  }
+
+  void destroy(DeviceAllocator* allocator) {
+    if (buffer != VK_NULL_HANDLE)
+      allocator->destroyBuffer(buffer, alloc);
+    buffer = VK_NULL_HANDLE;
+  }
+
+  void beginFrame(uint32_t slot) {
+    frameBegin = slot * frameSize;
+    cursor.store(frameBegin, std::memory_order_relaxed);
+  }
+
+  // Distance between consecutive entries of `size` bytes
+  VkDeviceSize stride(VkDeviceSize size) const {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  // Reserves `count` entries `stride(size)` apart with one atomic bump, so
+  // recording threads can share the ring. Returns the first entry and its
+  // offset, or nullptr when this frame's region is full.
+  void* allocate(VkDeviceSize size, uint32_t count, uint32_t* offset) {
+    VkDeviceSize bytes = stride(size) * count;
+    VkDeviceSize start = cursor.fetch_add(bytes, std::memory_order_relaxed);
+    if (start + bytes > frameBegin + frameSize)
+      return nullptr;
+
+    *offset = (uint32_t)start;
+    return base + start;
+  }
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceSize frameSize = 0;
+
+private:
+  Allocation alloc;
+  char* base = nullptr;
+  VkDeviceSize alignment = 16;
+  VkDeviceSize frameBegin = 0;
+  std::atomic<VkDeviceSize> cursor{0};
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+// Bindless resource table (descriptor indexing, core in Vulkan 1.2).
+//
+// One descriptor set holds a large array of sampled textures and one of
+// storage buffers. The set is bound once per command buffer and draws pick
+// their resources by index through push constants, so the per-draw CPU cost
+// is a vkCmdPushConstants instead of a vkCmdBindDescriptorSets. Both arrays
+// are update-after-bind and partially bound: slots can be written while the
+// set is bound in a command buffer being recorded, and unused slots may stay
+// empty. A slot must not be rewritten while a pending frame reads it.
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+#define BINDLESS_MAX_TEXTURES 1024
+#define BINDLESS_MAX_BUFFERS 64
+
+#define BINDLESS_TEXTURE_BINDING 0
+#define BINDLESS_BUFFER_BINDING 1
+
+// Must match the push constant block in shader_bindless.vert / .frag
+struct BindlessPushConstants {
+  uint32_t drawBuffer;   // buffer slot holding the DrawUniforms
+  uint32_t drawOffset;   // in 16 byte units
+  uint32_t texture;      // texture slot
+};
+
+// Everything the bindless path needs from the device, all Vulkan 1.2 core features
+inline bool bindlessSupported(const VkPhysicalDeviceVulkan12Features& features) {
+  return features.descriptorIndexing && features.runtimeDescriptorArray &&
+         features.descriptorBindingPartiallyBound &&
+         features.descriptorBindingSampledImageUpdateAfterBind &&
+         features.descriptorBindingStorageBufferUpdateAfterBind;
+}
+
+class BindlessTable {
+public:
+  VkResult init(VkDevice device) {
+    this->device = device;
+
+    VkDescriptorSetLayoutBinding bindings[2]{};
+    bindings[0].binding = BINDLESS_TEXTURE_BINDING;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    bindings[0].descriptorCount = BINDLESS_MAX_TEXTURES;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].binding = BINDLESS_BUFFER_BINDING;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].descriptorCount = BINDLESS_MAX_BUFFERS;
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorBindingFlags flags[2] = {
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT,
+    };
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlags{};
+    bindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlags.bindingCount = 2;
+    bindingFlags.pBindingFlags = flags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlags;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = 2;
+    layoutInfo.pBindings = bindings;
+
+    VkResult result = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkPushConstantRange push{VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                             sizeof(BindlessPushConstants)};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &push;
+
+    result = vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkDescriptorPoolSize poolSizes[2] = {
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, BINDLESS_MAX_TEXTURES},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, BINDLESS_MAX_BUFFERS},
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 2;
+    poolInfo.pPoolSizes = poolSizes;
+
+    result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkDescriptorSetAllocateInfo alloc{};
+    alloc.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc.descriptorPool = pool;
+    alloc.descriptorSetCount = 1;
+    alloc.pSetLayouts = &setLayout;
+
+    return vkAllocateDescriptorSets(device, &alloc, &set);
+  }
+
+  // Slots are handed out once and rewritten in place with setTexture / setBuffer
+  uint32_t addTexture(const VkDescriptorImageInfo& image) {
+    uint32_t slot = textureCount++;
+    setTexture(slot, image);
+    return slot;
+  }
+
+  uint32_t addBuffer(VkBuffer buffer) {
+    uint32_t slot = bufferCount++;
+    setBuffer(slot, buffer);
+    return slot;
+  }
+
+  void setTexture(uint32_t slot, const VkDescriptorImageInfo& image) {
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = BINDLESS_TEXTURE_BINDING;
+    write.dstArrayElement = slot;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &image;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+
+  void setBuffer(uint32_t slot, VkBuffer buffer) {
+    VkDescriptorBufferInfo info{buffer, 0, VK_WHOLE_SIZE};
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = BINDLESS_BUFFER_BINDING;
+    write.dstArrayElement = slot;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &info;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+
+  // The device must be idle
+  void destroy() {
+    if (pool != VK_NULL_HANDLE)
+      vkDestroyDescriptorPool(device, pool, nullptr);
+    if (pipelineLayout != VK_NULL_HANDLE)
+      vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    if (setLayout != VK_NULL_HANDLE)
+      vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    pool = VK_NULL_HANDLE;
+    pipelineLayout = VK_NULL_HANDLE;
+    setLayout = VK_NULL_HANDLE;
+    set = VK_NULL_HANDLE;
+  }
+
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  uint32_t textureCount = 0;
+  uint32_t bufferCount = 0;
+};
@@ -4,5 +4,65 @@ set -xe
 CFLAGS="-std=c++17 -O2"
 LDFLAGS="-lglfw -lvulkan -ldl -lpthread -lX11 -lXxf86vm -lXrandr -lXi"
 
+glslc shader.vert -o vert.spv
+glslc shader.frag -o frag.spv
+glslc cull.comp -o cull.spv
+glslc shader_bindless.vert -o bindless_vert.spv
+glslc shader_bindless.frag -o bindless_frag.spv
+glslc sprite.vert -o sprite_vert.spv
+glslc sprite.frag -o sprite_frag.spv
+glslc sprite_flat.frag -o sprite_flat_frag.spv
+glslc upscale.vert -o upscale_vert.spv
+glslc upscale.frag -o upscale_frag.spv
+
+# Embed the same SPIR-V as constexpr word arrays so startup needs no shader I/O.
+# The .spv files are still written for hot-reload.
+{
+  echo "// Generated by build.sh from shader.vert, shader.frag, cull.comp, shader_bindless.*, sprite* and upscale.*, do not edit"
+  echo "#pragma once"
+  echo "#include <cstdint>"
+  printf "constexpr uint32_t vertSpirv[] = "
+  glslc -mfmt=c shader.vert -o -
+  echo ";"
+  printf "constexpr uint32_t fragSpirv[] = "
+  glslc -mfmt=c shader.frag -o -
+  echo ";"
+  printf "constexpr uint32_t cullSpirv[] = "
+  glslc -mfmt=c cull.comp -o -
+  echo ";"
+  printf "constexpr uint32_t bindlessVertSpirv[] = "
+  glslc -mfmt=c shader_bindless.vert -o -
+  echo ";"
+  printf "constexpr uint32_t bindlessFragSpirv[] = "
+  glslc -mfmt=c shader_bindless.frag -o -
+  echo ";"
+  printf "constexpr uint32_t spriteVertSpirv[] = "
+  glslc -mfmt=c sprite.vert -o -
+  echo ";"
+  printf "constexpr uint32_t spriteFragSpirv[] = "
+  glslc -mfmt=c sprite.frag -o -
+  echo ";"
+  printf "constexpr uint32_t spriteFlatFragSpirv[] = "
+  glslc -mfmt=c sprite_flat.frag -o -
+  echo ";"
+  printf "constexpr uint32_t upscaleVertSpirv[] = "
+  glslc -mfmt=c upscale.vert -o -
+  echo ";"
+  printf "constexpr uint32_t upscaleFragSpirv[] = "
+  glslc -mfmt=c upscale.frag -o -
+  echo ";"
+} > shaders_spv.h
+
+g++ $CFLAGS -o meshconv meshconv.cpp
+# Headless regression suite against bench_baseline.json, see --regress below
+g++ $CFLAGS -o regress regress.cpp
 g++ $CFLAGS -o main main.cpp $LDFLAGS
-./main
+
+# ./build.sh --regress [regress options] runs the regression suite instead of
+# the app. It fails on a regression or a missing baseline, so record one first
+# with ./build.sh --regress --update-baseline on the ICD the runs will use
+if [ "$1" = "--regress" ]; then
+  shift
+  exec ./regress "$@"
+fi
+./main "$@"
@@ -0,0 +1,449 @@
+#pragma once
+
+// Frame capture without stalling the render loop.
+//
+// The finished backbuffer is copied into one of a ring of host-visible
+// readback buffers at the end of the frame's command buffer. Once the frame
+// has retired (counted like DeletionQueue: every frame handed to the GPU so
+// far) the slot goes to a writer thread, which streams it to disk and hands
+// the slot back. Nothing on the render thread ever waits: when every slot is
+// still in flight or being written, the frame is not captured and counted
+// as dropped.
+//
+// Output is a raw stream when the path ends in ".raw" (pixels in the image's
+// byte order, see the ffmpeg hint logged with the first frame), otherwise one
+// PNG per frame named PATH_<frame>.png.
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Readback buffers; the writer may fall this many frames behind before frames drop
+#define CAPTURE_SLOTS 4
+
+class FrameCapture {
+public:
+  ~FrameCapture() { stop(); }
+
+  // Only 8-bit RGBA and BGRA images can be captured
+  VkResult init(DeviceAllocator* allocator, const std::string& path, VkFormat format, uint32_t slotCount,
+                uint32_t framesInFlight) {
+    switch (format) {
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM:
+      bgra = true;
+      break;
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+      bgra = false;
+      break;
+    default:
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+
+    this->allocator = allocator;
+    this->framesInFlight = framesInFlight;
+    raw = path.size() > 4 && path.compare(path.size() - 4, 4, ".raw") == 0;
+    prefix = !raw && path.size() > 4 && path.compare(path.size() - 4, 4, ".png") == 0
+           ? path.substr(0, path.size() - 4) : path;
+    this->path = path;
+
+    std::vector<Slot> fresh(std::max(1u, slotCount));
+    slots.swap(fresh);
+
+    quit = false;
+    writer = std::thread(&FrameCapture::writerLoop, this);
+    return VK_SUCCESS;
+  }
+
+  // Render thread, after the frame's last pass. Copies `image`, left in
+  // `layout` by the render graph, and puts it back in that layout.
+  void record(VkCommandBuffer cmd, VkImage image, VkImageLayout layout, VkExtent2D extent, uint64_t frame) {
+    Slot* slot = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (Slot& candidate : slots) {
+        if (candidate.state == SLOT_FREE) {
+          slot = &candidate;
+          break;
+        }
+      }
+    }
+    if (slot == nullptr) {
+      drop("Capture is falling behind, dropping frames");
+      return;
+    }
+
+    // Free slots are neither on the GPU nor with the writer, so they can be replaced
+    VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * 4;
+    if (slot->capacity < size) {
+      if (slot->buffer != VK_NULL_HANDLE) {
+        allocator->destroyBuffer(slot->buffer, slot->alloc);
+        slot->buffer = VK_NULL_HANDLE;
+        slot->capacity = 0;
+      }
+      if (createReadbackBuffer(size, &slot->buffer, &slot->alloc) != VK_SUCCESS) {
+        slot->buffer = VK_NULL_HANDLE;
+        drop("Failed to allocate a capture buffer, dropping frames");
+        return;
+      }
+      slot->capacity = size;
+    }
+    slot->extent = extent;
+    slot->frame = frame;
+
+    VkImageMemoryBarrier toCopy{};
+    toCopy.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    toCopy.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    toCopy.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    toCopy.oldLayout = layout;
+    toCopy.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    toCopy.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toCopy.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toCopy.image = image;
+    toCopy.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    // ALL_COMMANDS chains with the render pass's implicit end dependency, which carries its final layout transition
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &toCopy);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+    VkImageMemoryBarrier back = toCopy;
+    back.srcAccessMask = 0;
+    back.dstAccessMask = 0;
+    back.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    back.newLayout = layout;
+
+    VkBufferMemoryBarrier toHost{};
+    toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toHost.buffer = slot->buffer;
+    toHost.size = size;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         0, nullptr, 1, &toHost, layout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL ? 1 : 0, &back);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    slot->state = SLOT_IN_FLIGHT;
+  }
+
+  // Render thread, once per frame after its fence wait. Never blocks: slots
+  // whose frame has retired go to the writer, oldest first.
+  void poll(uint64_t framesSubmitted) {
+    std::vector<Slot*> ready;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (Slot& slot : slots) {
+        if (slot.state == SLOT_IN_FLIGHT && framesSubmitted >= slot.frame + framesInFlight) {
+          slot.state = SLOT_WRITING;
+          ready.push_back(&slot);
+        }
+      }
+      std::sort(ready.begin(), ready.end(), [](const Slot* a, const Slot* b) { return a->frame < b->frame; });
+      queue.insert(queue.end(), ready.begin(), ready.end());
+    }
+    if (!ready.empty())
+      wake.notify_all();
+  }
+
+  // Shutdown, with the device idle: writes everything captured so far and stops the writer
+  void finish() {
+    poll(UINT64_MAX - framesInFlight);
+    stop();
+  }
+
+  void destroy() {
+    stop();
+    for (Slot& slot : slots) {
+      if (slot.buffer != VK_NULL_HANDLE)
+        allocator->destroyBuffer(slot.buffer, slot.alloc);
+    }
+    slots.clear();
+  }
+
+  void report() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    logLine() << "Capture: " << written << " frames written to " << path << " ("
+              << bytesWritten / (1024.0 * 1024.0) << " MiB), " << dropped << " dropped";
+  }
+
+private:
+  enum SlotState {
+    SLOT_FREE,        // render thread may record into it
+    SLOT_IN_FLIGHT,   // copy submitted, frame not yet retired
+    SLOT_WRITING,     // owned by the writer thread
+  };
+
+  struct Slot {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation alloc;
+    VkDeviceSize capacity = 0;
+    VkExtent2D extent{};
+    uint64_t frame = 0;
+    SlotState state = SLOT_FREE;
+  };
+
+  // Cached memory makes the writer's reads fast; both kinds are coherent, so nothing needs invalidating
+  VkResult createReadbackBuffer(VkDeviceSize size, VkBuffer* buffer, Allocation* alloc) {
+    const VkMemoryPropertyFlags visible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkResult result = allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                              visible | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, buffer, alloc);
+    if (result != VK_SUCCESS)
+      result = allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, visible, buffer, alloc);
+    return result;
+  }
+
+  void drop(const char* reason) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (dropped++ == 0)
+      logLine() << reason;
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    wake.notify_all();
+    if (writer.joinable())
+      writer.join();
+    if (rawFile != nullptr) {
+      std::fclose(rawFile);
+      rawFile = nullptr;
+    }
+  }
+
+  // Drains the queue before quitting, so finish() loses nothing
+  void writerLoop() {
+    for (;;) {
+      Slot* slot;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return quit || !queue.empty(); });
+        if (queue.empty())
+          return;
+        slot = queue.front();
+        queue.pop_front();
+      }
+
+      size_t bytes = raw ? writeRaw(*slot) : writePng(*slot);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      slot->state = SLOT_FREE;
+      if (bytes > 0) {
+        written++;
+        bytesWritten += bytes;
+      } else {
+        dropped++;
+      }
+    }
+  }
+
+  // Writer thread only, from here on
+
+  size_t writeRaw(const Slot& slot) {
+    size_t size = (size_t)slot.extent.width * slot.extent.height * 4;
+    if (rawFile == nullptr && !rawFailed) {
+      rawFile = std::fopen(path.c_str(), "wb");
+      rawExtent = slot.extent;
+      if (rawFile == nullptr) {
+        logLine() << "Failed to open capture file " << path;
+        rawFailed = true;
+      } else {
+        logLine() << "Capturing to " << path << ", convert with: ffmpeg -f rawvideo -pixel_format "
+                  << (bgra ? "bgra" : "rgba") << " -video_size " << rawExtent.width << "x" << rawExtent.height
+                  << " -i " << path << " capture.mp4";
+      }
+    }
+    if (rawFile == nullptr)
+      return 0;
+    // A stream has a single frame size, frames from after a resize do not fit it
+    if (slot.extent.width != rawExtent.width || slot.extent.height != rawExtent.height) {
+      if (!rawResized) {
+        logLine() << "Capture size changed, dropping frames that do not match the stream";
+        rawResized = true;
+      }
+      return 0;
+    }
+    return std::fwrite(slot.alloc.mapped, 1, size, rawFile) == size ? size : 0;
+  }
+
+  // Uncompressed (stored deflate) RGB, the cheapest valid PNG to produce
+  size_t writePng(const Slot& slot) {
+    uint32_t width = slot.extent.width;
+    uint32_t height = slot.extent.height;
+    const uint8_t* pixels = static_cast<const uint8_t*>(slot.alloc.mapped);
+
+    // Filter byte 0 and RGB for every row
+    size_t rowBytes = 1 + (size_t)width * 3;
+    scanlines.resize(rowBytes * height);
+    int r = bgra ? 2 : 0;
+    int b = bgra ? 0 : 2;
+    for (uint32_t y = 0; y < height; y++) {
+      uint8_t* out = scanlines.data() + y * rowBytes;
+      const uint8_t* in = pixels + (size_t)y * width * 4;
+      *out++ = 0;
+      for (uint32_t x = 0; x < width; x++, in += 4) {
+        *out++ = in[r];
+        *out++ = in[1];
+        *out++ = in[b];
+      }
+    }
+
+    // zlib header, stored blocks of at most 65535 bytes, adler32
+    const size_t blockMax = 65535;
+    size_t blocks = std::max<size_t>(1, (scanlines.size() + blockMax - 1) / blockMax);
+    idat.clear();
+    idat.reserve(2 + scanlines.size() + blocks * 5 + 4);
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    for (size_t offset = 0, i = 0; i < blocks; i++, offset += blockMax) {
+      uint16_t length = (uint16_t)std::min(blockMax, scanlines.size() - offset);
+      idat.push_back(i + 1 == blocks ? 1 : 0);
+      idat.push_back(length & 0xff);
+      idat.push_back(length >> 8);
+      idat.push_back(~length & 0xff);
+      idat.push_back((~length >> 8) & 0xff);
+      idat.insert(idat.end(), scanlines.begin() + offset, scanlines.begin() + offset + length);
+    }
+    appendBigEndian(&idat, adler32(scanlines.data(), scanlines.size()));
+
+    uint8_t header[13];
+    storeBigEndian(header, width);
+    storeBigEndian(header + 4, height);
+    header[8] = 8;    // bit depth
+    header[9] = 2;    // RGB
+    header[10] = 0;   // deflate
+    header[11] = 0;   // adaptive filtering
+    header[12] = 0;   // not interlaced
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "_%06llu.png", (unsigned long long)slot.frame);
+    std::string filePath = prefix + name;
+    FILE* file = std::fopen(filePath.c_str(), "wb");
+    if (file == nullptr) {
+      if (!pngFailed) {
+        logLine() << "Failed to open capture file " << filePath;
+        pngFailed = true;
+      }
+      return 0;
+    }
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    size_t bytes = std::fwrite(signature, 1, sizeof(signature), file);
+    bytes += writeChunk(file, "IHDR", header, sizeof(header));
+    bytes += writeChunk(file, "IDAT", idat.data(), idat.size());
+    bytes += writeChunk(file, "IEND", nullptr, 0);
+    bool ok = std::ferror(file) == 0;
+    return std::fclose(file) == 0 && ok ? bytes : 0;
+  }
+
+  size_t writeChunk(FILE* file, const char type[4], const uint8_t* data, size_t size) {
+    uint8_t length[4];
+    storeBigEndian(length, (uint32_t)size);
+    uint32_t crc = crc32(0xffffffffu, reinterpret_cast<const uint8_t*>(type), 4);
+    crc = crc32(crc, data, size) ^ 0xffffffffu;
+    uint8_t trailer[4];
+    storeBigEndian(trailer, crc);
+
+    std::fwrite(length, 1, 4, file);
+    std::fwrite(type, 1, 4, file);
+    if (size > 0)
+      std::fwrite(data, 1, size, file);
+    std::fwrite(trailer, 1, 4, file);
+    return 12 + size;
+  }
+
+  static void storeBigEndian(uint8_t* out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = (value >> 16) & 0xff;
+    out[2] = (value >> 8) & 0xff;
+    out[3] = value & 0xff;
+  }
+
+  static void appendBigEndian(std::vector<uint8_t>* out, uint32_t value) {
+    uint8_t bytes[4];
+    storeBigEndian(bytes, value);
+    out->insert(out->end(), bytes, bytes + 4);
+  }
+
+  // Running CRC without the final inversion, table built on first use
+  static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+    static const std::vector<uint32_t> table = [] {
+      std::vector<uint32_t> t(256);
+      for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+          c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        t[n] = c;
+      }
+      return t;
+    }();
+    for (size_t i = 0; i < size; i++) {
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+  }
+
+  static uint32_t adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+      // Largest run before b can overflow 32 bits
+      size_t run = std::min<size_t>(size, 5552);
+      size -= run;
+      for (size_t i = 0; i < run; i++) {
+        a += data[i];
+        b += a;
+      }
+      data += run;
+      a %= 65521;
+      b %= 65521;
+    }
+    return (b << 16) | a;
+  }
+
+  DeviceAllocator* allocator = nullptr;
+  uint32_t framesInFlight = 1;
+  std::string path;
+  std::string prefix;   // PNG names, the path without its extension
+  bool raw = false;
+  bool bgra = true;
+
+  std::vector<Slot> slots;
+  std::thread writer;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Slot*> queue;
+  bool quit = false;
+  uint64_t written = 0;
+  uint64_t dropped = 0;
+  uint64_t bytesWritten = 0;
+
+  // Writer thread state
+  std::vector<uint8_t> scanlines;
+  std::vector<uint8_t> idat;
+  FILE* rawFile = nullptr;
+  VkExtent2D rawExtent{};
+  bool rawFailed = false;
+  bool rawResized = false;
+  bool pngFailed = false;
+};
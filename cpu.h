@@ -0,0 +1,25 @@
+#pragma once
+
+// Instruction sets picked at runtime.
+//
+// The build only assumes SSE2, so one binary runs on any x86-64 CPU. The
+// eight-wide kernels are compiled for AVX with AVX_KERNEL instead of a global
+// -mavx, and callers check cpuHasAvx() before running them.
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_AVX_KERNELS 1
+#define AVX_KERNEL __attribute__((target("avx")))
+#else
+#define HAVE_AVX_KERNELS 0
+#endif
+
+inline bool cpuHasAvx() {
+#if defined(__AVX__)
+  return true;
+#elif HAVE_AVX_KERNELS
+  static const bool avx = __builtin_cpu_supports("avx");
+  return avx;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,391 @@
+#pragma once
+
+// Frustum culling, on the CPU or as a GPU pre-pass.
+//
+// GpuCuller records a compute dispatch (cull.comp) ahead of the render pass
+// that tests every instance against the camera frustum and compacts the
+// survivors into a device-local buffer, together with an indexed indirect
+// command whose instance count the shader fills in. The pass then draws them
+// with a single vkCmdDrawIndexedIndirect, so the CPU never looks at
+// per-object visibility. The CPU path uses the same planes and bounds.
+//
+// On devices with a compute-only family the dispatch runs on that queue
+// instead, from a command buffer per frame in flight, so it overlaps the
+// graphics work of the frames still in flight. It releases the outputs to
+// the graphics family and signals a semaphore; the frame's graphics
+// submission waits on it and acquires them. The instance sources are
+// host-written, so they are shared concurrently between the two families
+// instead of changing owner every frame.
+
+#include <vulkan/vulkan.h>
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/geometric.hpp>
+
+#include "allocator.h"
+
+#include <cstdint>
+#include <vector>
+
+// Clip-space planes of a view-projection matrix (Gribb/Hartmann), for depth
+// in [0, 1]. Normalized, so the signed distance compares directly to a radius.
+struct Frustum {
+  glm::vec4 planes[6];
+};
+
+inline Frustum extractFrustum(const glm::mat4& m) {
+  glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+  glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+  glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+  glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+  Frustum f;
+  f.planes[0] = row3 + row0;   // left
+  f.planes[1] = row3 - row0;   // right
+  f.planes[2] = row3 + row1;   // top
+  f.planes[3] = row3 - row1;   // bottom
+  f.planes[4] = row2;          // near
+  f.planes[5] = row3 - row2;   // far
+  for (glm::vec4& p : f.planes) {
+    p /= glm::length(glm::vec3(p));
+  }
+  return f;
+}
+
+// Instances are flat, so their bounds are circles in the z = 0 plane
+inline bool circleVisible(const Frustum& f, glm::vec2 center, float radius) {
+  for (const glm::vec4& p : f.planes) {
+    if (p.x * center.x + p.y * center.y + p.w < -radius)
+      return false;
+  }
+  return true;
+}
+
+// Must match the push constant block in cull.comp
+struct CullPushConstants {
+  glm::vec4 planes[6];
+  uint32_t count;
+  float meshRadius;
+};
+
+#define CULL_WORKGROUP_SIZE 64
+// Graphics stages that read the cull outputs
+#define CULL_CONSUMER_STAGES (VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT)
+
+class GpuCuller {
+public:
+  // `computeQueue` is only used when `computeFamily` differs from `graphicsFamily`
+  VkResult init(VkDevice device, DeviceAllocator* allocator, uint32_t frameCount, uint32_t graphicsFamily,
+                uint32_t computeFamily, VkQueue computeQueue) {
+    this->device = device;
+    this->allocator = allocator;
+    this->graphicsFamily = graphicsFamily;
+    this->computeFamily = computeFamily;
+    this->computeQueue = computeQueue;
+    frames.resize(frameCount);
+
+    // Source instances, compacted survivors, indirect command
+    VkDescriptorSetLayoutBinding bindings[3]{};
+    for (uint32_t b = 0; b < 3; b++) {
+      bindings[b].binding = b;
+      bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      bindings[b].descriptorCount = 1;
+      bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 3;
+    layoutInfo.pBindings = bindings;
+
+    VkResult result = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkPushConstantRange push{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants)};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &push;
+
+    result = vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * frameCount};
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = frameCount;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool);
+    if (result != VK_SUCCESS)
+      return result;
+
+    std::vector<VkDescriptorSetLayout> layouts(frameCount, setLayout);
+    std::vector<VkDescriptorSet> sets(frameCount);
+
+    VkDescriptorSetAllocateInfo alloc{};
+    alloc.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc.descriptorPool = pool;
+    alloc.descriptorSetCount = frameCount;
+    alloc.pSetLayouts = layouts.data();
+
+    result = vkAllocateDescriptorSets(device, &alloc, sets.data());
+    for (uint32_t i = 0; i < frameCount && result == VK_SUCCESS; i++) {
+      frames[i].set = sets[i];
+    }
+    if (result != VK_SUCCESS || !async())
+      return result;
+
+    for (Frame& frame : frames) {
+      VkCommandPoolCreateInfo cmdPoolInfo{};
+      cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+      cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+      cmdPoolInfo.queueFamilyIndex = computeFamily;
+      result = vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &frame.cmdPool);
+      if (result != VK_SUCCESS)
+        return result;
+
+      VkCommandBufferAllocateInfo cmdAlloc{};
+      cmdAlloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      cmdAlloc.commandPool = frame.cmdPool;
+      cmdAlloc.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      cmdAlloc.commandBufferCount = 1;
+      result = vkAllocateCommandBuffers(device, &cmdAlloc, &frame.cmd);
+      if (result != VK_SUCCESS)
+        return result;
+
+      VkSemaphoreCreateInfo semInfo{};
+      semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+      result = vkCreateSemaphore(device, &semInfo, nullptr, &frame.done);
+      if (result != VK_SUCCESS)
+        return result;
+    }
+    return VK_SUCCESS;
+  }
+
+  // The dispatch runs on its own compute queue
+  bool async() const { return graphicsFamily != computeFamily; }
+
+  // Families the instance sources must be shared across; empty when one queue does everything
+  std::vector<uint32_t> sourceFamilies() const {
+    if (!async())
+      return {};
+    return {graphicsFamily, computeFamily};
+  }
+
+  // (Re)creates the per-frame outputs for up to `capacity` instances of
+  // `stride` bytes read from sources[frame]. No frame may be in flight.
+  VkResult resize(uint32_t capacity, VkDeviceSize stride, const std::vector<VkBuffer>& sources) {
+    releaseBuffers();
+
+    for (size_t i = 0; i < frames.size(); i++) {
+      Frame& frame = frames[i];
+      VkResult result = allocator->createBuffer(
+        stride * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &frame.visible, &frame.visibleAlloc
+      );
+      if (result != VK_SUCCESS)
+        return result;
+
+      result = allocator->createBuffer(
+        sizeof(VkDrawIndexedIndirectCommand),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &frame.indirect, &frame.indirectAlloc
+      );
+      if (result != VK_SUCCESS)
+        return result;
+
+      VkDescriptorBufferInfo infos[3] = {
+        {sources[i], 0, VK_WHOLE_SIZE},
+        {frame.visible, 0, VK_WHOLE_SIZE},
+        {frame.indirect, 0, VK_WHOLE_SIZE},
+      };
+
+      VkWriteDescriptorSet writes[3]{};
+      for (uint32_t b = 0; b < 3; b++) {
+        writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[b].dstSet = frame.set;
+        writes[b].dstBinding = b;
+        writes[b].descriptorCount = 1;
+        writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[b].pBufferInfo = &infos[b];
+      }
+      vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+    }
+    return VK_SUCCESS;
+  }
+
+  // Outside a render pass. Leaves visibleBuffer(frame) and indirectBuffer(frame)
+  // ready for the vertex input and indirect stages of `cmd`. When async() the
+  // dispatch goes into the frame's compute command buffer and only the
+  // acquire is recorded into `cmd`; submit() then has to run before `cmd` is.
+  void record(VkCommandBuffer cmd, uint32_t frame, VkPipeline pipeline, const Frustum& frustum,
+              uint32_t count, uint32_t indexCount, float meshRadius) {
+    Frame& f = frames[frame];
+    if (!async()) {
+      recordDispatch(cmd, f, pipeline, frustum, count, indexCount, meshRadius);
+
+      VkMemoryBarrier toDraw{};
+      toDraw.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      toDraw.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      toDraw.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, CULL_CONSUMER_STAGES, 0,
+                           1, &toDraw, 0, nullptr, 0, nullptr);
+      return;
+    }
+
+    // The frame's fence covers the graphics submission that waited on the last dispatch
+    vkResetCommandPool(device, f.cmdPool, 0);
+    VkCommandBufferBeginInfo begin{};
+    begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(f.cmd, &begin);
+    recordDispatch(f.cmd, f, pipeline, frustum, count, indexCount, meshRadius);
+
+    // The next dispatch overwrites both outputs, so nothing is handed back to compute
+    VkBufferMemoryBarrier handoff[2]{};
+    VkBuffer outputs[2] = {f.indirect, f.visible};
+    VkAccessFlags reads[2] = {VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT};
+    for (int b = 0; b < 2; b++) {
+      handoff[b].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      handoff[b].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      handoff[b].srcQueueFamilyIndex = computeFamily;
+      handoff[b].dstQueueFamilyIndex = graphicsFamily;
+      handoff[b].buffer = outputs[b];
+      handoff[b].offset = 0;
+      handoff[b].size = VK_WHOLE_SIZE;
+    }
+    // Release: the destination access mask is ignored on this side
+    vkCmdPipelineBarrier(f.cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, nullptr, 2, handoff, 0, nullptr);
+    vkEndCommandBuffer(f.cmd);
+
+    // Acquire: the source access mask is ignored on this side; the semaphore
+    // wait blocks the consumer stages, the barrier chains off the same stages
+    for (int b = 0; b < 2; b++) {
+      handoff[b].srcAccessMask = 0;
+      handoff[b].dstAccessMask = reads[b];
+    }
+    vkCmdPipelineBarrier(cmd, CULL_CONSUMER_STAGES, CULL_CONSUMER_STAGES, 0, 0, nullptr, 2, handoff, 0, nullptr);
+    f.recorded = true;
+  }
+
+  // Submits the dispatch recorded for `frame` to the compute queue, right
+  // before the frame's graphics submission. Sets `wait` to the semaphore that
+  // submission has to wait on at CULL_CONSUMER_STAGES, or to null when there
+  // is nothing to wait for.
+  VkResult submit(uint32_t frame, VkSemaphore* wait) {
+    *wait = VK_NULL_HANDLE;
+    Frame& f = frames[frame];
+    if (!f.recorded)
+      return VK_SUCCESS;
+    f.recorded = false;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &f.cmd;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &f.done;
+    VkResult result = vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    if (result == VK_SUCCESS)
+      *wait = f.done;
+    return result;
+  }
+
+  VkBuffer visibleBuffer(uint32_t frame) const { return frames[frame].visible; }
+  VkBuffer indirectBuffer(uint32_t frame) const { return frames[frame].indirect; }
+
+  // The device must be idle
+  void destroy() {
+    releaseBuffers();
+    for (Frame& frame : frames) {
+      if (frame.done != VK_NULL_HANDLE)
+        vkDestroySemaphore(device, frame.done, nullptr);
+      if (frame.cmdPool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(device, frame.cmdPool, nullptr);
+    }
+    if (pool != VK_NULL_HANDLE)
+      vkDestroyDescriptorPool(device, pool, nullptr);
+    if (pipelineLayout != VK_NULL_HANDLE)
+      vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    if (setLayout != VK_NULL_HANDLE)
+      vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    pool = VK_NULL_HANDLE;
+    pipelineLayout = VK_NULL_HANDLE;
+    setLayout = VK_NULL_HANDLE;
+    frames.clear();
+  }
+
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+
+private:
+  struct Frame {
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    VkBuffer visible = VK_NULL_HANDLE;
+    Allocation visibleAlloc;
+    VkBuffer indirect = VK_NULL_HANDLE;
+    Allocation indirectAlloc;
+
+    // async() only
+    VkCommandPool cmdPool = VK_NULL_HANDLE;
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    VkSemaphore done = VK_NULL_HANDLE;
+    bool recorded = false;   // waiting for submit()
+  };
+
+  // Resets the indirect command and compacts the survivors of `frustum`
+  void recordDispatch(VkCommandBuffer cmd, const Frame& f, VkPipeline pipeline, const Frustum& frustum,
+                      uint32_t count, uint32_t indexCount, float meshRadius) const {
+    VkDrawIndexedIndirectCommand reset{indexCount, 0, 0, 0, 0};
+    vkCmdUpdateBuffer(cmd, f.indirect, 0, sizeof(reset), &reset);
+
+    VkMemoryBarrier toCompute{};
+    toCompute.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    toCompute.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    toCompute.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &toCompute, 0, nullptr, 0, nullptr);
+
+    CullPushConstants push;
+    for (int p = 0; p < 6; p++) {
+      push.planes[p] = frustum.planes[p];
+    }
+    push.count = count;
+    push.meshRadius = meshRadius;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &f.set, 0, nullptr);
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(cmd, (count + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+  }
+
+  void releaseBuffers() {
+    for (Frame& frame : frames) {
+      if (frame.visible != VK_NULL_HANDLE)
+        allocator->destroyBuffer(frame.visible, frame.visibleAlloc);
+      if (frame.indirect != VK_NULL_HANDLE)
+        allocator->destroyBuffer(frame.indirect, frame.indirectAlloc);
+      frame.visible = VK_NULL_HANDLE;
+      frame.indirect = VK_NULL_HANDLE;
+    }
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator* allocator = nullptr;
+  uint32_t graphicsFamily = 0;
+  uint32_t computeFamily = 0;
+  VkQueue computeQueue = VK_NULL_HANDLE;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  std::vector<Frame> frames;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+// Frame-indexed deferred destruction.
+//
+// Replacing a resource the GPU may still be reading used to need a
+// vkDeviceWaitIdle. Instead the old object goes into this queue, tagged with
+// the last frame that could have used it, and is destroyed by collect() once
+// that frame's fence has signaled. Frames are counted by how many were handed
+// to the GPU so far. Pipelines replaced by a rebuild and texture chains
+// replaced by streaming are retired here too.
+//
+// Render thread only. Objects are queued in frame order, so collect() only
+// ever looks at the front.
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+class DeletionQueue {
+public:
+  void init(VkDevice device, DeviceAllocator* allocator, uint32_t framesInFlight) {
+    this->device = device;
+    this->allocator = allocator;
+    this->framesInFlight = framesInFlight;
+  }
+
+  // Once per frame after its fence wait, before anything is queued for that
+  // frame. Objects queued from here on may be used by frames up to `framesSubmitted`.
+  void collect(uint64_t framesSubmitted) {
+    frame = framesSubmitted;
+    while (!entries.empty() && framesSubmitted >= entries.front().safeFrame) {
+      entries.front().destroy();
+      entries.pop_front();
+      destroyed++;
+    }
+  }
+
+  void defer(std::function<void()> destroy) {
+    entries.push_back({frame + framesInFlight, std::move(destroy)});
+  }
+
+  // Images from the DeviceAllocator, or with memory owned elsewhere when `alloc` is empty
+  void destroyImage(VkImage image, const Allocation& alloc = {}) {
+    VkDevice device = this->device;
+    DeviceAllocator* allocator = this->allocator;
+    defer([device, allocator, image, alloc] {
+      vkDestroyImage(device, image, nullptr);
+      if (alloc.memory != VK_NULL_HANDLE)
+        allocator->free(alloc);
+    });
+  }
+
+  void free(const Allocation& alloc) {
+    DeviceAllocator* allocator = this->allocator;
+    defer([allocator, alloc] { allocator->free(alloc); });
+  }
+
+  void destroyImageView(VkImageView view) {
+    VkDevice device = this->device;
+    defer([device, view] { vkDestroyImageView(device, view, nullptr); });
+  }
+
+  void destroyFramebuffer(VkFramebuffer framebuffer) {
+    VkDevice device = this->device;
+    defer([device, framebuffer] { vkDestroyFramebuffer(device, framebuffer, nullptr); });
+  }
+
+  void destroySemaphore(VkSemaphore semaphore) {
+    VkDevice device = this->device;
+    defer([device, semaphore] { vkDestroySemaphore(device, semaphore, nullptr); });
+  }
+
+  void destroyPipeline(VkPipeline pipeline) {
+    VkDevice device = this->device;
+    defer([device, pipeline] { vkDestroyPipeline(device, pipeline, nullptr); });
+  }
+
+  // Shutdown: the device must be idle, so everything left is safe
+  void flush() {
+    for (Entry& entry : entries) {
+      entry.destroy();
+      destroyed++;
+    }
+    entries.clear();
+  }
+
+  size_t pending() const { return entries.size(); }
+  uint64_t destroyed = 0;
+
+private:
+  struct Entry {
+    uint64_t safeFrame;   // destroyable once this many frames were submitted
+    std::function<void()> destroy;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator* allocator = nullptr;
+  uint32_t framesInFlight = 1;
+  uint64_t frame = 0;
+  std::deque<Entry> entries;
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+// Work-stealing job system for data-parallel frame work.
+//
+// Every thread owns a deque of jobs. A job covering more than one grain of
+// its range splits in half: the thread keeps the lower half and pushes the
+// upper half onto the back of its own deque. The owner pops from the back,
+// so it continues on the piece it split last, still warm in its cache; idle
+// threads steal from the front, where the largest pieces are. A parallelFor
+// therefore starts as a single job on the caller's deque and only spreads as
+// far as there are idle threads to take it. The calling thread works too,
+// as thread 0.
+//
+// Each deque has its own mutex. Jobs are a grain of work each, so the lock
+// is noise next to them, and owners and thieves rarely meet on one deque.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+public:
+  // Runs elements [begin, end) of the range
+  using RangeFn = std::function<void(uint32_t begin, uint32_t end)>;
+
+  ~JobSystem() { stop(); }
+
+  // `threadCount` includes the calling thread; 1 runs everything inline
+  void start(uint32_t threadCount) {
+    stop();
+    threads = std::max(1u, threadCount);
+    queues.clear();
+    for (uint32_t t = 0; t < threads; t++) {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    quit = false;
+    stolen.store(0, std::memory_order_relaxed);
+    for (uint32_t t = 1; t < threads; t++) {
+      workers.emplace_back(&JobSystem::workerLoop, this, t);
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      quit = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    workers.clear();
+  }
+
+  uint32_t threadCount() const { return threads; }
+
+  // Calls `fn` over [0, count) in pieces of at most `grain` elements, spread
+  // over every thread, and returns once all of them have run. Calling thread
+  // only; `fn` must not call parallelFor itself.
+  void parallelFor(uint32_t count, uint32_t grain, const RangeFn& fn) {
+    if (count == 0)
+      return;
+    grain = std::max(1u, grain);
+    if (threads == 1 || count <= grain) {
+      fn(0, count);
+      return;
+    }
+
+    remaining.store(count, std::memory_order_relaxed);
+    push(0, {&fn, 0, count, grain});
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      epoch++;
+    }
+    wake.notify_all();
+
+    work(0);
+  }
+
+  // Jobs taken from another thread's deque since the last start()
+  uint64_t steals() const { return stolen.load(std::memory_order_relaxed); }
+
+private:
+  struct Job {
+    const RangeFn* fn;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t grain;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  void push(uint32_t self, const Job& job) {
+    Queue& queue = *queues[self];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(job);
+  }
+
+  bool pop(uint32_t self, Job* job) {
+    Queue& queue = *queues[self];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.jobs.empty())
+      return false;
+    *job = queue.jobs.back();
+    queue.jobs.pop_back();
+    return true;
+  }
+
+  // Tries every other deque once, starting after our own
+  bool steal(uint32_t self, Job* job) {
+    for (uint32_t i = 1; i < threads; i++) {
+      Queue& queue = *queues[(self + i) % threads];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.jobs.empty()) {
+        *job = queue.jobs.front();
+        queue.jobs.pop_front();
+        stolen.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Runs and steals jobs until every element of the current parallelFor is done
+  void work(uint32_t self) {
+    Job job;
+    while (remaining.load(std::memory_order_acquire) > 0) {
+      if (pop(self, &job) || steal(self, &job)) {
+        run(self, job);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  void run(uint32_t self, Job job) {
+    while (job.end - job.begin > job.grain) {
+      uint32_t middle = job.begin + (job.end - job.begin) / 2;
+      push(self, {job.fn, middle, job.end, job.grain});
+      job.end = middle;
+    }
+    (*job.fn)(job.begin, job.end);
+    // Publishes the job's writes to whoever sees the count reach zero
+    remaining.fetch_sub(job.end - job.begin, std::memory_order_acq_rel);
+  }
+
+  // Sleeps between parallelFor calls, so idle frames cost no CPU
+  void workerLoop(uint32_t self) {
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [&] { return quit || epoch != seen; });
+        if (quit)
+          return;
+        seen = epoch;
+      }
+      work(self);
+    }
+  }
+
+  uint32_t threads = 1;
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<uint32_t> remaining{0};   // elements of the current parallelFor not yet run
+  std::atomic<uint64_t> stolen{0};
+
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  uint64_t epoch = 0;   // bumped by every parallelFor
+  bool quit = false;
+};
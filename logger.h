@@ -0,0 +1,79 @@
+#pragma once
+
+// Buffered logging. logLine() collects one line and appends it to a shared
+// buffer under a mutex; the buffer reaches stdout in one write when
+// flushLog() is called (once per frame and after startup), when it grows
+// past LOG_BUFFER_SIZE, and at exit. Unlike std::endl nothing flushes per
+// line, and lines from different threads never interleave.
+
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#define LOG_BUFFER_SIZE (64 * 1024)
+
+class Logger {
+public:
+  ~Logger() { flush(); }
+
+  void append(const std::string& line) {
+    std::lock_guard<std::mutex> lock(mutex);
+    buffer += line;
+    if (buffer.size() >= LOG_BUFFER_SIZE)
+      writeOut();
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    writeOut();
+  }
+
+private:
+  // Called with the mutex held
+  void writeOut() {
+    if (buffer.empty())
+      return;
+    fwrite(buffer.data(), 1, buffer.size(), stdout);
+    fflush(stdout);
+    buffer.clear();
+  }
+
+  std::mutex mutex;
+  std::string buffer;
+};
+
+inline Logger& logger() {
+  static Logger instance;
+  return instance;
+}
+
+// Streams into a line that is handed to the logger when the statement ends
+class LogLine {
+public:
+  LogLine() = default;
+  LogLine(const LogLine&) = delete;
+  LogLine& operator=(const LogLine&) = delete;
+
+  ~LogLine() {
+    stream << '\n';
+    logger().append(stream.str());
+  }
+
+  template <typename T>
+  LogLine& operator<<(const T& value) {
+    stream << value;
+    return *this;
+  }
+
+private:
+  std::ostringstream stream;
+};
+
+inline LogLine logLine() {
+  return LogLine();
+}
+
+inline void flushLog() {
+  logger().flush();
+}
@@ -3,38 +3,308 @@
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 
-#include <iostream>
 #include <optional>
 #include <set>
 #include <algorithm>
 #include <fstream>
+#include <vector>
+#include <chrono>
+#include <future>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+#include <cmath>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "profiler.h"
+#include "allocator.h"
+#include "recorder.h"
+#include "rendergraph.h"
+#include "pipelinecompiler.h"
+#include "queues.h"
+#include "culling.h"
+#include "textures.h"
+#include "bindless.h"
+#include "sprites.h"
+#include "resolution.h"
+#include "pacing.h"
+#include "mesh.h"
+#include "scene.h"
+#include "capture.h"
+#include "deletion.h"
+#include "logger.h"
+#include <string>
+
+// Generated by build.sh. Without it every shader is mapped from its .spv file.
+#if __has_include("shaders_spv.h")
+#include "shaders_spv.h"
+#define HAVE_EMBEDDED_SHADERS 1
+#else
+#define HAVE_EMBEDDED_SHADERS 0
+#endif
 
 #define WIDTH 800
 #define HEIGHT 600
 
-std::vector<char> readFile(const std::string& filename) {
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
-  if (!file.is_open())
-    throw std::runtime_error("failed to open file");
+// Number of frames the CPU may record ahead of the GPU. Override with
+// -DMAX_FRAMES_IN_FLIGHT=N; 2 or 3 keeps latency low while still overlapping work.
+#ifndef MAX_FRAMES_IN_FLIGHT
+#define MAX_FRAMES_IN_FLIGHT 2
+#endif
 
-  size_t size = (size_t)file.tellg();
-  std::vector<char> buffer(size);
-  file.seekg(0);
-  file.read(buffer.data(), size);
-  file.close();
-  return buffer;
+// SPIR-V words, either embedded in the binary or backed by a MappedFile
+struct SpirvCode {
+  const uint32_t* words = nullptr;
+  size_t size = 0;   // in bytes
+};
+
+#if HAVE_EMBEDDED_SHADERS
+const SpirvCode embeddedVert{vertSpirv, sizeof(vertSpirv)};
+const SpirvCode embeddedFrag{fragSpirv, sizeof(fragSpirv)};
+const SpirvCode embeddedCull{cullSpirv, sizeof(cullSpirv)};
+const SpirvCode embeddedBindlessVert{bindlessVertSpirv, sizeof(bindlessVertSpirv)};
+const SpirvCode embeddedBindlessFrag{bindlessFragSpirv, sizeof(bindlessFragSpirv)};
+const SpirvCode embeddedSpriteVert{spriteVertSpirv, sizeof(spriteVertSpirv)};
+const SpirvCode embeddedSpriteFrag{spriteFragSpirv, sizeof(spriteFragSpirv)};
+const SpirvCode embeddedSpriteFlatFrag{spriteFlatFragSpirv, sizeof(spriteFlatFragSpirv)};
+const SpirvCode embeddedUpscaleVert{upscaleVertSpirv, sizeof(upscaleVertSpirv)};
+const SpirvCode embeddedUpscaleFrag{upscaleFragSpirv, sizeof(upscaleFragSpirv)};
+#else
+const SpirvCode embeddedVert;
+const SpirvCode embeddedFrag;
+const SpirvCode embeddedCull;
+const SpirvCode embeddedBindlessVert;
+const SpirvCode embeddedBindlessFrag;
+const SpirvCode embeddedSpriteVert;
+const SpirvCode embeddedSpriteFrag;
+const SpirvCode embeddedSpriteFlatFrag;
+const SpirvCode embeddedUpscaleVert;
+const SpirvCode embeddedUpscaleFrag;
+#endif
+
+// Vertex and fragment stage of a graphics pipeline and the files they are mapped from
+struct ShaderPair {
+  SpirvCode vert;
+  SpirvCode frag;
+  const char* vertPath;
+  const char* fragPath;
+};
+
+const ShaderPair triangleShaders{embeddedVert, embeddedFrag, "vert.spv", "frag.spv"};
+const ShaderPair bindlessShaders{embeddedBindlessVert, embeddedBindlessFrag, "bindless_vert.spv", "bindless_frag.spv"};
+// Indexed by SPRITE_PIPELINE_*
+const ShaderPair spriteShaders[SPRITE_PIPELINE_COUNT] = {
+  {embeddedSpriteVert, embeddedSpriteFrag, "sprite_vert.spv", "sprite_frag.spv"},
+  {embeddedSpriteVert, embeddedSpriteFlatFrag, "sprite_vert.spv", "sprite_flat_frag.spv"},
+};
+const ShaderPair upscaleShaders{embeddedUpscaleVert, embeddedUpscaleFrag, "upscale_vert.spv", "upscale_frag.spv"};
+
+// Read-only mapping of a whole file. mmap returns page-aligned memory, so the
+// contents can go straight into pCode without a copy or an aligned buffer.
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    if (data != nullptr)
+      munmap(data, size);
+  }
+
+  bool open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return false;
+    }
+
+    void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+      return false;
+
+    data = mapped;
+    size = (size_t)st.st_size;
+    return true;
+  }
+
+  // Readers going front to back let the kernel read ahead further
+  void adviseSequential() const {
+    if (data != nullptr)
+      madvise(data, size, MADV_SEQUENTIAL);
+  }
+
+  SpirvCode code() const { return {static_cast<const uint32_t*>(data), size}; }
+  const void* bytes() const { return data; }
+  size_t length() const { return size; }
+
+private:
+  void* data = nullptr;
+  size_t size = 0;
+};
+
+struct Vertex {
+  glm::vec2 pos;
+  glm::vec3 color;
+};
+// .lvm files store vertices in this layout and are uploaded without conversion
+static_assert(sizeof(Vertex) == sizeof(MeshVertex) && offsetof(Vertex, color) == offsetof(MeshVertex, color),
+              "Vertex must match MeshVertex");
+
+// Same triangle the vertex shader used to hardcode
+const std::vector<Vertex> triangleVertices = {
+  {{ 0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+  {{ 0.5f,  0.5f}, {1.0f, 0.0f, 0.0f}},
+  {{-0.5f,  0.5f}, {1.0f, 0.0f, 0.0f}}
+};
+
+const std::vector<uint16_t> triangleIndices = {0, 1, 2};
+
+// Per-instance attributes, rewritten by the CPU every frame
+struct InstanceData {
+  glm::vec4 transform;  // xy offset, z scale, w rotation in radians
+  glm::vec4 color;
+};
+// The scene update writes instances in this layout straight into the mapped buffers
+static_assert(sizeof(InstanceData) == sizeof(SceneInstance) &&
+              offsetof(InstanceData, color) == offsetof(SceneInstance, color), "InstanceData must match SceneInstance");
+
+// Per-draw uniforms, bound through a dynamic offset into the UniformRing
+struct DrawUniforms {
+  glm::mat4 transform;
+  glm::vec4 tint;
+};
+
+// Tints cycled per draw so split draws are visible; a single draw stays white
+const glm::vec4 drawTints[] = {
+  {1.0f, 1.0f, 1.0f, 1.0f}, {1.0f, 0.6f, 0.6f, 1.0f}, {0.6f, 1.0f, 0.6f, 1.0f}, {0.6f, 0.6f, 1.0f, 1.0f},
+  {1.0f, 1.0f, 0.6f, 1.0f}, {1.0f, 0.6f, 1.0f, 1.0f}, {0.6f, 1.0f, 1.0f, 1.0f}, {0.8f, 0.8f, 0.8f, 1.0f},
+};
+
+// Instance counts swept by --bench instances
+const uint32_t instanceSweep[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+// Object counts swept by --bench culling
+const uint32_t cullSweep[] = {1000, 10000, 100000, 1000000};
+
+// Sprite counts swept by --bench sprites
+const uint32_t spriteSweep[] = {1000, 10000, 100000, 1000000};
+
+// Object counts swept by --bench scene
+const uint32_t sceneSweep[] = {100000, 1000000};
+
+// Side of the vertex grid --bench mesh generates when no --obj is given, about 2M triangles
+#define MESH_BENCH_GRID 1024
+
+// Frames each --texture stays on screen before the next one is shown
+#define TEXTURE_CYCLE_FRAMES 300
+
+// Window sizes --resize-stress cycles through. The first round warms up driver allocations
+// and memory is measured from its end, so the option needs more resizes than that.
+#define RESIZE_STRESS_WARMUP 5
+
+// Camera zoom used by --bench culling unless --zoom is given; at 4 about 1/16 of the grid is on screen
+#define CULL_BENCH_ZOOM 4.0f
+
+enum CullMode {
+  CULL_NONE,   // draw everything, the rasterizer clips
+  CULL_CPU,    // test on the CPU, one direct draw per visible object
+  CULL_GPU,    // compute pre-pass, one indirect draw
+};
+
+// How the triangle pass decides what to draw this frame
+struct FrameCulling {
+  CullMode mode = CULL_NONE;
+  glm::mat4 camera = glm::mat4(1.0f);
+  Frustum frustum;
+  // CULL_CPU: indices of the visible instances
+  const std::vector<uint32_t>* visible = nullptr;
+  // CULL_GPU: the pre-pass, skipped while its pipeline is compiling
+  GpuCuller* culler = nullptr;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  float meshRadius = 0.0f;
+};
+
+// Camera for --zoom: scales the view around the origin
+glm::mat4 zoomCamera(float zoom) {
+  glm::mat4 camera(1.0f);
+  camera[0][0] = zoom;
+  camera[1][1] = zoom;
+  return camera;
 }
 
+// Device-local geometry, sub-allocated from the DeviceAllocator
+struct Mesh {
+  VkBuffer vertexBuffer = VK_NULL_HANDLE;
+  Allocation vertexAlloc;
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  Allocation indexAlloc;
+  uint32_t indexCount = 0;
+  VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+  float radius = 0.0f;   // bounding circle around the origin, at scale 1
+};
+
+// One host-visible instance buffer per recording slot, so the CPU only ever
+// writes a buffer whose last submission has already retired
+struct InstanceBuffers {
+  std::vector<VkBuffer> buffers;
+  std::vector<Allocation> allocs;
+  uint32_t count = 0;
+};
+
 struct QueueFamilyIndices {
   std::optional<uint32_t> graphicsFamily;
   std::optional<uint32_t> presentFamily;
-
-  bool isComplete() {
-    return graphicsFamily.has_value() && presentFamily.has_value();
+  // Only set when the device has families without graphics; otherwise that
+  // work shares the graphics queue
+  std::optional<uint32_t> transferFamily;
+  std::optional<uint32_t> computeFamily;
+
+  // Headless runs have no surface and therefore no present family to look for
+  bool isComplete(bool needsPresent = true) {
+    return graphicsFamily.has_value() && (presentFamily.has_value() || !needsPresent);
   }
+
+  uint32_t transfer() const { return transferFamily.value_or(graphicsFamily.value()); }
+  uint32_t compute() const { return computeFamily.value_or(graphicsFamily.value()); }
+};
+
+// Everything that has to be rebuilt when the surface changes size
+struct SwapChain {
+  VkSwapchainKHR handle = VK_NULL_HANDLE;
+  std::vector<VkImage> images;
+  VkFormat imageFormat;
+  VkExtent2D extent;
+  std::vector<VkImageView> imageViews;
+  std::vector<VkSemaphore> renderFinished;   // per image, waited on by its present
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  VkImageUsageFlags imageUsage = 0;
+};
+
+// What the swapchain is asked for; the surface decides what it gets
+struct PresentSettings {
+  // Without a requested mode MAILBOX is preferred, then FIFO
+  bool modeSet = false;
+  VkPresentModeKHR mode = VK_PRESENT_MODE_FIFO_KHR;
+  // 0 asks for one more than the surface minimum
+  uint32_t imageCount = 0;
+  // Usage on top of color attachment, e.g. TRANSFER_SRC to capture frames; dropped when unsupported
+  VkImageUsageFlags extraUsage = 0;
 };
 
 struct SwapChainSupportDetails {
@@ -52,20 +322,30 @@ QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surfa
   std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
   vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
-  int32_t i = 0;
-  for (const auto& queueFamily : queueFamilies) {
-    if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+  for (uint32_t i = 0; i < queueFamilyCount; i++) {
+    VkQueueFlags flags = queueFamilies[i].queueFlags;
+    if ((flags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphicsFamily) {
       indices.graphicsFamily = i;
     }
 
-    VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-    if (presentSupport) {
-      indices.presentFamily = i;
+    // Transfer-only families are the copy engines, they run next to graphics
+    if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+        !indices.transferFamily) {
+      indices.transferFamily = i;
+    }
+
+    if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && !indices.computeFamily) {
+      indices.computeFamily = i;
     }
 
-    if (indices.isComplete()) break;
-    i++;
+    // Presenting from the graphics family saves a queue handoff
+    if (surface != VK_NULL_HANDLE) {
+      VkBool32 presentSupport = false;
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+      if (presentSupport && (!indices.presentFamily || indices.graphicsFamily == i)) {
+        indices.presentFamily = i;
+      }
+    }
   }
 
   return indices;
@@ -97,186 +377,732 @@ VkSurfaceFormatKHR chooseSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& fo
   return formats[0];
 }
 
-VkPresentModeKHR choosePresentMode(const std::vector<VkPresentModeKHR>& modes) {
+const char* presentModeName(VkPresentModeKHR mode) {
+  switch (mode) {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+  case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+  case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+  case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+  default: return "unknown";
+  }
+}
+
+// FIFO is the only mode every surface supports, so it is the fallback
+VkPresentModeKHR choosePresentMode(const std::vector<VkPresentModeKHR>& modes, const PresentSettings& settings) {
+  VkPresentModeKHR wanted = settings.modeSet ? settings.mode : VK_PRESENT_MODE_MAILBOX_KHR;
   for (const auto& m : modes) {
-    if (m == VK_PRESENT_MODE_MAILBOX_KHR)
+    if (m == wanted)
       return m;
   }
+  if (settings.modeSet && wanted != VK_PRESENT_MODE_FIFO_KHR) {
+    logLine() << "Present mode " << presentModeName(wanted) << " is not supported, using fifo";
+  }
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR& caps) {
+VkExtent2D chooseExtent(const VkSurfaceCapabilitiesKHR& caps, GLFWwindow* window) {
   if (caps.currentExtent.width != UINT32_MAX)
     return caps.currentExtent;
 
-  VkExtent2D extent{WIDTH, HEIGHT};
+  int width, height;
+  glfwGetFramebufferSize(window, &width, &height);
+
+  VkExtent2D extent{(uint32_t)width, (uint32_t)height};
   extent.width = std::clamp(extent.width, caps.minImageExtent.width, caps.maxImageExtent.width);
   extent.height = std::clamp(extent.height, caps.minImageExtent.height, caps.maxImageExtent.height);
   return extent;
 }
 
-VkShaderModule createShaderModule(VkDevice device, const std::vector<char>& code) {
+// Returns VK_NULL_HANDLE for anything that is not SPIR-V, e.g. a file caught mid-write
+VkShaderModule createShaderModule(VkDevice device, const SpirvCode& code) {
+  const uint32_t spirvMagic = 0x07230203;
+  if (code.size < 4 || code.size % 4 != 0 || code.words[0] != spirvMagic) {
+    logLine() << "Invalid SPIR-V (" << code.size << " bytes)";
+    return VK_NULL_HANDLE;
+  }
+
   VkShaderModuleCreateInfo info{};
   info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  info.codeSize = code.size();
-  info.pCode = reinterpret_cast<const uint32_t*>(code.data());
+  info.codeSize = code.size;
+  info.pCode = code.words;
 
-  VkShaderModule shaderModule;
+  VkShaderModule shaderModule = VK_NULL_HANDLE;
   if (vkCreateShaderModule(device, &info, nullptr, &shaderModule) != VK_SUCCESS) {
-    std::cout << "Failed to create shader module" << std::endl;
+    logLine() << "Failed to create shader module";
+    shaderModule = VK_NULL_HANDLE;
   }
 
   return shaderModule;
 }
 
-int main() {
-  GLFWwindow* window;
-  VkInstance instance;
+struct Options {
+  bool headless = false;
+  uint32_t frames = 1000;
+  std::string pipelineCachePath = "pipeline_cache.bin";
+  bool coldCache = false;
+  uint32_t resizeStress = 0;
+  std::string profilePath;
+  // Runs the named benchmark instead of the frame loop
+  std::string bench;
+  uint32_t instances = 1;
+  // Draw calls per frame, each covering a slice of the instances
+  uint32_t draws = 1;
+  // Address uniforms and textures through the bindless table instead of per-draw descriptor sets
+  bool bindless = false;
+  // Threads recording secondary command buffers, including the main thread
+  uint32_t threads = 1;
+  // Threads updating the scene, including the main thread; 0 uses every core
+  uint32_t jobThreads = 0;
+  // Move the instances over time in the window; otherwise every frame shows their starting pose
+  bool animate = false;
+  // Load shaders from the .spv files even when they are embedded
+  bool externalShaders = false;
+  // Keep transfers and compute on the graphics queue even when the device has dedicated families
+  bool singleQueue = false;
+  // Startup breakdown as JSON, for comparing builds
+  std::string startupReportPath;
+  // Frame-time percentiles, startup and peak memory of a headless run, read by regress
+  std::string frameReportPath;
+  // Record no draws, the frame is only the clear
+  bool clearOnly = false;
+  // Frustum culling of the instances; replaces the --draws split when enabled
+  CullMode cull = CULL_NONE;
+  // Camera zoom, values above 1 push instances off screen
+  float zoom = 1.0f;
+  bool zoomSet = false;
+  // PPM images streamed in and shown in turn; without any the triangle is untextured
+  std::vector<std::string> textures;
+  uint32_t textureBudgetMb = TEXTURE_BUDGET_MB;
+  // Batched quads and sprites drawn over the instances
+  uint32_t sprites = 0;
+  PresentSettings present;
+  // .lvm mesh drawn instead of the built-in triangle
+  std::string meshPath;
+  // Scene for --bench mesh; a generated grid without one
+  std::string objPath;
+  // Frame rate cap, 0 for none
+  double maxFps = 0.0;
+  // Start each frame's CPU work as late as the frame rate allows
+  bool lowLatency = false;
+  // Render the scene at a scale picked from GPU timings and upscale it to the backbuffer
+  bool dynamicResolution = false;
+  float minScale = DYNAMIC_RES_MIN_SCALE;
+  float maxScale = DYNAMIC_RES_MAX_SCALE;
+  float gpuBudgetMs = DYNAMIC_RES_BUDGET_MS;
+  // Frames copied out to PATH_<frame>.png, or one raw stream for a .raw path
+  std::string capturePath;
+  uint32_t captureSlots = CAPTURE_SLOTS;
+};
 
-  VkSurfaceKHR surface;
-  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-  VkDevice device;
-  VkQueue graphicsQueue;
+// Numeric option values; false unless the whole argument parses, so a bad
+// value falls through to the usage message like an unknown option
+bool parseUint(const char* text, uint32_t* value) {
+  char* end = nullptr;
+  errno = 0;
+  unsigned long parsed = strtoul(text, &end, 10);
+  if (end == text || *end != '\0' || errno == ERANGE || text[0] == '-' || parsed > UINT32_MAX)
+    return false;
+  *value = (uint32_t)parsed;
+  return true;
+}
 
-  VkSwapchainKHR swapChain;
-  std::vector<VkImage> swapChainImages;
-  VkFormat swapChainImageFormat;
-  VkExtent2D swapChainExtent;
-  std::vector<VkImageView> swapChainImageViews;
+template <typename T>
+bool parseFloat(const char* text, T* value) {
+  char* end = nullptr;
+  T parsed = (T)strtod(text, &end);
+  if (end == text || *end != '\0' || !std::isfinite(parsed))
+    return false;
+  *value = parsed;
+  return true;
+}
 
-  VkRenderPass renderPass;
-  std::vector<VkFramebuffer> swapChainFramebuffers;
+Options parseOptions(int argc, char** argv) {
+  Options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--headless") {
+      opts.headless = true;
+    } else if (arg == "--frames" && i + 1 < argc && parseUint(argv[i + 1], &opts.frames)) {
+      i++;
+    } else if (arg == "--pipeline-cache" && i + 1 < argc) {
+      opts.pipelineCachePath = argv[++i];
+    } else if (arg == "--cold-cache") {
+      opts.coldCache = true;
+    } else if (arg == "--resize-stress" && i + 1 < argc && parseUint(argv[i + 1], &opts.resizeStress) &&
+               opts.resizeStress > RESIZE_STRESS_WARMUP) {
+      i++;
+    } else if (arg == "--profile" && i + 1 < argc) {
+      opts.profilePath = argv[++i];
+    } else if (arg == "--bench" && i + 1 < argc) {
+      opts.bench = argv[++i];
+    } else if (arg == "--instances" && i + 1 < argc && parseUint(argv[i + 1], &opts.instances)) {
+      i++;
+      opts.instances = std::max(1u, opts.instances);
+    } else if (arg == "--draws" && i + 1 < argc && parseUint(argv[i + 1], &opts.draws)) {
+      i++;
+      opts.draws = std::max(1u, opts.draws);
+    } else if (arg == "--external-shaders") {
+      opts.externalShaders = true;
+    } else if (arg == "--bindless") {
+      opts.bindless = true;
+    } else if (arg == "--single-queue") {
+      opts.singleQueue = true;
+    } else if (arg == "--threads" && i + 1 < argc && parseUint(argv[i + 1], &opts.threads)) {
+      i++;
+      opts.threads = std::max(1u, opts.threads);
+    } else if (arg == "--jobs" && i + 1 < argc && parseUint(argv[i + 1], &opts.jobThreads)) {
+      i++;
+    } else if (arg == "--animate") {
+      opts.animate = true;
+    } else if (arg == "--startup-report" && i + 1 < argc) {
+      opts.startupReportPath = argv[++i];
+    } else if (arg == "--frame-report" && i + 1 < argc) {
+      opts.frameReportPath = argv[++i];
+    } else if (arg == "--clear-only") {
+      opts.clearOnly = true;
+    } else if (arg == "--cull" && i + 1 < argc && (std::string(argv[i + 1]) == "none" ||
+               std::string(argv[i + 1]) == "cpu" || std::string(argv[i + 1]) == "gpu")) {
+      std::string mode = argv[++i];
+      opts.cull = mode == "cpu" ? CULL_CPU : mode == "gpu" ? CULL_GPU : CULL_NONE;
+    } else if (arg == "--texture" && i + 1 < argc) {
+      opts.textures.push_back(argv[++i]);
+    } else if (arg == "--texture-budget" && i + 1 < argc && parseUint(argv[i + 1], &opts.textureBudgetMb)) {
+      i++;
+      opts.textureBudgetMb = std::max(1u, opts.textureBudgetMb);
+    } else if (arg == "--sprites" && i + 1 < argc && parseUint(argv[i + 1], &opts.sprites)) {
+      i++;
+    } else if (arg == "--present-mode" && i + 1 < argc && (std::string(argv[i + 1]) == "immediate" ||
+               std::string(argv[i + 1]) == "mailbox" || std::string(argv[i + 1]) == "fifo" ||
+               std::string(argv[i + 1]) == "fifo-relaxed")) {
+      std::string mode = argv[++i];
+      opts.present.modeSet = true;
+      opts.present.mode = mode == "immediate" ? VK_PRESENT_MODE_IMMEDIATE_KHR
+                        : mode == "mailbox"   ? VK_PRESENT_MODE_MAILBOX_KHR
+                        : mode == "fifo"      ? VK_PRESENT_MODE_FIFO_KHR
+                                              : VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    } else if (arg == "--swapchain-images" && i + 1 < argc && parseUint(argv[i + 1], &opts.present.imageCount)) {
+      i++;
+    } else if (arg == "--max-fps" && i + 1 < argc && parseFloat(argv[i + 1], &opts.maxFps)) {
+      i++;
+      opts.maxFps = std::max(0.0, opts.maxFps);
+    } else if (arg == "--low-latency") {
+      opts.lowLatency = true;
+    } else if (arg == "--mesh" && i + 1 < argc) {
+      opts.meshPath = argv[++i];
+    } else if (arg == "--obj" && i + 1 < argc) {
+      opts.objPath = argv[++i];
+    } else if (arg == "--dynamic-resolution") {
+      opts.dynamicResolution = true;
+    } else if (arg == "--min-scale" && i + 1 < argc && parseFloat(argv[i + 1], &opts.minScale)) {
+      i++;
+      opts.minScale = std::min(std::max(opts.minScale, 0.1f), 2.0f);
+    } else if (arg == "--max-scale" && i + 1 < argc && parseFloat(argv[i + 1], &opts.maxScale)) {
+      i++;
+      opts.maxScale = std::min(std::max(opts.maxScale, 0.1f), 2.0f);
+    } else if (arg == "--gpu-budget" && i + 1 < argc && parseFloat(argv[i + 1], &opts.gpuBudgetMs)) {
+      i++;
+      opts.gpuBudgetMs = std::max(0.1f, opts.gpuBudgetMs);
+    } else if (arg == "--capture" && i + 1 < argc) {
+      opts.capturePath = argv[++i];
+      opts.present.extraUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    } else if (arg == "--capture-slots" && i + 1 < argc && parseUint(argv[i + 1], &opts.captureSlots)) {
+      i++;
+      opts.captureSlots = std::max(1u, opts.captureSlots);
+    } else if (arg == "--zoom" && i + 1 < argc && parseFloat(argv[i + 1], &opts.zoom)) {
+      i++;
+      opts.zoom = std::max(0.01f, opts.zoom);
+      opts.zoomSet = true;
+    } else {
+      logLine() << "Unknown option or bad value: " << arg;
+      logLine() << "Usage: main [--headless] [--frames N] [--pipeline-cache PATH] [--cold-cache]"
+                << " [--resize-stress N] [--profile trace.json|trace.csv] [--startup-report startup.json]"
+                << " [--frame-report frames.json] [--clear-only]"
+                << " [--instances N] [--draws N] [--threads N] [--jobs N] [--animate]"
+                << " [--bindless] [--external-shaders] [--single-queue]"
+                << " [--cull none|cpu|gpu] [--zoom F] [--texture image.ppm]... [--texture-budget MB] [--sprites N]"
+                << " [--dynamic-resolution [--min-scale F] [--max-scale F] [--gpu-budget MS]]"
+                << " [--present-mode immediate|mailbox|fifo|fifo-relaxed] [--swapchain-images N] [--max-fps N]"
+                << " [--low-latency] [--mesh scene.lvm] [--obj scene.obj]"
+                << " [--capture frames.png|frames.raw [--capture-slots N]]"
+                << " [--bench upload|instances|recording|culling|bindless|sprites|mesh|scene]";
+      exit(1);
+    }
+  }
+  // Every draw gets at least one instance
+  opts.instances = std::max(opts.instances, opts.draws);
+  opts.minScale = std::min(opts.minScale, opts.maxScale);
+  return opts;
+}
 
-  VkPipelineLayout pipelineLayout;
-  VkPipeline graphicsPipeline;
+uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeBits, VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceMemoryProperties memProps;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
 
-  VkCommandPool commandPool;
-  std::vector<VkCommandBuffer> commandBuffers;
+  for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+    if ((typeBits & (1 << i)) && (memProps.memoryTypes[i].propertyFlags & properties) == properties)
+      return i;
+  }
+  throw std::runtime_error("failed to find suitable memory type");
+}
 
-  VkSemaphore imageAvailableSemaphore;
-  VkSemaphore renderFinishedSemaphore;
-  VkFence inFlightFence;
+// Largest copy staged at once, so meshes bigger than the staging ring still upload
+#define MESH_UPLOAD_CHUNK (8ull * 1024 * 1024)
+
+// Stages `size` bytes from `data` into dst in chunks. When the ring is full the
+// copies so far are submitted and recording continues in a new command buffer,
+// returned through `cmd`, once they are done.
+bool stageChunked(QueueHandoff* uploads, StagingRing* staging, VkCommandBuffer* cmd, VkBuffer dst,
+                  const void* data, VkDeviceSize size) {
+  const char* src = static_cast<const char*>(data);
+  for (VkDeviceSize offset = 0; offset < size;) {
+    VkDeviceSize chunk = std::min<VkDeviceSize>(size - offset, MESH_UPLOAD_CHUNK);
+    if (!staging->upload(*cmd, dst, offset, src + offset, chunk)) {
+      if (uploads->submit() != VK_SUCCESS)
+        return false;
+      *cmd = uploads->begin();
+      staging->reset();
+      if (!staging->upload(*cmd, dst, offset, src + offset, chunk))
+        return false;
+    }
+    offset += chunk;
+  }
+  return true;
+}
 
-  // Init
-  glfwInit();
+void destroyMesh(DeviceAllocator* allocator, Mesh* mesh) {
+  if (mesh->vertexBuffer != VK_NULL_HANDLE)
+    allocator->destroyBuffer(mesh->vertexBuffer, mesh->vertexAlloc);
+  if (mesh->indexBuffer != VK_NULL_HANDLE)
+    allocator->destroyBuffer(mesh->indexBuffer, mesh->indexAlloc);
+  *mesh = Mesh{};
+}
 
-  // Creating window
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan window", nullptr, nullptr);
+// Creates device-local vertex and index buffers and fills them through the staging ring on the
+// upload queue. Returns once the copies are submitted: graphics work submitted afterwards is
+// ordered behind them, and the graphics queue acquires the buffers. On failure `mesh` is left empty.
+VkResult uploadMesh(QueueHandoff* uploads, DeviceAllocator* allocator, StagingRing* staging,
+                    const void* vertices, VkDeviceSize vertexSize, const void* indices, VkDeviceSize indexSize,
+                    VkIndexType indexType, float radius, Mesh* mesh) {
+  VkResult result = allocator->createBuffer(
+    vertexSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->vertexBuffer, &mesh->vertexAlloc
+  );
+  if (result != VK_SUCCESS)
+    return result;
+
+  result = allocator->createBuffer(
+    indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->indexBuffer, &mesh->indexAlloc
+  );
+  if (result != VK_SUCCESS) {
+    destroyMesh(allocator, mesh);
+    return result;
+  }
 
-  if (!window) {
-    std::cout << "Failed to create window" << std::endl;
+  mesh->indexType = indexType;
+  mesh->indexCount = (uint32_t)(indexSize / (indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4));
+  mesh->radius = radius;
+
+  // begin() waits for the previous batch, which frees the whole ring
+  VkCommandBuffer cmd = uploads->begin();
+  staging->reset();
+
+  if (!stageChunked(uploads, staging, &cmd, mesh->vertexBuffer, vertices, vertexSize) ||
+      !stageChunked(uploads, staging, &cmd, mesh->indexBuffer, indices, indexSize)) {
+    // A failed chunk submit already ended the batch; otherwise it is dropped unsubmitted.
+    // Earlier chunk batches were waited for by begin(), so the buffers can go now.
+    uploads->cancel();
+    destroyMesh(allocator, mesh);
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
   }
 
-  // Create app information
-  VkApplicationInfo appInfo{};
-  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-  appInfo.pApplicationName = "Learning Vulkan";
-  appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.pEngineName = "What?";
-  appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  uploads->handOff(mesh->vertexBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+  uploads->handOff(mesh->indexBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
 
-  uint32_t extensionCount = 0;
-  const char** extensions;
-  extensions = glfwGetRequiredInstanceExtensions(&extensionCount);
+  return uploads->submit();
+}
 
-  std::cout << "Extensions:" << std::endl;
-  for (int i = 0; i < extensionCount; i++) {
-    std::cout << " - " << extensions[i] << std::endl;
+VkResult createMesh(QueueHandoff* uploads, DeviceAllocator* allocator, StagingRing* staging,
+                    const std::vector<Vertex>& vertices, const std::vector<uint16_t>& indices, Mesh* mesh) {
+  float radius = 0.0f;
+  for (const Vertex& v : vertices) {
+    radius = std::max(radius, glm::length(v.pos));
   }
-  std::cout << std::endl;
+  return uploadMesh(uploads, allocator, staging, vertices.data(), sizeof(Vertex) * vertices.size(),
+                    indices.data(), sizeof(uint16_t) * indices.size(), VK_INDEX_TYPE_UINT16, radius, mesh);
+}
 
-  // Create instance information
-  VkInstanceCreateInfo createInfo{};
-  createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-  createInfo.pApplicationInfo = &appInfo;
-  createInfo.enabledExtensionCount = extensionCount;
-  createInfo.ppEnabledExtensionNames = extensions;
+// Maps a .lvm file and stages its blobs straight from the mapping; the
+// radius comes from the stored bounds, so no vertex is read on the CPU
+VkResult loadMeshFile(QueueHandoff* uploads, DeviceAllocator* allocator, StagingRing* staging,
+                      const std::string& path, Mesh* mesh) {
+  MappedFile file;
+  MeshFileView view;
+  if (!file.open(path) || !openMeshFile(file.bytes(), file.length(), &view)) {
+    logLine() << "Invalid mesh file: " << path;
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+  file.adviseSequential();
 
-  // Create the vulkan instance
-  if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
-    std::cout << "Failed to create vulkan instance" << std::endl;
-    return 1;
+  const MeshFileHeader& header = *view.header;
+  return uploadMesh(uploads, allocator, staging, view.vertices, view.vertexBytes, view.indices, view.indexBytes,
+                    header.indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32,
+                    meshBoundsRadius(header.boundsMin, header.boundsMax), mesh);
+}
+
+// Reallocates every slot's instance buffer for `count` instances, shared across
+// `families` when the GPU cull reads them from another queue family
+VkResult resizeInstanceBuffers(DeviceAllocator* allocator, size_t slots, uint32_t count,
+                               const std::vector<uint32_t>& families, InstanceBuffers* instances) {
+  for (size_t i = 0; i < instances->buffers.size(); i++) {
+    allocator->destroyBuffer(instances->buffers[i], instances->allocs[i]);
   }
-  std::cout << "Vulkan Instance Created" << std::endl;
 
-  // Create the surface
-  if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
-    std::cout << "Failed to create surface" << std::endl;
-    return 1;
+  instances->buffers.assign(slots, VK_NULL_HANDLE);
+  instances->allocs.assign(slots, Allocation{});
+  instances->count = count;
+
+  for (size_t i = 0; i < slots; i++) {
+    VkResult result = allocator->createBuffer(
+      sizeof(InstanceData) * count, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      &instances->buffers[i], &instances->allocs[i], families
+    );
+    if (result != VK_SUCCESS) {
+      instances->buffers.resize(i);
+      instances->allocs.resize(i);
+      return result;
+    }
   }
+  return VK_SUCCESS;
+}
 
-  // Pick physical device
-  uint32_t deviceCount = 0;
-  vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+void destroyInstanceBuffers(DeviceAllocator* allocator, InstanceBuffers* instances) {
+  for (size_t i = 0; i < instances->buffers.size(); i++) {
+    allocator->destroyBuffer(instances->buffers[i], instances->allocs[i]);
+  }
+  instances->buffers.clear();
+  instances->allocs.clear();
+}
 
-  if (deviceCount == 0) {
-    std::cout << "Failed to find GPUs with vulkan support" << std::endl;
-    return 1;
+// Rewrites the instances for `time` across the job threads, laying the scene
+// out again first when the instance count changed
+void writeInstances(JobSystem* jobs, SceneTransforms* scene, InstanceData* dst, uint32_t count, float time) {
+  if (scene->size() != count) {
+    scene->layoutGrid(count);
   }
-  std::cout << "Devices Found: " << deviceCount << std::endl;
+  scene->update(jobs, time, reinterpret_cast<SceneInstance*>(dst));
+}
 
-  std::vector<VkPhysicalDevice> devices(deviceCount);
-  vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+// Collects the indices of the instances whose bounding circle touches the frustum
+void cullInstances(const Frustum& frustum, float meshRadius, const InstanceData* instances, uint32_t count,
+                   std::vector<uint32_t>* visible) {
+  visible->clear();
+  for (uint32_t i = 0; i < count; i++) {
+    const glm::vec4& t = instances[i].transform;
+    if (circleVisible(frustum, glm::vec2(t.x, t.y), meshRadius * t.z)) {
+      visible->push_back(i);
+    }
+  }
+}
 
-  for (const auto& dev : devices) {
-    QueueFamilyIndices indices = findQueueFamilies(dev, surface);
-    if (indices.isComplete()) {
-      physicalDevice = dev;
-      break;
+// A grid of spinning quads over the viewport with every other one a sprite,
+// spread over `textureCount` textures and shuffled in depth so sorting has work to do
+void writeSprites(SpriteBatch* batch, uint32_t count, uint32_t textureCount, float time) {
+  uint32_t side = (uint32_t)std::ceil(std::sqrt((double)count));
+  float cell = 2.0f / side;
+
+  batch->clear();
+  for (uint32_t i = 0; i < count; i++) {
+    glm::vec2 center(-1.0f + cell * (i % side + 0.5f), -1.0f + cell * (i / side + 0.5f));
+    glm::vec2 size(cell * 0.8f, cell * 0.8f);
+    float rotation = time * (1.0f + (i & 3) * 0.5f);
+    float depth = (float)((i * 2654435761u) >> 8) / (float)(1u << 24);
+    glm::vec4 color = drawTints[(i >> 1) & 7];
+    color.w = 0.8f;
+
+    if (i & 1) {
+      batch->sprite((i >> 1) % textureCount, center, size, rotation, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), color, depth);
+    } else {
+      batch->quad(center, size, rotation, color, depth);
     }
   }
+}
 
-  if (physicalDevice == VK_NULL_HANDLE) {
-    std::cout << "Failed to find physical device" << std::endl;
-    return 1;
+// CPU cost of sorting and expanding sprites, SIMD against the scalar kernel.
+// Vertices go to ordinary memory here; in frames they go to the mapped ring.
+void runSpriteBenchmark() {
+  const uint32_t textureCount = 8;
+  SpriteBatch batch;
+  std::vector<SpriteVertex> vertices;
+
+  for (uint32_t count : spriteSweep) {
+    writeSprites(&batch, count, textureCount, 1.0f);
+    vertices.resize((size_t)count * 4);
+    uint32_t repeats = std::max(1u, 4000000 / count);
+
+    size_t draws = 0;
+    double ms[2] = {};
+    for (int simd = 1; simd >= 0; simd--) {
+      auto begin = std::chrono::steady_clock::now();
+      for (uint32_t r = 0; r < repeats; r++) {
+        draws = batch.build(vertices.data(), simd).size();
+      }
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+      ms[simd] = elapsed.count() / repeats;
+    }
+
+    logLine() << "Sprite bench: " << count << " sprites in " << draws << " draws, "
+              << count / ms[1] << " sprites/ms " << spriteKernelName() << " (" << ms[1] << " ms), "
+              << count / ms[0] << " sprites/ms scalar (" << ms[0] << " ms)";
   }
-  std::cout << "Found physical device" << std::endl;
+  flushLog();
+}
 
-  // Creating the device
-  QueueFamilyIndices indices = findQueueFamilies(physicalDevice, surface);
+// Scene update throughput from one thread up to `maxThreads` (every core
+// when 0), writing into a host-visible buffer as the frame loop does
+void runSceneBenchmark(DeviceAllocator* allocator, uint32_t maxThreads) {
+  if (maxThreads == 0) {
+    maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<uint32_t> threadCounts;
+  for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(maxThreads);
+
+  for (uint32_t count : sceneSweep) {
+    VkBuffer buffer;
+    Allocation alloc;
+    if (allocator->createBuffer(sizeof(SceneInstance) * count, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                &buffer, &alloc) != VK_SUCCESS) {
+      logLine() << "Failed to allocate " << count << " instances";
+      return;
+    }
+    SceneInstance* dst = static_cast<SceneInstance*>(alloc.mapped);
+
+    SceneTransforms scene;
+    scene.layoutGrid(count);
+    uint32_t repeats = std::max(1u, 20000000 / count);
+    auto measure = [&](JobSystem* jobs, bool simd) {
+      scene.update(jobs, 0.0f, dst, simd);   // warm up the threads and the mapping
+      auto begin = std::chrono::steady_clock::now();
+      for (uint32_t r = 0; r < repeats; r++) {
+        scene.update(jobs, r * 0.016f, dst, simd);
+      }
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+      return elapsed.count() / repeats;
+    };
 
-  float queuePriority = 1.0f;
+    JobSystem jobs;
+    jobs.start(1);
+    double scalarMs = measure(&jobs, false);
+    logLine() << "Scene bench: " << count << " objects, 1 thread scalar: " << scalarMs << " ms";
+
+    double singleMs = 0.0;
+    for (uint32_t threads : threadCounts) {
+      jobs.start(threads);
+      double ms = measure(&jobs, true);
+      if (threads == 1) {
+        singleMs = ms;
+      }
+      logLine() << "Scene bench: " << count << " objects, " << threads << " threads " << sceneKernelName() << ": "
+                << ms << " ms (" << count / ms << " objects/ms, " << singleMs / ms << "x one thread, "
+                << jobs.steals() << " steals)";
+    }
 
-  VkDeviceQueueCreateInfo queueCreateInfo{};
-  queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-  queueCreateInfo.queueFamilyIndex = indices.graphicsFamily.value();
-  queueCreateInfo.queueCount = 1;
-  queueCreateInfo.pQueuePriorities = &queuePriority;
+    allocator->destroyBuffer(buffer, alloc);
+  }
+  flushLog();
+}
 
-  VkPhysicalDeviceFeatures deviceFeatures{};
+// Load time of a large scene, parsing OBJ against mapping the converted .lvm.
+// Both end in the same upload, and both files are read warm from the page cache.
+void runMeshBenchmark(QueueHandoff* uploads, DeviceAllocator* allocator, StagingRing* staging, std::string objPath) {
+  const int repeats = 3;
+  const std::string lvmPath = "mesh_bench.lvm";
+  bool generated = objPath.empty();
+
+  // The files this writes go on every exit path, including the failed ones
+  struct RemoveOnExit {
+    std::vector<std::string> paths;
+    ~RemoveOnExit() {
+      for (const std::string& path : paths) {
+        std::remove(path.c_str());
+      }
+    }
+  } written;
+  written.paths.push_back(lvmPath);
+
+  if (generated) {
+    objPath = "mesh_bench.obj";
+    written.paths.push_back(objPath);
+    FILE* file = std::fopen(objPath.c_str(), "w");
+    if (file == nullptr) {
+      logLine() << "Failed to write " << objPath;
+      return;
+    }
+    const uint32_t n = MESH_BENCH_GRID;
+    for (uint32_t y = 0; y < n; y++) {
+      for (uint32_t x = 0; x < n; x++) {
+        std::fprintf(file, "v %f %f 0 %f %f 0.5\n", (float)x / n - 0.5f, (float)y / n - 0.5f, (float)x / n,
+                     (float)y / n);
+      }
+    }
+    for (uint32_t y = 0; y + 1 < n; y++) {
+      for (uint32_t x = 0; x + 1 < n; x++) {
+        uint32_t a = y * n + x + 1;
+        std::fprintf(file, "f %u %u %u %u\n", a, a + 1, a + n + 1, a + n);
+      }
+    }
+    std::fclose(file);
+  }
 
-  const std::vector<const char*> deviceExtensions = {
-    VK_KHR_SWAPCHAIN_EXTENSION_NAME
-  };
+  ObjMesh converted;
+  if (!parseObj(objPath.c_str(), &converted) || !writeMeshFile(lvmPath.c_str(), converted)) {
+    logLine() << "Failed to convert " << objPath;
+    return;
+  }
+  converted = ObjMesh{};
+
+  double objMs = 1e30, lvmMs = 1e30;
+  size_t triangles = 0;
+  for (int r = 0; r < repeats; r++) {
+    Mesh mesh;
+    auto begin = std::chrono::steady_clock::now();
+    ObjMesh obj;
+    VkResult result = VK_ERROR_INITIALIZATION_FAILED;
+    if (parseObj(objPath.c_str(), &obj)) {
+      float radius = 0.0f;
+      for (const MeshVertex& v : obj.vertices) {
+        radius = std::max(radius, std::sqrt(v.pos[0] * v.pos[0] + v.pos[1] * v.pos[1]));
+      }
+      result = uploadMesh(uploads, allocator, staging, obj.vertices.data(), sizeof(MeshVertex) * obj.vertices.size(),
+                          obj.indices.data(), sizeof(uint32_t) * obj.indices.size(), VK_INDEX_TYPE_UINT32, radius,
+                          &mesh);
+    }
+    // Both timings include the copy landing, and the mesh is destroyed right after
+    uploads->wait();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+    destroyMesh(allocator, &mesh);
+    if (result != VK_SUCCESS) {
+      logLine() << "Mesh bench: OBJ load failed";
+      return;
+    }
+    objMs = std::min(objMs, elapsed.count());
+    triangles = obj.indices.size() / 3;
+
+    begin = std::chrono::steady_clock::now();
+    result = loadMeshFile(uploads, allocator, staging, lvmPath, &mesh);
+    uploads->wait();
+    elapsed = std::chrono::steady_clock::now() - begin;
+    destroyMesh(allocator, &mesh);
+    if (result != VK_SUCCESS) {
+      logLine() << "Mesh bench: .lvm load failed";
+      return;
+    }
+    lvmMs = std::min(lvmMs, elapsed.count());
+  }
 
-  VkDeviceCreateInfo deviceCreateInfo{};
-  deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-  deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-  deviceCreateInfo.queueCreateInfoCount = 1;
-  deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-  deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-  deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  logLine() << "Mesh bench: " << triangles << " triangles, OBJ parse + upload " << objMs << " ms, .lvm map + upload "
+            << lvmMs << " ms (" << objMs / lvmMs << "x)";
+  flushLog();
+}
 
-  if (vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device) != VK_SUCCESS) {
-    std::cout << "Failed to create logical device" << std::endl;
-    return 1;
+// Many small buffers through the sub-allocator, then a bulk stream through the staging ring
+void runUploadBenchmark(QueueHandoff* uploads, DeviceAllocator* allocator, StagingRing* staging) {
+  const uint32_t bufferCount = 4096;
+  const VkDeviceSize bufferSize = 64 * 1024;
+  const VkDeviceSize streamBytes = 512ull * 1024 * 1024;
+
+  std::vector<VkBuffer> buffers(bufferCount);
+  std::vector<Allocation> allocs(bufferCount);
+
+  uint64_t blocksBefore = allocator->getStats().totalDeviceAllocations;
+  auto allocBegin = std::chrono::steady_clock::now();
+
+  for (uint32_t i = 0; i < bufferCount; i++) {
+    if (allocator->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffers[i], &allocs[i]) != VK_SUCCESS) {
+      logLine() << "Upload bench: buffer " << i << " failed to allocate";
+      buffers.resize(i);
+      break;
+    }
   }
-  std::cout << "Created the device" << std::endl;
 
-  // Creating the graphics queue
-  vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-  std::cout << "Created graphics queue" << std::endl;
+  std::chrono::duration<double, std::micro> allocTime = std::chrono::steady_clock::now() - allocBegin;
+  logLine() << "Upload bench: " << buffers.size() << " buffers of " << bufferSize / 1024 << " KiB using "
+            << allocator->getStats().totalDeviceAllocations - blocksBefore << " vkAllocateMemory calls, "
+            << allocTime.count() / std::max<size_t>(buffers.size(), 1) << " us per buffer";
+
+  if (buffers.empty())
+    return;
+
+  // Fill the ring, submit, wait, repeat: measures memcpy + transfer throughput end to end
+  std::vector<char> source(bufferSize, 0x5a);
+  uint64_t stagedBefore = staging->bytesStaged;
+  auto uploadBegin = std::chrono::steady_clock::now();
+
+  // The buffers never leave the upload queue, so there is nothing to hand off
+  VkCommandBuffer cmd = uploads->begin();
+  staging->reset();
+  bool streamed = true;
+  for (VkDeviceSize sent = 0, i = 0; streamed && sent < streamBytes; sent += bufferSize, i++) {
+    VkBuffer dst = buffers[i % buffers.size()];
+    if (!staging->upload(cmd, dst, 0, source.data(), bufferSize)) {
+      if (uploads->submit() != VK_SUCCESS) {
+        streamed = false;
+        break;
+      }
+      cmd = uploads->begin();
+      staging->reset();
+      if (!staging->upload(cmd, dst, 0, source.data(), bufferSize)) {
+        uploads->cancel();
+        streamed = false;
+      }
+    }
+  }
+  if (streamed) {
+    streamed = uploads->submit() == VK_SUCCESS;
+  }
+  // Only blocks on a batch that was actually submitted
+  uploads->wait();
+  staging->reset();
+
+  if (streamed) {
+    std::chrono::duration<double> uploadTime = std::chrono::steady_clock::now() - uploadBegin;
+    double megabytes = (staging->bytesStaged - stagedBefore) / (1024.0 * 1024.0);
+    logLine() << "Upload bench: streamed " << megabytes << " MiB through a "
+              << staging->capacity / (1024 * 1024) << " MiB staging ring at "
+              << megabytes / uploadTime.count() << " MiB/s";
+  } else {
+    logLine() << "Upload bench: streaming failed, no throughput reported";
+  }
+
+  for (size_t i = 0; i < buffers.size(); i++) {
+    allocator->destroyBuffer(buffers[i], allocs[i]);
+  }
+  allocator->printStats();
+}
 
-  // Creating swap chain
+// Creates (or re-creates, when swapChain->handle is set) the swapchain and fetches its images.
+// The old swapchain is passed as oldSwapchain and then retired through `retire`, or
+// destroyed right away without one, in which case its images must be idle.
+VkResult createSwapChain(GLFWwindow* window, VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface,
+                         const QueueFamilyIndices& indices, const PresentSettings& settings, SwapChain* swapChain,
+                         DeletionQueue* retire = nullptr) {
   SwapChainSupportDetails support = querySwapChainSupport(physicalDevice, surface);
 
   VkSurfaceFormatKHR surfaceFormat = chooseSurfaceFormat(support.formats);
-  VkPresentModeKHR presentMode = choosePresentMode(support.presentModes);
-  VkExtent2D extent = chooseExtent(support.capabilities);
+  VkPresentModeKHR presentMode = choosePresentMode(support.presentModes, settings);
+  VkExtent2D extent = chooseExtent(support.capabilities, window);
 
-  uint32_t imageCount = support.capabilities.minImageCount + 1;
+  // More images let the CPU run further ahead, fewer keep queued frames (and latency) down
+  uint32_t imageCount = settings.imageCount ? settings.imageCount : support.capabilities.minImageCount + 1;
+  imageCount = std::max(imageCount, support.capabilities.minImageCount);
   if (support.capabilities.maxImageCount > 0 && imageCount > support.capabilities.maxImageCount) {
     imageCount = support.capabilities.maxImageCount;
   }
@@ -289,7 +1115,8 @@ int main() {
   swapChainCreateInfo.imageColorSpace = surfaceFormat.colorSpace;
   swapChainCreateInfo.imageExtent = extent;
   swapChainCreateInfo.imageArrayLayers = 1;
-  swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                   (settings.extraUsage & support.capabilities.supportedUsageFlags);
 
   uint32_t queueIndices[] = {
     indices.graphicsFamily.value(),
@@ -308,113 +1135,344 @@ int main() {
   swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   swapChainCreateInfo.presentMode = presentMode;
   swapChainCreateInfo.clipped = VK_TRUE;
+  // Hand the retired swapchain to the driver so it can recycle its resources
+  swapChainCreateInfo.oldSwapchain = swapChain->handle;
 
-  if (vkCreateSwapchainKHR(device, &swapChainCreateInfo, nullptr, &swapChain) != VK_SUCCESS) {
-    std::cout << "Failed to create swap chain" << std::endl;
-    return 1;
+  VkSwapchainKHR newSwapChain;
+  VkResult result = vkCreateSwapchainKHR(device, &swapChainCreateInfo, nullptr, &newSwapChain);
+
+  VkSwapchainKHR oldSwapChain = swapChain->handle;
+  if (oldSwapChain != VK_NULL_HANDLE && retire) {
+    retire->defer([device, oldSwapChain] { vkDestroySwapchainKHR(device, oldSwapChain, nullptr); });
+  } else if (oldSwapChain != VK_NULL_HANDLE) {
+    vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
   }
+  swapChain->handle = VK_NULL_HANDLE;
 
-  vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-  swapChainImages.resize(imageCount);
-  vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+  if (result != VK_SUCCESS)
+    return result;
 
-  swapChainImageFormat = surfaceFormat.format;
-  swapChainExtent = extent;
+  swapChain->handle = newSwapChain;
 
-  std::cout << "Created Swap Chain" << std::endl;
+  vkGetSwapchainImagesKHR(device, swapChain->handle, &imageCount, nullptr);
+  swapChain->images.resize(imageCount);
+  vkGetSwapchainImagesKHR(device, swapChain->handle, &imageCount, swapChain->images.data());
+
+  swapChain->imageFormat = surfaceFormat.format;
+  swapChain->extent = extent;
+  swapChain->presentMode = presentMode;
+  swapChain->imageUsage = swapChainCreateInfo.imageUsage;
+
+  return VK_SUCCESS;
+}
+
+// Also creates each image's render-finished semaphore. A present holds it until
+// that image is acquired again, which a frame-in-flight slot cannot tell, so
+// the semaphores follow the images rather than the frames.
+VkResult createImageViews(VkDevice device, SwapChain* swapChain) {
+  swapChain->imageViews.resize(swapChain->images.size());
+  swapChain->renderFinished.assign(swapChain->images.size(), VK_NULL_HANDLE);
+  VkSemaphoreCreateInfo semInfo{};
+  semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  for (size_t i = 0; i < swapChain->images.size(); i++) {
+    VkResult result = vkCreateSemaphore(device, &semInfo, nullptr, &swapChain->renderFinished[i]);
+    if (result != VK_SUCCESS)
+      return result;
 
-  // Create image views
-  swapChainImageViews.resize(swapChainImages.size());
-  for (size_t i = 0; i < swapChainImages.size(); i++) {
     VkImageViewCreateInfo info{};
     info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    info.image = swapChainImages[i];
+    info.image = swapChain->images[i];
     info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    info.format = swapChainImageFormat;
+    info.format = swapChain->imageFormat;
     info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     info.subresourceRange.levelCount = 1;
     info.subresourceRange.layerCount = 1;
 
-    if (vkCreateImageView(device, &info, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) {
-      std::cout << "Failed to create image view" << std::endl;
-      return 1;
-    }
+    result = vkCreateImageView(device, &info, nullptr, &swapChain->imageViews[i]);
+    if (result != VK_SUCCESS)
+      return result;
   }
+  return VK_SUCCESS;
+}
 
-  std::cout << "Created Image views" << std::endl;
-
-  // Creating render pass
-  VkAttachmentDescription colorAttachment{};
-  colorAttachment.format = swapChainImageFormat;
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-  VkAttachmentReference colorRef{};
-  colorRef.attachment = 0;
-  colorRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-  VkSubpassDescription subpass{};
-  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpass.colorAttachmentCount = 1;
-  subpass.pColorAttachments = &colorRef;
-
-  VkSubpassDependency dependency{};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-  VkRenderPassCreateInfo renderPassCreateInfo{};
-  renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassCreateInfo.attachmentCount = 1;
-  renderPassCreateInfo.pAttachments = &colorAttachment;
-  renderPassCreateInfo.subpassCount = 1;
-  renderPassCreateInfo.pSubpasses = &subpass;
-  renderPassCreateInfo.dependencyCount = 1;
-  renderPassCreateInfo.pDependencies = &dependency;
-
-  if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &renderPass) != VK_SUCCESS) {
-    std::cout << "Failed to create render pass" << std::endl;
-    return 1;
+// Destroys the views and semaphores, leaving the swapchain handle and images alone.
+// With `retire` they go once the frames in flight have retired.
+void destroyImageViews(VkDevice device, SwapChain* swapChain, DeletionQueue* retire = nullptr) {
+  for (auto view : swapChain->imageViews) {
+    if (retire)
+      retire->destroyImageView(view);
+    else
+      vkDestroyImageView(device, view, nullptr);
+  }
+  swapChain->imageViews.clear();
+  for (VkSemaphore semaphore : swapChain->renderFinished) {
+    if (semaphore == VK_NULL_HANDLE)
+      continue;
+    if (retire)
+      retire->destroySemaphore(semaphore);
+    else
+      vkDestroySemaphore(device, semaphore, nullptr);
   }
-  std::cout << "Created Render Pass" << std::endl;
+  swapChain->renderFinished.clear();
+}
 
-  // Creating framebuffers
-  swapChainFramebuffers.resize(swapChainImageViews.size());
+// Rebuilds the swapchain and its views. The caller resizes the render graph
+// afterwards; pipelines survive because the format is unchanged and
+// viewport/scissor are dynamic state. Nothing waits for the GPU: the old
+// swapchain and views are retired through `retire` behind the frames in flight.
+// Returns VK_NOT_READY, with the old swapchain untouched, when the window was
+// closed while minimized: there is no extent to create one with.
+VkResult recreateSwapChain(GLFWwindow* window, VkPhysicalDevice physicalDevice, VkDevice device, VkSurfaceKHR surface,
+                           const QueueFamilyIndices& indices, const PresentSettings& settings, SwapChain* swapChain,
+                           DeletionQueue* retire) {
+  // A minimized window has a zero sized framebuffer, nothing can be created until it comes back
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(window, &width, &height);
+  while ((width == 0 || height == 0) && !glfwWindowShouldClose(window)) {
+    glfwWaitEvents();
+    glfwGetFramebufferSize(window, &width, &height);
+  }
+  if (width == 0 || height == 0)
+    return VK_NOT_READY;
 
-  for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-    VkImageView attachments[] = {
-      swapChainImageViews[i]
-    };
+  destroyImageViews(device, swapChain, retire);
 
-    VkFramebufferCreateInfo info{};
-    info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    info.renderPass = renderPass;
-    info.attachmentCount = 1;
-    info.pAttachments = attachments;
-    info.width = swapChainExtent.width;
-    info.height = swapChainExtent.height;
-    info.layers = 1;
-
-    if (vkCreateFramebuffer(device, &info, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-      std::cout << "Failed to create framebuffer" << std::endl;
-      return 1;
-    }
+  VkResult result = createSwapChain(window, physicalDevice, device, surface, indices, settings, swapChain, retire);
+  if (result == VK_SUCCESS)
+    result = createImageViews(device, swapChain);
+  return result;
+}
+
+// Empty when `path` is empty or missing. Needs no device, so it runs while the device is created.
+std::vector<char> readPipelineCacheFile(const std::string& path) {
+  std::vector<char> data;
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (file.is_open()) {
+    data.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(data.data(), data.size());
+  }
+  return data;
+}
+
+// Creates a pipeline cache seeded from `data`, read from `path`. The data is only used
+// when its header matches this exact driver and device, anything else starts empty.
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& props, const std::vector<char>& data,
+                                  const std::string& path, bool* warm) {
+  // Header layout is fixed by the spec for VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+  struct {
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t uuid[VK_UUID_SIZE];
+  } header{};
+
+  bool valid = data.size() >= sizeof(header);
+  if (valid) {
+    memcpy(&header, data.data(), sizeof(header));
+    valid = header.headerSize >= sizeof(header) &&
+            header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            header.vendorID == props.vendorID &&
+            header.deviceID == props.deviceID &&
+            memcmp(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+  }
+
+  if (!data.empty() && !valid) {
+    logLine() << "Discarding stale pipeline cache: " << path;
+  }
+
+  VkPipelineCacheCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  if (valid) {
+    info.initialDataSize = data.size();
+    info.pInitialData = data.data();
+  }
+
+  VkPipelineCache cache = VK_NULL_HANDLE;
+  if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS) {
+    logLine() << "Failed to create pipeline cache";
+    return VK_NULL_HANDLE;
+  }
+
+  *warm = valid;
+  return cache;
+}
+
+// Writes the cache to a temporary file first so a crash mid-write never leaves a torn cache behind
+void savePipelineCache(VkDevice device, VkPipelineCache cache, const std::string& path) {
+  if (cache == VK_NULL_HANDLE)
+    return;
+
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+    return;
+
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+    return;
+
+  std::string tmpPath = path + ".tmp";
+  std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    logLine() << "Failed to write pipeline cache: " << path;
+    return;
   }
-  std::cout << "Created Framebuffers" << std::endl;
+  file.write(data.data(), size);
+  file.close();
+
+  std::rename(tmpPath.c_str(), path.c_str());
+}
+
+// Set 0 holds a single dynamic uniform buffer for DrawUniforms. The set is
+// written once; each draw only changes its dynamic offset.
+VkResult createDrawDescriptors(VkDevice device, VkDescriptorSetLayout* setLayout,
+                               VkDescriptorPool* pool, VkDescriptorSet* set) {
+  VkDescriptorSetLayoutBinding binding{};
+  binding.binding = 0;
+  binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  binding.descriptorCount = 1;
+  binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo{};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &binding;
+
+  VkResult result = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, setLayout);
+  if (result != VK_SUCCESS)
+    return result;
+
+  VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1};
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = 1;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+
+  result = vkCreateDescriptorPool(device, &poolInfo, nullptr, pool);
+  if (result != VK_SUCCESS)
+    return result;
+
+  VkDescriptorSetAllocateInfo alloc{};
+  alloc.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc.descriptorPool = *pool;
+  alloc.descriptorSetCount = 1;
+  alloc.pSetLayouts = setLayout;
+
+  return vkAllocateDescriptorSets(device, &alloc, set);
+}
+
+// Points the draw set at `uniformBuffer`; the set must not be in use by the GPU
+void writeDrawDescriptor(VkDevice device, VkDescriptorSet set, VkBuffer uniformBuffer) {
+  VkDescriptorBufferInfo bufferInfo{};
+  bufferInfo.buffer = uniformBuffer;
+  bufferInfo.offset = 0;
+  bufferInfo.range = sizeof(DrawUniforms);
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = set;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  write.pBufferInfo = &bufferInfo;
+
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+// Per-frame uniform space needed for `drawCount` draws
+VkDeviceSize uniformFrameSize(const VkPhysicalDeviceProperties& props, uint32_t drawCount) {
+  VkDeviceSize alignment = std::max<VkDeviceSize>(props.limits.minUniformBufferOffsetAlignment, 16);
+  VkDeviceSize stride = (sizeof(DrawUniforms) + alignment - 1) / alignment * alignment;
+  return std::max<VkDeviceSize>(UNIFORM_RING_FRAME_SIZE, stride * drawCount);
+}
+
+// Set 0 is the per-draw uniforms, set 1 the texture
+VkResult createPipelineLayout(VkDevice device, VkDescriptorSetLayout drawSetLayout, VkDescriptorSetLayout textureSetLayout,
+                              VkPipelineLayout* pipelineLayout) {
+  VkDescriptorSetLayout setLayouts[] = {drawSetLayout, textureSetLayout};
+
+  VkPipelineLayoutCreateInfo layout{};
+  layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout.setLayoutCount = 2;
+  layout.pSetLayouts = setLayouts;
+
+  return vkCreatePipelineLayout(device, &layout, nullptr, pipelineLayout);
+}
 
-  // Create graphics pipeline
-  auto vertCode = readFile("vert.spv");
-  auto fragCode = readFile("frag.spv");
+// Vertex layout and fixed-function state that differ between the pipelines of the triangle pass
+struct PipelineState {
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+  VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+  bool alphaBlend = false;
+};
+
+// Mesh vertices plus InstanceData; binding 0 is per vertex, binding 1 steps once per instance
+PipelineState meshPipelineState() {
+  PipelineState state;
+  state.bindings = {
+    {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX},
+    {1, sizeof(InstanceData), VK_VERTEX_INPUT_RATE_INSTANCE},
+  };
+  state.attributes = {
+    {0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, pos)},
+    {1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color)},
+    {2, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceData, transform)},
+    {3, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(InstanceData, color)},
+  };
+  return state;
+}
+
+// SpriteVertex; rotated sprites may come out either way round, and they blend in key order
+PipelineState spritePipelineState() {
+  PipelineState state;
+  state.bindings = {{0, sizeof(SpriteVertex), VK_VERTEX_INPUT_RATE_VERTEX}};
+  state.attributes = {
+    {0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(SpriteVertex, x)},
+    {1, 0, VK_FORMAT_R16G16_UNORM, offsetof(SpriteVertex, uv)},
+    {2, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(SpriteVertex, color)},
+  };
+  state.cullMode = VK_CULL_MODE_NONE;
+  state.alphaBlend = true;
+  return state;
+}
+
+// No vertex input; the vertex shader derives a full-screen triangle from gl_VertexIndex
+PipelineState fullscreenPipelineState() {
+  PipelineState state;
+  state.cullMode = VK_CULL_MODE_NONE;
+  return state;
+}
+
+// Uses the embedded SPIR-V when `embedded` is set and the build has it, otherwise
+// maps the pair's .spv files. Safe to call off the render thread: besides the
+// files it only touches the pipeline cache, which Vulkan synchronizes internally.
+VkResult createGraphicsPipeline(VkDevice device, VkPipelineCache cache, VkRenderPass renderPass,
+                                VkPipelineLayout pipelineLayout, const ShaderPair& shaders,
+                                const PipelineState& state, bool embedded, VkPipeline* pipeline) {
+  MappedFile vertFile, fragFile;
+  SpirvCode vertCode = shaders.vert;
+  SpirvCode fragCode = shaders.frag;
+
+  if (!embedded || vertCode.words == nullptr || fragCode.words == nullptr) {
+    if (!vertFile.open(shaders.vertPath) || !fragFile.open(shaders.fragPath)) {
+      logLine() << "Failed to map " << shaders.vertPath << " / " << shaders.fragPath;
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    vertCode = vertFile.code();
+    fragCode = fragFile.code();
+  }
 
   VkShaderModule vertModule = createShaderModule(device, vertCode);
   VkShaderModule fragModule = createShaderModule(device, fragCode);
+  if (vertModule == VK_NULL_HANDLE || fragModule == VK_NULL_HANDLE) {
+    vkDestroyShaderModule(device, vertModule, nullptr);
+    vkDestroyShaderModule(device, fragModule, nullptr);
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
 
   VkPipelineShaderStageCreateInfo vertStage{};
   vertStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -432,31 +1490,36 @@ int main() {
 
   VkPipelineVertexInputStateCreateInfo vertexInput{};
   vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInput.vertexBindingDescriptionCount = (uint32_t)state.bindings.size();
+  vertexInput.pVertexBindingDescriptions = state.bindings.data();
+  vertexInput.vertexAttributeDescriptionCount = (uint32_t)state.attributes.size();
+  vertexInput.pVertexAttributeDescriptions = state.attributes.data();
 
   VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
   inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
   inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 
-  VkViewport viewport{};
-  viewport.width = (float) swapChainExtent.width;
-  viewport.height = (float) swapChainExtent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor{{0,0}, swapChainExtent};
-
+  // Viewport and scissor are set at record time so a resize never rebuilds the pipeline
   VkPipelineViewportStateCreateInfo viewportState{};
   viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
   viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
   viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
+
+  VkDynamicState dynamicStates[] = {
+    VK_DYNAMIC_STATE_VIEWPORT,
+    VK_DYNAMIC_STATE_SCISSOR
+  };
+
+  VkPipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = 2;
+  dynamicState.pDynamicStates = dynamicStates;
 
   VkPipelineRasterizationStateCreateInfo raster{};
   raster.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
   raster.polygonMode = VK_POLYGON_MODE_FILL;
   raster.lineWidth = 1.0f;
-  raster.cullMode = VK_CULL_MODE_BACK_BIT;
+  raster.cullMode = state.cullMode;
   raster.frontFace = VK_FRONT_FACE_CLOCKWISE;
 
   VkPipelineMultisampleStateCreateInfo msaa{};
@@ -469,17 +1532,21 @@ int main() {
       VK_COLOR_COMPONENT_G_BIT |
       VK_COLOR_COMPONENT_B_BIT |
       VK_COLOR_COMPONENT_A_BIT;
+  if (state.alphaBlend) {
+    colorBlend.blendEnable = VK_TRUE;
+    colorBlend.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    colorBlend.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlend.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlend.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlend.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    colorBlend.alphaBlendOp = VK_BLEND_OP_ADD;
+  }
 
   VkPipelineColorBlendStateCreateInfo blend{};
   blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
   blend.attachmentCount = 1;
   blend.pAttachments = &colorBlend;
 
-  VkPipelineLayoutCreateInfo layout{};
-  layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-
-  vkCreatePipelineLayout(device, &layout, nullptr, &pipelineLayout);
-
   VkGraphicsPipelineCreateInfo info{};
   info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
   info.stageCount = 2;
@@ -490,66 +1557,997 @@ int main() {
   info.pRasterizationState = &raster;
   info.pMultisampleState = &msaa;
   info.pColorBlendState = &blend;
+  info.pDynamicState = &dynamicState;
   info.layout = pipelineLayout;
   info.renderPass = renderPass;
   info.subpass = 0;
 
-  vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &info, nullptr, &graphicsPipeline);
+  VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &info, nullptr, pipeline);
 
   vkDestroyShaderModule(device, fragModule, nullptr);
   vkDestroyShaderModule(device, vertModule, nullptr);
 
-  std::cout << "Created Graphics Pipeline" << std::endl;
+  return result;
+}
 
-  // Create Command Pool
-  VkCommandPoolCreateInfo commandPoolCreateInfo{};
-  commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  commandPoolCreateInfo.queueFamilyIndex = indices.graphicsFamily.value();
+// Compute pipeline for cull.comp, from the embedded SPIR-V or cull.spv like createGraphicsPipeline
+VkResult createCullPipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout pipelineLayout, bool embedded,
+                            VkPipeline* pipeline) {
+  MappedFile cullFile;
+  SpirvCode cullCode = embeddedCull;
 
-  if (vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
-    std::cout << "Failed to create command pool" << std::endl;
-    return 1;
+  if (!embedded || cullCode.words == nullptr) {
+    if (!cullFile.open("cull.spv")) {
+      logLine() << "Failed to map cull.spv";
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    cullCode = cullFile.code();
   }
-  std::cout << "Created Command Pool" << std::endl;
 
-  // Creating Command Buffers
-  commandBuffers.resize(swapChainFramebuffers.size());
+  VkShaderModule cullModule = createShaderModule(device, cullCode);
+  if (cullModule == VK_NULL_HANDLE)
+    return VK_ERROR_INITIALIZATION_FAILED;
 
-  VkCommandBufferAllocateInfo alloc{};
-  alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  alloc.commandPool = commandPool;
-  alloc.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  alloc.commandBufferCount = (uint32_t)commandBuffers.size();
+  VkComputePipelineCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  info.stage.module = cullModule;
+  info.stage.pName = "main";
+  info.layout = pipelineLayout;
 
-  vkAllocateCommandBuffers(device, &alloc, commandBuffers.data());
+  VkResult result = vkCreateComputePipelines(device, cache, 1, &info, nullptr, pipeline);
 
-  for (size_t i = 0; i < commandBuffers.size(); i++) {
-    VkCommandBufferBeginInfo begin{};
-    begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  vkDestroyShaderModule(device, cullModule, nullptr);
 
-    vkBeginCommandBuffer(commandBuffers[i], &begin);
+  return result;
+}
 
-    VkClearValue clearColor = {{{0.1f, 0.1f, 0.1f, 1.0f}}};
+// Set when the frame draws through the bindless table
+struct FrameBindless {
+  BindlessTable* table = nullptr;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  uint32_t drawBuffer = 0;               // slot of the UniformRing buffer
+  std::vector<uint32_t> textureSlots;    // one per frame in flight, rewritten once that frame retired
+};
 
-    VkRenderPassBeginInfo render{};
-    render.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    render.renderPass = renderPass;
-    render.framebuffer = swapChainFramebuffers[i];
-    render.renderArea.offset = {0, 0};
-    render.renderArea.extent = swapChainExtent;
-    render.clearValueCount = 1;
-    render.pClearValues = &clearColor;
+// Set when the scene renders offscreen and an upscale pass fills the backbuffer
+struct FrameUpscale {
+  Upscaler* upscaler = nullptr;
+  RenderGraphPass pass = 0;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+};
 
-    vkCmdBeginRenderPass(commandBuffers[i], &render, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+// Set when the finished backbuffer is copied out for --capture
+struct FrameReadback {
+  FrameCapture* capture = nullptr;
+  VkImage image = VK_NULL_HANDLE;
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;   // the one the render graph leaves it in
+  VkExtent2D extent{};
+  uint64_t frame = 0;                                 // frames submitted before this one
+};
 
-    vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
+// Set when the frame draws batched sprites over the instances
+struct FrameSprites {
+  SpriteRenderer* renderer = nullptr;
+  SpriteBatch* batch = nullptr;
+  VkPipeline pipelines[SPRITE_PIPELINE_COUNT] = {};
+};
+
+// Records the frame for `frame` by executing the render graph on framebuffer
+// variant `variant`. The triangle pass splits its draws evenly over the
+// recorder's threads as secondary buffers; draw d covers the d-th slice of the
+// instances and gets its own DrawUniforms from `uniforms`, which must already be at `frame`.
+// `pipeline` may be null while it is still compiling, the pass then only clears.
+// `culling` replaces the draw split: CPU culling issues one direct draw per
+// visible instance, GPU culling dispatches the cull pre-pass before the graph
+// and draws its output with one indirect draw. Until the cull pipeline is
+// built the GPU mode draws every instance.
+// Pending texture uploads are recorded ahead of the graph as well.
+// `bindless` may be null; when set its pipeline replaces `pipeline` and draws
+// push table indices instead of binding `drawSet` at a new offset.
+// `sprites` may be null; when set and its pipelines are built, the batch is
+// sorted, expanded and drawn by the last recording thread, on top of everything.
+// `upscale` may be null; when set the triangle pass renders offscreen at the
+// graph's current render scale and the upscale pass stretches it to the backbuffer.
+// `gpu` may be null; when set, timestamps for `frame` are written around the whole graph, each
+// pass, the cull dispatch, each recording thread's draws and the sprites.
+VkCommandBuffer recordFrame(FrameRecorder* recorder, uint32_t frame, const RenderGraph& graph,
+                            RenderGraphPass trianglePass, uint32_t variant, VkPipeline pipeline,
+                            VkPipelineLayout pipelineLayout, VkDescriptorSet drawSet, UniformRing* uniforms,
+                            const Mesh& mesh, VkBuffer instanceBuffer, uint32_t instanceCount, uint32_t drawCount,
+                            const FrameCulling& culling, TextureStreamer* textures, const FrameBindless* bindless,
+                            const FrameSprites* sprites, const FrameUpscale* upscale, const FrameReadback* readback,
+                            const GpuProfiler* gpu) {
+  // Sprites always go through descriptor sets
+  VkPipelineLayout spriteLayout = pipelineLayout;
+  if (bindless) {
+    pipeline = bindless->pipeline;
+    pipelineLayout = bindless->table->pipelineLayout;
+  }
+
+  VkCommandBuffer cmd = recorder->beginFrame(frame);
+
+  VkCommandBufferBeginInfo begin{};
+  begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  vkBeginCommandBuffer(cmd, &begin);
+
+  gpuProfilerReset(cmd, gpu, frame);
+  gpuProfilerTimestamp(cmd, gpu, frame, GPU_TS_FRAME_BEGIN, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+  VkDescriptorSet textureSet = textures->update(cmd, frame);
+  bool drawSprites = sprites && sprites->pipelines[SPRITE_PIPELINE_TEXTURED] != VK_NULL_HANDLE &&
+                     sprites->pipelines[SPRITE_PIPELINE_FLAT] != VK_NULL_HANDLE;
+  if (drawSprites) {
+    sprites->renderer->beginFrame(frame);
+  }
+  if (bindless) {
+    bindless->table->setTexture(bindless->textureSlots[frame], textures->shownImage());
+  }
+
+  // Points the next draw at the DrawUniforms at `offset` in the ring
+  auto bindDraw = [&](VkCommandBuffer secondary, uint32_t offset) {
+    if (bindless) {
+      BindlessPushConstants push{bindless->drawBuffer, offset / 16, bindless->textureSlots[frame]};
+      vkCmdPushConstants(secondary, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                         0, sizeof(push), &push);
+    } else {
+      vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &drawSet, 1, &offset);
+    }
+  };
+
+  bool gpuCulled = culling.mode == CULL_GPU && culling.pipeline != VK_NULL_HANDLE && pipeline != VK_NULL_HANDLE;
+  if (gpuCulled) {
+    // An async dispatch runs on the compute queue, this buffer only records its acquire
+    bool timed = !culling.culler->async();
+    if (timed) {
+      gpuProfilerTimestamp(cmd, gpu, frame, GPU_TS_CULL_BEGIN, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    }
+    culling.culler->record(cmd, frame, culling.pipeline, culling.frustum, instanceCount, mesh.indexCount,
+                           culling.meshRadius);
+    if (timed) {
+      gpuProfilerTimestamp(cmd, gpu, frame, GPU_TS_CULL_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    }
+  }
+
+  VkCommandBufferInheritanceInfo inheritance{};
+  inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritance.subpass = 0;
+  VkExtent2D extent{};
+
+  auto recordDraws = [&](VkCommandBuffer secondary, uint32_t chunk, uint32_t chunkCount) {
+    // Secondaries inherit no state from the primary besides the render pass
+    vkCmdBindPipeline(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float) extent.width;
+    viewport.height = (float) extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(secondary, 0, 1, &viewport);
+
+    VkRect2D scissor{{0,0}, extent};
+    vkCmdSetScissor(secondary, 0, 1, &scissor);
+
+    VkBuffer vertexBuffers[] = {mesh.vertexBuffer, gpuCulled ? culling.culler->visibleBuffer(frame) : instanceBuffer};
+    VkDeviceSize vertexOffsets[] = {0, 0};
+    vkCmdBindVertexBuffers(secondary, 0, 2, vertexBuffers, vertexOffsets);
+    vkCmdBindIndexBuffer(secondary, mesh.indexBuffer, 0, mesh.indexType);
+    if (bindless) {
+      vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &bindless->table->set,
+                              0, nullptr);
+    } else {
+      vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &textureSet, 0, nullptr);
+    }
+
+    // Each thread's draws are one group
+    gpuProfilerTimestamp(secondary, gpu, frame, gpuDrawGroupTimestamp(chunk, false), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+    if (gpuCulled) {
+      // The pre-pass wrote the instance count, one draw covers every survivor
+      uint32_t offset = 0;
+      void* dst = chunk == 0 ? uniforms->allocate(sizeof(DrawUniforms), 1, &offset) : nullptr;
+      if (dst) {
+        DrawUniforms draw{culling.camera, drawTints[0]};
+        memcpy(dst, &draw, sizeof(draw));
+        bindDraw(secondary, offset);
+        vkCmdDrawIndexedIndirect(secondary, culling.culler->indirectBuffer(frame), 0, 1,
+                                 sizeof(VkDrawIndexedIndirectCommand));
+      }
+    } else if (culling.mode == CULL_CPU) {
+      // One uniform per chunk, one draw per visible instance
+      const std::vector<uint32_t>& visible = *culling.visible;
+      size_t first = visible.size() * chunk / chunkCount;
+      size_t end = visible.size() * (chunk + 1) / chunkCount;
+
+      uint32_t offset = 0;
+      void* dst = end > first ? uniforms->allocate(sizeof(DrawUniforms), 1, &offset) : nullptr;
+      if (dst) {
+        DrawUniforms draw{culling.camera, drawTints[0]};
+        memcpy(dst, &draw, sizeof(draw));
+        bindDraw(secondary, offset);
+        for (size_t i = first; i < end; i++) {
+          vkCmdDrawIndexed(secondary, mesh.indexCount, 1, 0, 0, visible[i]);
+        }
+      }
+    } else {
+      uint32_t firstDraw = (uint32_t)((uint64_t)drawCount * chunk / chunkCount);
+      uint32_t endDraw = (uint32_t)((uint64_t)drawCount * (chunk + 1) / chunkCount);
+
+      // One bump for the whole chunk, then a memcpy and a dynamic offset per draw
+      uint32_t offset = 0;
+      char* dst = static_cast<char*>(uniforms->allocate(sizeof(DrawUniforms), endDraw - firstDraw, &offset));
+      uint32_t stride = (uint32_t)uniforms->stride(sizeof(DrawUniforms));
+
+      for (uint32_t d = firstDraw; dst && d < endDraw; d++) {
+        DrawUniforms draw;
+        draw.transform = culling.camera;
+        draw.tint = drawCount == 1 ? drawTints[0] : drawTints[d & 7];
+        memcpy(dst, &draw, sizeof(draw));
+
+        bindDraw(secondary, offset);
+
+        uint32_t firstInstance = (uint32_t)((uint64_t)instanceCount * d / drawCount);
+        uint32_t endInstance = (uint32_t)((uint64_t)instanceCount * (d + 1) / drawCount);
+        if (endInstance > firstInstance) {
+          vkCmdDrawIndexed(secondary, mesh.indexCount, endInstance - firstInstance, 0, 0, firstInstance);
+        }
+
+        dst += stride;
+        offset += stride;
+      }
+    }
+
+    gpuProfilerTimestamp(secondary, gpu, frame, gpuDrawGroupTimestamp(chunk, true), VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+
+    // Secondaries execute in chunk order, so the last one's sprites land on top
+    if (chunk == chunkCount - 1 && drawSprites) {
+      uint32_t offset = 0;
+      void* dst = uniforms->allocate(sizeof(DrawUniforms), 1, &offset);
+      if (dst) {
+        DrawUniforms draw{culling.camera, drawTints[0]};
+        memcpy(dst, &draw, sizeof(draw));
+        gpuProfilerTimestamp(secondary, gpu, frame, GPU_TS_SPRITES_BEGIN, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+        vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, spriteLayout, 0, 1, &drawSet, 1, &offset);
+        sprites->renderer->record(secondary, sprites->batch, sprites->pipelines, &textureSet, spriteLayout);
+        gpuProfilerTimestamp(secondary, gpu, frame, GPU_TS_SPRITES_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+      }
+    }
+  };
+
+  VkExtent2D sceneArea{};
+  graph.execute(cmd, variant, [&](RenderGraphPass pass, VkCommandBuffer passCmd, const RenderGraphPassInfo& info) {
+    // Runs after the triangle pass, so sceneArea is this frame's render area
+    if (upscale && pass == upscale->pass) {
+      if (upscale->pipeline != VK_NULL_HANDLE) {
+        upscale->upscaler->record(passCmd, frame, upscale->pipeline, info.extent, sceneArea);
+      }
+      return;
+    }
+    if (pass == trianglePass) {
+      sceneArea = info.extent;
+    }
+
+    // Until its pipeline is built the pass only clears
+    if (pass != trianglePass || pipeline == VK_NULL_HANDLE)
+      return;
+
+    inheritance.renderPass = info.renderPass;
+    inheritance.framebuffer = info.framebuffer;
+    extent = info.extent;
+
+    const std::vector<VkCommandBuffer>& secondaries = recorder->recordSecondaries(frame, inheritance, recordDraws);
+    vkCmdExecuteCommands(passCmd, (uint32_t)secondaries.size(), secondaries.data());
+  }, [&](RenderGraphPass pass, VkCommandBuffer edgeCmd, bool end) {
+    gpuProfilerTimestamp(edgeCmd, gpu, frame, gpuPassTimestamp(pass, end),
+                         end ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+  });
+
+  gpuProfilerTimestamp(cmd, gpu, frame, GPU_TS_FRAME_END, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+  // After the timestamp, so the copy never counts against the GPU budget
+  if (readback) {
+    readback->capture->record(cmd, readback->image, readback->layout, readback->extent, readback->frame);
+  }
+  vkEndCommandBuffer(cmd);
+  return cmd;
+}
+
+// Called whenever a (re)built pipeline was swapped in
+void reportPipelineSwap(const char* name, const PipelineSlot& slot, std::chrono::steady_clock::time_point startupBegin,
+                        bool warmCache, const char* shaderSource) {
+  if (slot.generation == 1) {
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - startupBegin;
+    logLine() << name << " pipeline ready " << elapsed.count() << " ms after startup (compiled in "
+              << slot.compileMs << " ms, " << (warmCache ? "warm" : "cold") << " cache, "
+              << shaderSource << " shaders)";
+  } else {
+    logLine() << name << " pipeline rebuilt and swapped in (compiled in " << slot.compileMs << " ms)";
+  }
+}
+
+// Time from process start until the first frame was handed to the GPU, and where it went. Returns the time in ms.
+double reportTimeToFirstFrame(std::chrono::steady_clock::time_point startupBegin, bool warmCache,
+                              const std::string& startupReportPath) {
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - startupBegin;
+  logLine() << "Time to first frame: " << elapsed.count() << " ms ("
+            << (warmCache ? "warm" : "cold") << " pipeline cache)";
+  startupTimeline().report(startupReportPath);
+  flushLog();
+  return elapsed.count();
+}
+
+// One flat JSON object, so regress can read it without a JSON library
+void writeFrameReport(const std::string& path, std::vector<double> frameTimes, double startupMs) {
+  if (frameTimes.empty())
+    return;
+  std::sort(frameTimes.begin(), frameTimes.end());
+  auto percentile = [&](double p) {
+    return frameTimes[std::min(frameTimes.size() - 1, (size_t)(frameTimes.size() * p))];
+  };
+
+  // ru_maxrss is in KiB on Linux
+  struct rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+
+  std::ofstream file(path, std::ios::trunc);
+  if (!file.is_open()) {
+    logLine() << "Failed to write frame report: " << path;
+    return;
+  }
+  file << "{\"frames\":" << frameTimes.size() << ",\"frame_p50_ms\":" << percentile(0.5)
+       << ",\"frame_p90_ms\":" << percentile(0.9) << ",\"frame_p99_ms\":" << percentile(0.99)
+       << ",\"frame_max_ms\":" << frameTimes.back() << ",\"startup_ms\":" << startupMs
+       << ",\"peak_rss_mb\":" << usage.ru_maxrss / 1024.0 << "}\n";
+}
+
+// Resident set size of this process, used to spot leaks across swapchain rebuilds
+size_t currentRssBytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  statm >> pages >> resident;
+  return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+void framebufferResizeCallback(GLFWwindow* window, int, int) {
+  bool* framebufferResized = static_cast<bool*>(glfwGetWindowUserPointer(window));
+  *framebufferResized = true;
+}
+
+// Prints min / mean / p99 / max of the given CPU frame times in milliseconds
+void printFrameStats(const char* label, std::vector<double> frameTimes) {
+  if (frameTimes.empty()) {
+    logLine() << label << ": no frames recorded";
+    return;
+  }
+
+  std::sort(frameTimes.begin(), frameTimes.end());
+
+  double sum = 0.0;
+  for (double t : frameTimes) sum += t;
+
+  size_t p99 = std::min(frameTimes.size() - 1, (size_t)(frameTimes.size() * 0.99));
+
+  logLine() << label << " (" << frameTimes.size() << " frames, ms):"
+            << " min " << frameTimes.front()
+            << " mean " << sum / frameTimes.size()
+            << " p99 " << frameTimes[p99]
+            << " max " << frameTimes.back();
+}
+
+int main(int argc, char** argv) {
+  auto startupBegin = startupTimeline().epoch;
+
+  Options opts = parseOptions(argc, argv);
+  // Benchmarks always run offscreen so vsync and the compositor stay out of the numbers
+  if (!opts.bench.empty()) {
+    opts.headless = true;
+  }
+  bool headless = opts.headless;
+  profiler().enabled = !opts.profilePath.empty();
+
+  // Only needed once the device exists, so read it while the device is created
+  std::string pipelineCachePath = opts.coldCache ? "" : opts.pipelineCachePath;
+  std::future<std::vector<char>> pipelineCacheFile = std::async(std::launch::async, [pipelineCachePath] {
+    StartupPhase phase("read pipeline cache");
+    return readPipelineCacheFile(pipelineCachePath);
+  });
+
+  GLFWwindow* window = nullptr;
+  VkInstance instance;
+
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device;
+  VkQueue graphicsQueue;
+  // Same handle as graphicsQueue whenever the families match
+  VkQueue presentQueue = VK_NULL_HANDLE;
+  VkQueue transferQueue;
+  VkQueue computeQueue;
+
+  // Headless runs fill this with offscreen images and leave the handle null
+  SwapChain swapChain;
+
+  // Backing memory for the headless offscreen images
+  std::vector<VkDeviceMemory> offscreenMemory;
+
+  // Declared once, recompiled whenever the swapchain changes
+  RenderGraph graph;
+
+  VkPipelineCache pipelineCache;
+  VkDescriptorSetLayout drawSetLayout;
+  VkDescriptorPool descriptorPool;
+  VkDescriptorSet drawSet;
+  VkPipelineLayout pipelineLayout;
+  PipelineCompiler pipelineCompiler;
+  PipelineSlot trianglePipeline;
+  BindlessTable bindless;
+  PipelineSlot bindlessPipeline;
+  GpuCuller culler;
+  PipelineSlot cullPipeline;
+  TextureStreamer textures;
+  std::vector<TextureHandle> textureHandles;
+  SpriteRenderer spriteRenderer;
+  SpriteBatch spriteBatch;
+  PipelineSlot spritePipelines[SPRITE_PIPELINE_COUNT];
+  Upscaler upscaler;
+  PipelineSlot upscalePipeline;
+  ResolutionController resolution;
+  resolution.minScale = opts.minScale;
+  resolution.maxScale = opts.maxScale;
+  resolution.budgetMs = opts.gpuBudgetMs;
+  resolution.scale = opts.maxScale;
+  // Scale each frame slot was recorded at, matched with its timings once it retires
+  float slotScale[MAX_FRAMES_IN_FLIGHT];
+  std::fill(slotScale, slotScale + MAX_FRAMES_IN_FLIGHT, opts.maxScale);
+
+  // Staging copies run on the transfer queue and are handed to graphics;
+  // per-frame work is recorded through the FrameRecorder
+  QueueHandoff uploads;
+  FrameRecorder recorder;
+
+  GpuProfiler gpuProfiler;
+
+  DeviceAllocator allocator;
+  // Objects replaced at runtime, destroyed once the frames that used them retire
+  DeletionQueue deletion;
+  StagingRing staging;
+  UniformRing uniforms;
+  Mesh triangle;
+  InstanceBuffers instances;
+  // Instance transforms are recomputed every frame on the job threads
+  JobSystem jobs;
+  SceneTransforms sceneTransforms;
+
+  // One set of sync objects per frame in flight; the render-finished
+  // semaphores belong to the swapchain images instead
+  std::vector<VkSemaphore> imageAvailableSemaphores(MAX_FRAMES_IN_FLIGHT);
+  std::vector<VkFence> inFlightFences(MAX_FRAMES_IN_FLIGHT);
+  // Fence of the frame currently using each swapchain image
+  std::vector<VkFence> imagesInFlight;
+  size_t currentFrame = 0;
+
+  // Set by GLFW when the window framebuffer changes size
+  bool framebufferResized = false;
+
+  uint32_t extensionCount = 0;
+  const char** extensions = nullptr;
+
+  // Straight-line init is timed phase by phase through this one object
+  StartupPhase phase("create window");
+  if (!headless) {
+    // Init
+    glfwInit();
+
+    // Creating window
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+    window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan window", nullptr, nullptr);
+
+    if (!window) {
+      logLine() << "Failed to create window";
+      return 1;
+    }
+
+    glfwSetWindowUserPointer(window, &framebufferResized);
+    glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+
+    extensions = glfwGetRequiredInstanceExtensions(&extensionCount);
+  }
+
+  phase.next("create instance");
+
+  // Create app information
+  VkApplicationInfo appInfo{};
+  appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+  appInfo.pApplicationName = "Learning Vulkan";
+  appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+  appInfo.pEngineName = "What?";
+  appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+  // Descriptor indexing for the bindless path is core in 1.2; 1.0 loaders lack vkEnumerateInstanceVersion
+  uint32_t instanceVersion = VK_API_VERSION_1_0;
+  auto enumerateInstanceVersion =
+    (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion");
+  if (enumerateInstanceVersion) {
+    enumerateInstanceVersion(&instanceVersion);
+  }
+  appInfo.apiVersion = instanceVersion >= VK_API_VERSION_1_2 ? VK_API_VERSION_1_2 : VK_API_VERSION_1_0;
+
+  logLine() << "Extensions:";
+  for (int i = 0; i < extensionCount; i++) {
+    logLine() << " - " << extensions[i];
+  }
+  logLine();
+
+  // Create instance information
+  VkInstanceCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+  createInfo.pApplicationInfo = &appInfo;
+  createInfo.enabledExtensionCount = extensionCount;
+  createInfo.ppEnabledExtensionNames = extensions;
+
+  // Create the vulkan instance
+  if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+    logLine() << "Failed to create vulkan instance";
+    return 1;
+  }
+  logLine() << "Vulkan Instance Created";
+
+  // Create the surface
+  phase.next("create surface");
+  if (!headless && glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
+    logLine() << "Failed to create surface";
+    return 1;
+  }
+
+  // Pick physical device
+  phase.next("pick physical device");
+  uint32_t deviceCount = 0;
+  vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+  if (deviceCount == 0) {
+    logLine() << "Failed to find GPUs with vulkan support";
+    return 1;
+  }
+  logLine() << "Devices Found: " << deviceCount;
+
+  std::vector<VkPhysicalDevice> devices(deviceCount);
+  vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+  for (const auto& dev : devices) {
+    QueueFamilyIndices indices = findQueueFamilies(dev, surface);
+    if (indices.isComplete(!headless)) {
+      physicalDevice = dev;
+      break;
+    }
+  }
+
+  if (physicalDevice == VK_NULL_HANDLE) {
+    logLine() << "Failed to find physical device";
+    return 1;
+  }
+
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+  logLine() << "Found physical device: " << deviceProperties.deviceName;
+
+  // Creating the device
+  phase.next("create device");
+  QueueFamilyIndices indices = findQueueFamilies(physicalDevice, surface);
+  if (opts.singleQueue) {
+    indices.transferFamily.reset();
+    indices.computeFamily.reset();
+  }
+
+  // One queue from every distinct family in use
+  float queuePriority = 1.0f;
+  std::set<uint32_t> uniqueFamilies = {indices.graphicsFamily.value(), indices.transfer(), indices.compute()};
+  if (indices.presentFamily) {
+    uniqueFamilies.insert(indices.presentFamily.value());
+  }
+
+  std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+  for (uint32_t family : uniqueFamilies) {
+    VkDeviceQueueCreateInfo queueCreateInfo{};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = family;
+    queueCreateInfo.queueCount = 1;
+    queueCreateInfo.pQueuePriorities = &queuePriority;
+    queueCreateInfos.push_back(queueCreateInfo);
+  }
+
+  VkPhysicalDeviceFeatures deviceFeatures{};
+
+  // Bindless needs a 1.2 instance and device with the descriptor indexing features
+  VkPhysicalDeviceVulkan12Features features12{};
+  features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  if (appInfo.apiVersion >= VK_API_VERSION_1_2 && deviceProperties.apiVersion >= VK_API_VERSION_1_2) {
+    VkPhysicalDeviceFeatures2 features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &features12;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+  }
+  bool wantBindless = opts.bindless || opts.bench == "bindless";
+  bool useBindless = wantBindless && bindlessSupported(features12);
+  if (wantBindless && !useBindless) {
+    logLine() << "Bindless needs Vulkan 1.2 descriptor indexing, drawing with descriptor sets";
+  }
+
+  // Only what the bindless path uses is enabled
+  VkPhysicalDeviceVulkan12Features enabled12{};
+  enabled12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  enabled12.descriptorIndexing = VK_TRUE;
+  enabled12.runtimeDescriptorArray = VK_TRUE;
+  enabled12.descriptorBindingPartiallyBound = VK_TRUE;
+  enabled12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  enabled12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+
+  std::vector<const char*> deviceExtensions;
+  if (!headless) {
+    deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
+
+  VkDeviceCreateInfo deviceCreateInfo{};
+  deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  deviceCreateInfo.pNext = useBindless ? &enabled12 : nullptr;
+  deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+  deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+  deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+  deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+  deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
+  if (vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device) != VK_SUCCESS) {
+    logLine() << "Failed to create logical device";
+    return 1;
+  }
+  logLine() << "Created the device";
 
-    vkCmdEndRenderPass(commandBuffers[i]);
-    vkEndCommandBuffer(commandBuffers[i]);
+  // Fetching the queues
+  vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+  vkGetDeviceQueue(device, indices.transfer(), 0, &transferQueue);
+  vkGetDeviceQueue(device, indices.compute(), 0, &computeQueue);
+  if (indices.presentFamily) {
+    vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+  }
+  logLine() << "Created queues: graphics family " << indices.graphicsFamily.value()
+            << ", transfer family " << indices.transfer() << (indices.transferFamily ? " (dedicated)" : " (shared)")
+            << ", compute family " << indices.compute() << (indices.computeFamily ? " (async)" : " (shared)");
+
+  // Render passes and pipelines only need the backbuffer format, so the
+  // pipeline build is queued before the swapchain exists and compiles on the
+  // worker thread while the swapchain, buffers and mesh are being set up.
+  phase.next("compile render passes");
+  VkFormat backbufferFormat = headless ? VK_FORMAT_B8G8R8A8_SRGB
+                            : chooseSurfaceFormat(querySwapChainSupport(physicalDevice, surface).formats).format;
+
+  // The render graph's transient images come from the sub-allocator
+  allocator.init(physicalDevice, device);
+  deletion.init(device, &allocator, MAX_FRAMES_IN_FLIGHT);
+
+  // Declare the frame: clear the backbuffer and draw the triangle into it.
+  // Offscreen targets end up ready to be copied out rather than presented.
+  VkImageLayout finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  RenderGraphResource backbuffer = graph.importImage("backbuffer", backbufferFormat, finalLayout);
+  RenderGraphPass trianglePass = graph.addPass("triangle", VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  // With dynamic resolution the scene goes to a transient sized for the
+  // largest scale and the upscale pass is the one writing the backbuffer
+  RenderGraphResource scene = backbuffer;
+  RenderGraphPass upscalePass = 0;
+  if (opts.dynamicResolution) {
+    scene = graph.createImage("scene", backbufferFormat, opts.maxScale);
+    upscalePass = graph.addPass("upscale");
+    graph.readTexture(upscalePass, scene);
+    graph.writeColor(upscalePass, backbuffer, VK_ATTACHMENT_LOAD_OP_CLEAR, {{0.0f, 0.0f, 0.0f, 1.0f}});
+  }
+  graph.writeColor(trianglePass, scene, VK_ATTACHMENT_LOAD_OP_CLEAR, {{0.1f, 0.1f, 0.1f, 1.0f}});
+
+  if (graph.compilePasses(device, &allocator) != VK_SUCCESS) {
+    logLine() << "Failed to compile render graph";
+    return 1;
+  }
+  logLine() << "Created Render Passes";
+
+  // Create pipeline cache
+  phase.next("create pipeline cache");
+  bool warmCache = false;
+  pipelineCache = loadPipelineCache(device, deviceProperties, pipelineCacheFile.get(), pipelineCachePath, &warmCache);
+  logLine() << "Created Pipeline Cache (" << (warmCache ? "warm" : "cold") << ")";
+
+  // Create per-draw descriptor set
+  phase.next("create descriptors");
+  if (createDrawDescriptors(device, &drawSetLayout, &descriptorPool, &drawSet) != VK_SUCCESS) {
+    logLine() << "Failed to create descriptor set";
+    return 1;
+  }
+  logLine() << "Created Descriptor Set";
+
+  if (culler.init(device, &allocator, MAX_FRAMES_IN_FLIGHT, indices.graphicsFamily.value(), indices.compute(),
+                  computeQueue) != VK_SUCCESS) {
+    logLine() << "Failed to create culling descriptors";
+    return 1;
+  }
+
+  // Decoding starts right away on the streaming thread
+  if (textures.init(device, &allocator, &deletion, MAX_FRAMES_IN_FLIGHT,
+                    (VkDeviceSize)opts.textureBudgetMb * 1024 * 1024) != VK_SUCCESS) {
+    logLine() << "Failed to create texture streamer";
+    return 1;
+  }
+  for (const std::string& path : opts.textures) {
+    textureHandles.push_back(textures.load(path));
+  }
+
+  // Slots for the shown texture, one per frame so a pending frame's slot is never rewritten
+  FrameBindless bindlessFrame;
+  if (useBindless) {
+    if (bindless.init(device) != VK_SUCCESS) {
+      logLine() << "Failed to create bindless table";
+      return 1;
+    }
+    bindlessFrame.table = &bindless;
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+      bindlessFrame.textureSlots.push_back(bindless.addTexture(textures.shownImage()));
+    }
+    logLine() << "Created Bindless Table";
+  }
+
+  if (opts.dynamicResolution) {
+    if (upscaler.init(device, MAX_FRAMES_IN_FLIGHT) != VK_SUCCESS) {
+      logLine() << "Failed to create upscale descriptors";
+      return 1;
+    }
+  }
+
+  // Create graphics pipeline in the background; frames render without it until it lands
+  if (createPipelineLayout(device, drawSetLayout, textures.setLayout, &pipelineLayout) != VK_SUCCESS) {
+    logLine() << "Failed to create pipeline layout";
+    return 1;
+  }
+
+  // The first build uses the embedded SPIR-V; edits on disk are picked up from the .spv files
+  phase.next("queue pipeline build");
+  bool embeddedShaders = HAVE_EMBEDDED_SHADERS && !opts.externalShaders;
+  const char* shaderSource = embeddedShaders ? "embedded" : "mapped";
+  auto buildTrianglePipeline = [&, device](bool embedded) {
+    return [&, device, embedded, trianglePass](VkPipeline* pipeline) {
+      StartupPhase buildPhase("build pipeline");
+      return createGraphicsPipeline(device, pipelineCache, graph.renderPass(trianglePass), pipelineLayout,
+                                    triangleShaders, meshPipelineState(), embedded, pipeline);
+    };
+  };
+  auto buildBindlessPipeline = [&, device](bool embedded) {
+    return [&, device, embedded, trianglePass](VkPipeline* pipeline) {
+      return createGraphicsPipeline(device, pipelineCache, graph.renderPass(trianglePass), bindless.pipelineLayout,
+                                    bindlessShaders, meshPipelineState(), embedded, pipeline);
+    };
+  };
+  auto buildSpritePipeline = [&, device](uint32_t kind, bool embedded) {
+    return [&, device, kind, embedded, trianglePass](VkPipeline* pipeline) {
+      return createGraphicsPipeline(device, pipelineCache, graph.renderPass(trianglePass), pipelineLayout,
+                                    spriteShaders[kind], spritePipelineState(), embedded, pipeline);
+    };
+  };
+  auto buildUpscalePipeline = [&, device](bool embedded) {
+    return [&, device, embedded, upscalePass](VkPipeline* pipeline) {
+      return createGraphicsPipeline(device, pipelineCache, graph.renderPass(upscalePass), upscaler.pipelineLayout,
+                                    upscaleShaders, fullscreenPipelineState(), embedded, pipeline);
+    };
+  };
+  auto buildCullPipeline = [&, device](bool embedded) {
+    return [&, device, embedded](VkPipeline* pipeline) {
+      return createCullPipeline(device, pipelineCache, culler.pipelineLayout, embedded, pipeline);
+    };
+  };
+  pipelineCompiler.start(device);
+  pipelineCompiler.submit(&trianglePipeline, buildTrianglePipeline(embeddedShaders));
+  pipelineCompiler.submit(&cullPipeline, buildCullPipeline(embeddedShaders));
+  if (useBindless) {
+    pipelineCompiler.submit(&bindlessPipeline, buildBindlessPipeline(embeddedShaders));
+  }
+  for (uint32_t kind = 0; opts.sprites > 0 && kind < SPRITE_PIPELINE_COUNT; kind++) {
+    pipelineCompiler.submit(&spritePipelines[kind], buildSpritePipeline(kind, embeddedShaders));
+  }
+  if (opts.dynamicResolution) {
+    pipelineCompiler.submit(&upscalePipeline, buildUpscalePipeline(embeddedShaders));
+  }
+  // Fixed-length runs have nobody editing shaders
+  if (!headless) {
+    pipelineCompiler.watch(&trianglePipeline, {"vert.spv", "frag.spv"}, buildTrianglePipeline(false));
+    pipelineCompiler.watch(&cullPipeline, {"cull.spv"}, buildCullPipeline(false));
+    if (useBindless) {
+      pipelineCompiler.watch(&bindlessPipeline, {bindlessShaders.vertPath, bindlessShaders.fragPath},
+                             buildBindlessPipeline(false));
+    }
+    for (uint32_t kind = 0; opts.sprites > 0 && kind < SPRITE_PIPELINE_COUNT; kind++) {
+      pipelineCompiler.watch(&spritePipelines[kind], {spriteShaders[kind].vertPath, spriteShaders[kind].fragPath},
+                             buildSpritePipeline(kind, false));
+    }
+    if (opts.dynamicResolution) {
+      pipelineCompiler.watch(&upscalePipeline, {upscaleShaders.vertPath, upscaleShaders.fragPath},
+                             buildUpscalePipeline(false));
+    }
+  }
+  logLine() << "Queued Graphics and Culling Pipelines";
+
+  if (headless) {
+    // Creating offscreen color targets, one per frame in flight, standing in for the swapchain
+    phase.next("create offscreen images");
+    swapChain.imageFormat = backbufferFormat;
+    swapChain.extent = {WIDTH, HEIGHT};
+
+    swapChain.images.resize(MAX_FRAMES_IN_FLIGHT);
+    offscreenMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for (size_t i = 0; i < swapChain.images.size(); i++) {
+      VkImageCreateInfo info{};
+      info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      info.imageType = VK_IMAGE_TYPE_2D;
+      info.format = swapChain.imageFormat;
+      info.extent = {swapChain.extent.width, swapChain.extent.height, 1};
+      info.mipLevels = 1;
+      info.arrayLayers = 1;
+      info.samples = VK_SAMPLE_COUNT_1_BIT;
+      info.tiling = VK_IMAGE_TILING_OPTIMAL;
+      info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+      info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+      if (vkCreateImage(device, &info, nullptr, &swapChain.images[i]) != VK_SUCCESS) {
+        logLine() << "Failed to create offscreen image";
+        return 1;
+      }
+
+      VkMemoryRequirements memReqs;
+      vkGetImageMemoryRequirements(device, swapChain.images[i], &memReqs);
+
+      VkMemoryAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      allocInfo.allocationSize = memReqs.size;
+      allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+      if (vkAllocateMemory(device, &allocInfo, nullptr, &offscreenMemory[i]) != VK_SUCCESS) {
+        logLine() << "Failed to allocate offscreen image memory";
+        return 1;
+      }
+      vkBindImageMemory(device, swapChain.images[i], offscreenMemory[i], 0);
+    }
+
+    swapChain.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    logLine() << "Created Offscreen Images";
+  } else {
+    // Creating swap chain
+    phase.next("create swap chain");
+    if (createSwapChain(window, physicalDevice, device, surface, indices, opts.present, &swapChain) != VK_SUCCESS) {
+      logLine() << "Failed to create swap chain";
+      return 1;
+    }
+
+    logLine() << "Created Swap Chain (" << presentModeName(swapChain.presentMode) << ", "
+              << swapChain.images.size() << " images)";
+  }
+
+  // Create image views
+  phase.next("create image views");
+  if (createImageViews(device, &swapChain) != VK_SUCCESS) {
+    logLine() << "Failed to create image view";
+    return 1;
+  }
+  logLine() << "Created Image views";
+
+  // Capture is best effort: a surface that cannot be copied from only loses the capture
+  FrameCapture capture;
+  bool capturing = false;
+  if (!opts.capturePath.empty()) {
+    if (!(swapChain.imageUsage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+      logLine() << "Swapchain images cannot be copied from, capture disabled";
+    } else if (capture.init(&allocator, opts.capturePath, swapChain.imageFormat, opts.captureSlots,
+                            MAX_FRAMES_IN_FLIGHT) != VK_SUCCESS) {
+      logLine() << "Cannot capture backbuffer format " << swapChain.imageFormat << ", capture disabled";
+    } else {
+      capturing = true;
+      logLine() << "Capturing frames to " << opts.capturePath << " through " << opts.captureSlots
+                << " readback buffers";
+    }
+  }
+
+  phase.next("create framebuffers");
+  graph.setImportedViews(backbuffer, swapChain.imageViews);
+  if (graph.resize(swapChain.extent) != VK_SUCCESS) {
+    logLine() << "Failed to create render graph framebuffers";
+    return 1;
+  }
+  if (opts.dynamicResolution) {
+    upscaler.setSource(graph.imageView(scene), graph.imageExtent(scene));
+  }
+  graph.printSummary();
+  logLine() << "Created Framebuffers";
+
+  // Create the upload queue
+  phase.next("create upload queue");
+  if (uploads.init(device, indices.transfer(), transferQueue, indices.graphicsFamily.value(), graphicsQueue) != VK_SUCCESS) {
+    logLine() << "Failed to create upload queue";
+    return 1;
+  }
+  logLine() << "Created Upload Queue";
+
+  // Create the staging ring
+  phase.next("create rings");
+  if (staging.init(&allocator) != VK_SUCCESS) {
+    logLine() << "Failed to create staging ring";
+    return 1;
+  }
+  logLine() << "Created Staging Ring";
+
+  if (uniforms.init(&allocator, deviceProperties.limits.minUniformBufferOffsetAlignment, MAX_FRAMES_IN_FLIGHT,
+                    uniformFrameSize(deviceProperties, opts.draws)) != VK_SUCCESS) {
+    logLine() << "Failed to create uniform ring";
+    return 1;
+  }
+  writeDrawDescriptor(device, drawSet, uniforms.buffer);
+  if (useBindless) {
+    bindlessFrame.drawBuffer = bindless.addBuffer(uniforms.buffer);
+  }
+  logLine() << "Created Uniform Ring";
+
+  // Upload geometry
+  phase.next("upload mesh");
+  VkResult meshResult = opts.meshPath.empty()
+    ? createMesh(&uploads, &allocator, &staging, triangleVertices, triangleIndices, &triangle)
+    : loadMeshFile(&uploads, &allocator, &staging, opts.meshPath, &triangle);
+  if (meshResult != VK_SUCCESS) {
+    logLine() << "Failed to create vertex and index buffers";
+    return 1;
+  }
+  logLine() << "Created Vertex and Index Buffers (" << triangle.indexCount / 3 << " triangles)";
+
+  phase.next("create instance buffers");
+  if (resizeInstanceBuffers(&allocator, MAX_FRAMES_IN_FLIGHT, opts.instances, culler.sourceFamilies(),
+                            &instances) != VK_SUCCESS) {
+    logLine() << "Failed to create instance buffers";
+    return 1;
+  }
+  if (culler.resize(instances.count, sizeof(InstanceData), instances.buffers) != VK_SUCCESS) {
+    logLine() << "Failed to create culling buffers";
+    return 1;
   }
+  logLine() << "Created Instance Buffers for " << opts.instances << " instances";
+
+  if (opts.sprites > 0) {
+    phase.next("create sprite renderer");
+    if (spriteRenderer.init(&uploads, &allocator, &staging, MAX_FRAMES_IN_FLIGHT, opts.sprites) != VK_SUCCESS) {
+      logLine() << "Failed to create sprite renderer";
+      return 1;
+    }
+    logLine() << "Created Sprite Renderer for " << opts.sprites << " sprites (" << spriteKernelName()
+              << " vertex kernel)";
+  }
+
+  // Create timestamp query pool, only when profiling or when dynamic resolution needs the timings
+  phase.next("create frame recorder");
+  if (createGpuProfiler(device, physicalDevice, indices.graphicsFamily.value(), &gpuProfiler,
+                        opts.dynamicResolution) != VK_SUCCESS) {
+    logLine() << "Failed to create timestamp query pool";
+    return 1;
+  }
+  gpuProfiler.passNames[trianglePass] = "gpu triangle pass";
+  if (opts.dynamicResolution) {
+    gpuProfiler.passNames[upscalePass] = "gpu upscale pass";
+  }
+
+  // Per-frame command pools and recording threads
+  if (recorder.init(device, indices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, opts.threads) != VK_SUCCESS) {
+    logLine() << "Failed to create frame command pools";
+    return 1;
+  }
+  logLine() << "Created Frame Recorder with " << recorder.threadCount() << " recording threads";
+
+  jobs.start(opts.jobThreads ? opts.jobThreads : std::max(1u, std::thread::hardware_concurrency()));
+  logLine() << "Started " << jobs.threadCount() << " job threads, " << sceneKernelName() << " scene kernel";
 
   // Creating Semaphores for syncs
+  phase.next("create sync objects");
   VkSemaphoreCreateInfo semCreateInfo{};
   semCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
@@ -557,91 +2555,731 @@ int main() {
   fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
   fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-  if (vkCreateSemaphore(device, &semCreateInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS) {
-    std::cout << "Failed to create image available semaphore" << std::endl;
-    return 1;
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    if (vkCreateSemaphore(device, &semCreateInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS) {
+      logLine() << "Failed to create image available semaphore";
+      return 1;
+    }
+
+    if (vkCreateFence(device, &fenceCreateInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+      logLine() << "Failed to create in flight fence";
+      return 1;
+    }
   }
-  std::cout << "Created Image Available Semaphore" << std::endl;
+  imagesInFlight.resize(swapChain.images.size(), VK_NULL_HANDLE);
+  logLine() << "Created Sync Objects for " << MAX_FRAMES_IN_FLIGHT << " frames in flight";
+  phase.end();
+
+  const char* spritePipelineNames[SPRITE_PIPELINE_COUNT] = {"Sprite", "Flat sprite"};
+  FrameSprites spriteFrame;
+  spriteFrame.renderer = &spriteRenderer;
+  spriteFrame.batch = &spriteBatch;
+  FrameUpscale upscaleFrame;
+  upscaleFrame.upscaler = &upscaler;
+  upscaleFrame.pass = upscalePass;
+  FrameReadback readbackFrame;
+  readbackFrame.capture = &capture;
+  readbackFrame.layout = finalLayout;
+
+  // Retired frame timings pick the scale the next frame renders at
+  auto updateResolution = [&](uint32_t slot) {
+    resolution.update(gpuProfiler.passMs, slotScale[slot]);
+    graph.setRenderScale(trianglePass, resolution.scale / opts.maxScale);
+    slotScale[slot] = resolution.scale;
+  };
 
-  if (vkCreateSemaphore(device, &semCreateInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
-    std::cout << "Failed to create render finished semaphore" << std::endl;
-    return 1;
+  bool runFrames = opts.bench.empty() || opts.bench == "instances" || opts.bench == "recording" ||
+                   opts.bench == "culling" || opts.bench == "bindless";
+
+  if (opts.bench == "upload") {
+    runUploadBenchmark(&uploads, &allocator, &staging);
+  } else if (opts.bench == "sprites") {
+    runSpriteBenchmark();
+  } else if (opts.bench == "mesh") {
+    runMeshBenchmark(&uploads, &allocator, &staging, opts.objPath);
+  } else if (opts.bench == "scene") {
+    runSceneBenchmark(&allocator, opts.jobThreads);
+  } else if (!runFrames) {
+    logLine() << "Unknown benchmark: " << opts.bench;
   }
-  std::cout << "Created Render Finished Semaphore" << std::endl;
 
-  if (vkCreateFence(device, &fenceCreateInfo, nullptr, &inFlightFence) != VK_SUCCESS) {
-    std::cout << "Failed to create in flight fence" << std::endl;
-    return 1;
+  if (headless && runFrames) {
+    // Fixed-length offscreen run. Each frame slot owns its own target, so
+    // there is nothing to acquire or present and no semaphores to wait on.
+
+    // Measure real frames, not ones that are still waiting on the pipeline
+    StartupPhase waitPhase("wait for pipeline");
+    pipelineCompiler.waitIdle();
+    waitPhase.end();
+    if (pipelineCompiler.update(&trianglePipeline, &deletion)) {
+      reportPipelineSwap("Graphics", trianglePipeline, startupBegin, warmCache, shaderSource);
+    }
+    if (pipelineCompiler.update(&cullPipeline, &deletion)) {
+      reportPipelineSwap("Culling", cullPipeline, startupBegin, warmCache, shaderSource);
+    }
+    if (pipelineCompiler.update(&bindlessPipeline, &deletion)) {
+      reportPipelineSwap("Bindless", bindlessPipeline, startupBegin, warmCache, shaderSource);
+    }
+    if (trianglePipeline.current == VK_NULL_HANDLE) {
+      logLine() << "Failed to create graphics pipeline";
+      runFrames = false;
+    }
+    // Without it GPU culling would silently measure unculled draws
+    bool needsCull = opts.cull == CULL_GPU || opts.bench == "culling";
+    if (needsCull && cullPipeline.current == VK_NULL_HANDLE) {
+      logLine() << "Failed to create culling pipeline";
+      runFrames = false;
+    }
+    if (useBindless && bindlessPipeline.current == VK_NULL_HANDLE) {
+      logLine() << "Failed to create bindless pipeline";
+      runFrames = false;
+    }
+    bindlessFrame.pipeline = bindlessPipeline.current;
+    for (uint32_t kind = 0; opts.sprites > 0 && kind < SPRITE_PIPELINE_COUNT; kind++) {
+      if (pipelineCompiler.update(&spritePipelines[kind], &deletion)) {
+        reportPipelineSwap(spritePipelineNames[kind], spritePipelines[kind], startupBegin, warmCache, shaderSource);
+      }
+      if (spritePipelines[kind].current == VK_NULL_HANDLE) {
+        logLine() << "Failed to create " << spritePipelineNames[kind] << " pipeline";
+        runFrames = false;
+      }
+      spriteFrame.pipelines[kind] = spritePipelines[kind].current;
+    }
+    if (pipelineCompiler.update(&upscalePipeline, &deletion)) {
+      reportPipelineSwap("Upscale", upscalePipeline, startupBegin, warmCache, shaderSource);
+    }
+    if (opts.dynamicResolution && upscalePipeline.current == VK_NULL_HANDLE) {
+      logLine() << "Failed to create upscale pipeline";
+      runFrames = false;
+    }
+    upscaleFrame.pipeline = upscalePipeline.current;
+  }
+
+  if (headless && runFrames) {
+    struct RunStep {
+      uint32_t instances;
+      uint32_t draws;
+      uint32_t threads;
+      CullMode cull;
+      bool bindless;
+    };
+
+    std::vector<RunStep> steps;
+    if (opts.bench == "instances") {
+      for (uint32_t count : instanceSweep) {
+        steps.push_back({std::max(count, opts.draws), opts.draws, opts.threads, opts.cull, useBindless});
+      }
+    } else if (opts.bench == "recording") {
+      // One instance per draw, so recording cost dominates
+      uint32_t draws = opts.draws > 1 ? opts.draws : 100000;
+      uint32_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+      for (uint32_t threads = 1; threads < maxThreads * 2; threads *= 2) {
+        steps.push_back({draws, draws, std::min(threads, maxThreads), CULL_NONE, useBindless});
+      }
+    } else if (opts.bench == "culling") {
+      // Same scene and camera either way, only who decides visibility changes
+      for (uint32_t count : cullSweep) {
+        steps.push_back({count, 1, opts.threads, CULL_CPU, useBindless});
+        steps.push_back({count, 1, opts.threads, CULL_GPU, useBindless});
+      }
+    } else if (opts.bench == "bindless") {
+      // One instance per draw, so the per-draw binding cost dominates
+      uint32_t draws = opts.draws > 1 ? opts.draws : 100000;
+      steps.push_back({draws, draws, opts.threads, CULL_NONE, false});
+      if (useBindless) {
+        steps.push_back({draws, draws, opts.threads, CULL_NONE, true});
+      }
+    } else {
+      steps.push_back({opts.instances, opts.draws, opts.threads, opts.cull, useBindless});
+    }
+
+    FrameCulling culling;
+    culling.camera = zoomCamera(opts.bench == "culling" && !opts.zoomSet ? CULL_BENCH_ZOOM : opts.zoom);
+    culling.frustum = extractFrustum(culling.camera);
+    culling.culler = &culler;
+    culling.meshRadius = triangle.radius;
+    // The instances are generated here first when the CPU culls them
+    std::vector<InstanceData> instanceData;
+    std::vector<uint32_t> visible;
+    culling.visible = &visible;
+
+    auto runBegin = std::chrono::steady_clock::now();
+    uint64_t totalFrames = 0;
+    double startupMs = 0.0;
+
+    for (const RunStep& step : steps) {
+      bool growUniforms = uniformFrameSize(deviceProperties, step.draws) > uniforms.frameSize;
+      if (step.instances != instances.count || step.threads != recorder.threadCount() || growUniforms) {
+        vkDeviceWaitIdle(device);
+      }
+      if (growUniforms) {
+        uniforms.destroy(&allocator);
+        if (uniforms.init(&allocator, deviceProperties.limits.minUniformBufferOffsetAlignment, MAX_FRAMES_IN_FLIGHT,
+                          uniformFrameSize(deviceProperties, step.draws)) != VK_SUCCESS) {
+          logLine() << "Failed to grow uniform ring for " << step.draws << " draws";
+          break;
+        }
+        writeDrawDescriptor(device, drawSet, uniforms.buffer);
+        if (useBindless) {
+          bindless.setBuffer(bindlessFrame.drawBuffer, uniforms.buffer);
+        }
+      }
+      if (step.instances != instances.count &&
+          (resizeInstanceBuffers(&allocator, MAX_FRAMES_IN_FLIGHT, step.instances, culler.sourceFamilies(),
+                                 &instances) != VK_SUCCESS ||
+           culler.resize(instances.count, sizeof(InstanceData), instances.buffers) != VK_SUCCESS)) {
+        logLine() << "Failed to allocate instance buffers for " << step.instances << " instances";
+        break;
+      }
+      culling.mode = step.cull;
+      culling.pipeline = cullPipeline.current;
+      if (step.threads != recorder.threadCount()) {
+        recorder.destroy();
+        if (recorder.init(device, indices.graphicsFamily.value(), MAX_FRAMES_IN_FLIGHT, step.threads) != VK_SUCCESS) {
+          logLine() << "Failed to create frame command pools";
+          break;
+        }
+      }
+
+      std::vector<double> frameTimes;
+      frameTimes.reserve(opts.frames);
+      std::vector<double> recordTimes;
+      recordTimes.reserve(opts.frames);
+      std::vector<double> cullTimes;
+      std::vector<double> scales;
+      std::vector<double> gpuTimes;
+      double uploadSeconds = 0.0;
+
+      for (uint32_t frame = 0; frame < opts.frames; frame++) {
+        auto frameStart = std::chrono::steady_clock::now();
+
+        {
+          PROFILE_SCOPE("fence wait");
+          vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+        }
+        vkResetFences(device, 1, &inFlightFences[currentFrame]);
+        deletion.collect(totalFrames);
+        if (capturing) {
+          capture.poll(totalFrames);
+        }
+
+        // This slot's previous submission has retired, its timestamps are ready
+        if (totalFrames >= MAX_FRAMES_IN_FLIGHT &&
+            gpuProfilerCollect(device, &gpuProfiler, (uint32_t)currentFrame) && opts.dynamicResolution) {
+          updateResolution((uint32_t)currentFrame);
+          scales.push_back(resolution.scale);
+          gpuTimes.push_back(gpuProfiler.passMs);
+        }
+
+        // ...and its instance buffer and command pools are free to reuse
+        {
+          PROFILE_SCOPE("instance update");
+          auto uploadStart = std::chrono::steady_clock::now();
+          std::chrono::duration<float> time = uploadStart - runBegin;
+          InstanceData* mapped = static_cast<InstanceData*>(instances.allocs[currentFrame].mapped);
+          if (step.cull == CULL_CPU) {
+            instanceData.resize(instances.count);
+            writeInstances(&jobs, &sceneTransforms, instanceData.data(), instances.count, 0.0f);
+            memcpy(mapped, instanceData.data(), sizeof(InstanceData) * instances.count);
+          } else {
+            writeInstances(&jobs, &sceneTransforms, mapped, instances.count,
+                           opts.bench == "instances" ? time.count() : 0.0f);
+          }
+          uploadSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - uploadStart).count();
+        }
+
+        if (opts.sprites > 0) {
+          PROFILE_SCOPE("sprite update");
+          writeSprites(&spriteBatch, opts.sprites, 1, 0.0f);
+        }
+
+        if (step.cull == CULL_CPU) {
+          PROFILE_SCOPE("cull");
+          auto cullStart = std::chrono::steady_clock::now();
+          cullInstances(culling.frustum, culling.meshRadius, instanceData.data(), instances.count, &visible);
+          std::chrono::duration<double, std::milli> cullElapsed = std::chrono::steady_clock::now() - cullStart;
+          cullTimes.push_back(cullElapsed.count());
+        }
+
+        VkCommandBuffer cmd;
+        {
+          PROFILE_SCOPE("record");
+          auto recordStart = std::chrono::steady_clock::now();
+          uniforms.beginFrame((uint32_t)currentFrame);
+          if (!textureHandles.empty()) {
+            textures.show(textureHandles[totalFrames / TEXTURE_CYCLE_FRAMES % textureHandles.size()]);
+          }
+          readbackFrame.image = swapChain.images[currentFrame];
+          readbackFrame.extent = swapChain.extent;
+          readbackFrame.frame = totalFrames;
+          cmd = recordFrame(&recorder, (uint32_t)currentFrame, graph, trianglePass, (uint32_t)currentFrame,
+                            opts.clearOnly ? VK_NULL_HANDLE : trianglePipeline.current, pipelineLayout, drawSet,
+                            &uniforms, triangle, instances.buffers[currentFrame], instances.count, step.draws,
+                            culling, &textures,
+                            step.bindless ? &bindlessFrame : nullptr, opts.sprites ? &spriteFrame : nullptr,
+                            opts.dynamicResolution ? &upscaleFrame : nullptr, capturing ? &readbackFrame : nullptr,
+                            &gpuProfiler);
+          std::chrono::duration<double, std::milli> recordElapsed = std::chrono::steady_clock::now() - recordStart;
+          recordTimes.push_back(recordElapsed.count());
+        }
+
+        VkSubmitInfo submit{};
+        submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit.commandBufferCount = 1;
+        submit.pCommandBuffers = &cmd;
+
+        {
+          PROFILE_SCOPE("submit");
+          VkSemaphore cullDone;
+          VkPipelineStageFlags cullStages = CULL_CONSUMER_STAGES;
+          culler.submit((uint32_t)currentFrame, &cullDone);
+          if (cullDone != VK_NULL_HANDLE) {
+            submit.waitSemaphoreCount = 1;
+            submit.pWaitSemaphores = &cullDone;
+            submit.pWaitDstStageMask = &cullStages;
+          }
+          vkQueueSubmit(graphicsQueue, 1, &submit, inFlightFences[currentFrame]);
+        }
+
+        if (totalFrames == 0) {
+          startupMs = reportTimeToFirstFrame(startupBegin, warmCache, opts.startupReportPath);
+        }
+        totalFrames++;
+
+        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - frameStart;
+        frameTimes.push_back(elapsed.count());
+      }
+
+      if (opts.bench == "instances") {
+        double megabytes = (double)sizeof(InstanceData) * step.instances / (1024.0 * 1024.0);
+        std::string label = std::to_string(step.instances) + " instances";
+        printFrameStats(label.c_str(), frameTimes);
+        logLine() << "  instance upload: " << megabytes << " MiB/frame at "
+                  << megabytes * opts.frames / std::max(uploadSeconds, 1e-9) / 1024.0 << " GiB/s";
+      } else if (opts.bench == "recording") {
+        std::string label = std::to_string(step.draws) + " draws, " + std::to_string(step.threads) + " threads";
+        printFrameStats(label.c_str(), frameTimes);
+        printFrameStats("  recording", recordTimes);
+      } else if (opts.bench == "culling") {
+        std::string label = std::to_string(step.instances) + " objects, " +
+                            (step.cull == CULL_CPU ? "cpu culled direct draws (" + std::to_string(visible.size()) +
+                                                     " visible)"
+                                                   : std::string("gpu culled indirect draw"));
+        printFrameStats(label.c_str(), frameTimes);
+        printFrameStats("  recording", recordTimes);
+        if (step.cull == CULL_CPU) {
+          printFrameStats("  culling", cullTimes);
+        }
+      } else if (opts.bench == "bindless") {
+        std::string label = std::to_string(step.draws) + " draws, " +
+                            (step.bindless ? "bindless push constants" : "per-draw descriptor sets");
+        printFrameStats(label.c_str(), frameTimes);
+        printFrameStats("  recording", recordTimes);
+      } else {
+        printFrameStats("Headless CPU frame time", frameTimes);
+      }
+      // Benchmarks with several steps report the last one
+      if (!opts.frameReportPath.empty()) {
+        writeFrameReport(opts.frameReportPath, frameTimes, startupMs);
+      }
+      if (!scales.empty()) {
+        double sum = 0.0;
+        for (double scale : scales) {
+          sum += scale;
+        }
+        logLine() << "  render scale: min " << *std::min_element(scales.begin(), scales.end()) << ", avg "
+                  << sum / scales.size() << ", last " << scales.back();
+        printFrameStats("  gpu", gpuTimes);
+      }
+      flushLog();
+    }
+  }
+
+  // Resize stress test: resize the window every few frames and make sure
+  // recreation neither leaks nor stalls
+  const VkExtent2D stressSizes[RESIZE_STRESS_WARMUP] = {{800, 600}, {1024, 768}, {640, 480}, {1280, 720}, {320, 240}};
+  uint32_t resizesDone = 0;
+  size_t stressRssBegin = 0;
+  std::vector<double> stressFrameTimes;
+
+  // The window always culls with the command line camera
+  FrameCulling windowCulling;
+  windowCulling.mode = opts.cull;
+  windowCulling.camera = zoomCamera(opts.zoom);
+  windowCulling.frustum = extractFrustum(windowCulling.camera);
+  windowCulling.culler = &culler;
+  windowCulling.meshRadius = triangle.radius;
+  std::vector<InstanceData> windowScene;
+  std::vector<uint32_t> windowVisible;
+  windowCulling.visible = &windowVisible;
+
+  // Low latency needs a slot to start late in; without a cap that is the display refresh
+  FramePacer pacer;
+  double paceIntervalMs = opts.maxFps > 0.0 ? 1000.0 / opts.maxFps : 0.0;
+  if (!headless && opts.lowLatency && paceIntervalMs == 0.0) {
+    const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    if (mode != nullptr && mode->refreshRate > 0) {
+      paceIntervalMs = 1000.0 / mode->refreshRate;
+    }
+  }
+  pacer.init(paceIntervalMs, opts.lowLatency);
+  if (!headless && pacer.active()) {
+    logLine() << "Pacing frames at " << paceIntervalMs << " ms" << (opts.lowLatency ? ", starting work late" : "");
   }
-  std::cout << "Created In Flight Fence" << std::endl;
+  std::vector<double> inputLatencies;
 
   // Main loop
-  while(!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
+  bool firstFramePresented = false;
+  uint64_t frameCount = 0;
+  uint64_t framesSubmitted = 0;
+  while (!headless && runFrames && !glfwWindowShouldClose(window)) {
+    auto frameStart = std::chrono::steady_clock::now();
+
+    if (opts.resizeStress > 0 && frameCount > 0 && frameCount % 10 == 0) {
+      if (resizesDone == opts.resizeStress) {
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+      } else {
+        const VkExtent2D& size = stressSizes[resizesDone % RESIZE_STRESS_WARMUP];
+        glfwSetWindowSize(window, (int)size.width, (int)size.height);
+        resizesDone++;
+        // Let the first full round of sizes warm up driver allocations before measuring
+        if (resizesDone == RESIZE_STRESS_WARMUP) {
+          stressRssBegin = currentRssBytes();
+        }
+      }
+    }
 
     // Draw frame
-    vkWaitForFences(device, 1, &inFlightFence, VK_TRUE, UINT64_MAX);
-    vkResetFences(device, 1, &inFlightFence);
+    // Only block on the frame that last used this slot, so up to
+    // MAX_FRAMES_IN_FLIGHT frames can be queued on the GPU at once.
+    {
+      PROFILE_SCOPE("fence wait");
+      vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    }
+    // Every frame before this slot's last one has retired too
+    deletion.collect(framesSubmitted);
+    if (capturing) {
+      capture.poll(framesSubmitted);
+    }
 
     uint32_t imageIndex;
-    vkAcquireNextImageKHR(
-      device, swapChain, UINT64_MAX,
-      imageAvailableSemaphore, VK_NULL_HANDLE,
-      &imageIndex
-    );
+    VkResult result;
+    {
+      PROFILE_SCOPE("acquire");
+      result = vkAcquireNextImageKHR(
+        device, swapChain.handle, UINT64_MAX,
+        imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE,
+        &imageIndex
+      );
+    }
+
+    // Nothing was acquired, so the semaphore is unsignaled and the fence untouched
+    bool needsRecreate = false;
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+      needsRecreate = true;
+    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      logLine() << "Failed to acquire swap chain image";
+      break;
+    }
 
-    VkSubmitInfo submit{};
-    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    // Input is sampled after every wait, so the frame is built from the freshest state
+    if (!needsRecreate) {
+      PROFILE_SCOPE("pace");
+      pacer.wait();
+    }
+    glfwPollEvents();
+    auto inputSampled = std::chrono::steady_clock::now();
+
+    if (!needsRecreate) {
+      // The swapchain may hand back an image an older frame is still rendering to
+      if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+        PROFILE_SCOPE("image fence wait");
+        vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+      }
+      imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+
+      // The fence wait above retired this slot's last frame, its timestamps are ready
+      if (framesSubmitted >= MAX_FRAMES_IN_FLIGHT &&
+          gpuProfilerCollect(device, &gpuProfiler, (uint32_t)currentFrame) && opts.dynamicResolution) {
+        updateResolution((uint32_t)currentFrame);
+      }
+
+      {
+        PROFILE_SCOPE("instance update");
+        InstanceData* mapped = static_cast<InstanceData*>(instances.allocs[currentFrame].mapped);
+        float time = opts.animate ? (float)glfwGetTime() : 0.0f;
+        if (opts.cull == CULL_CPU) {
+          windowScene.resize(instances.count);
+          writeInstances(&jobs, &sceneTransforms, windowScene.data(), instances.count, time);
+          memcpy(mapped, windowScene.data(), sizeof(InstanceData) * instances.count);
+        } else {
+          writeInstances(&jobs, &sceneTransforms, mapped, instances.count, time);
+        }
+      }
+
+      if (opts.sprites > 0) {
+        PROFILE_SCOPE("sprite update");
+        writeSprites(&spriteBatch, opts.sprites, 1, (float)glfwGetTime());
+      }
+
+      if (opts.cull == CULL_CPU) {
+        PROFILE_SCOPE("cull");
+        cullInstances(windowCulling.frustum, windowCulling.meshRadius, windowScene.data(), instances.count,
+                      &windowVisible);
+      }
+
+      // Pick up finished builds; retired pipelines go once their frames have
+      if (pipelineCompiler.update(&trianglePipeline, &deletion)) {
+        reportPipelineSwap("Graphics", trianglePipeline, startupBegin, warmCache, shaderSource);
+      }
+      if (pipelineCompiler.update(&cullPipeline, &deletion)) {
+        reportPipelineSwap("Culling", cullPipeline, startupBegin, warmCache, shaderSource);
+      }
+      windowCulling.pipeline = cullPipeline.current;
+      if (pipelineCompiler.update(&bindlessPipeline, &deletion)) {
+        reportPipelineSwap("Bindless", bindlessPipeline, startupBegin, warmCache, shaderSource);
+      }
+      // Descriptor sets until the bindless pipeline has been built
+      bindlessFrame.pipeline = bindlessPipeline.current;
+      bool drawBindless = useBindless && bindlessFrame.pipeline != VK_NULL_HANDLE;
+      for (uint32_t kind = 0; opts.sprites > 0 && kind < SPRITE_PIPELINE_COUNT; kind++) {
+        if (pipelineCompiler.update(&spritePipelines[kind], &deletion)) {
+          reportPipelineSwap(spritePipelineNames[kind], spritePipelines[kind], startupBegin, warmCache, shaderSource);
+        }
+        spriteFrame.pipelines[kind] = spritePipelines[kind].current;
+      }
+      // Until it is built the backbuffer is only cleared
+      if (pipelineCompiler.update(&upscalePipeline, &deletion)) {
+        reportPipelineSwap("Upscale", upscalePipeline, startupBegin, warmCache, shaderSource);
+      }
+      upscaleFrame.pipeline = upscalePipeline.current;
+
+      VkCommandBuffer cmd;
+      {
+        PROFILE_SCOPE("record");
+        uniforms.beginFrame((uint32_t)currentFrame);
+        if (!textureHandles.empty()) {
+          textures.show(textureHandles[framesSubmitted / TEXTURE_CYCLE_FRAMES % textureHandles.size()]);
+        }
+        readbackFrame.image = swapChain.images[imageIndex];
+        readbackFrame.extent = swapChain.extent;
+        readbackFrame.frame = framesSubmitted;
+        cmd = recordFrame(&recorder, (uint32_t)currentFrame, graph, trianglePass, imageIndex,
+                          opts.clearOnly ? VK_NULL_HANDLE : trianglePipeline.current, pipelineLayout, drawSet,
+                          &uniforms, triangle, instances.buffers[currentFrame], instances.count, opts.draws,
+                          windowCulling, &textures,
+                          drawBindless ? &bindlessFrame : nullptr, opts.sprites ? &spriteFrame : nullptr,
+                          opts.dynamicResolution ? &upscaleFrame : nullptr, capturing ? &readbackFrame : nullptr,
+                          &gpuProfiler);
+      }
+
+      vkResetFences(device, 1, &inFlightFences[currentFrame]);
+
+      VkSubmitInfo submit{};
+      submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+      VkSemaphore waitSem[] = {imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE};
+      VkPipelineStageFlags waitStages[] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        CULL_CONSUMER_STAGES
+      };
+
+      // The async cull goes to the compute queue first, the draws wait for it
+      culler.submit((uint32_t)currentFrame, &waitSem[1]);
+      submit.waitSemaphoreCount = waitSem[1] != VK_NULL_HANDLE ? 2 : 1;
+      submit.pWaitSemaphores = waitSem;
+      submit.pWaitDstStageMask = waitStages;
+      submit.commandBufferCount = 1;
+      submit.pCommandBuffers = &cmd;
+
+      VkSemaphore signalSem[] = {swapChain.renderFinished[imageIndex]};
+      submit.signalSemaphoreCount = 1;
+      submit.pSignalSemaphores = signalSem;
+
+      {
+        PROFILE_SCOPE("submit");
+        vkQueueSubmit(graphicsQueue, 1, &submit, inFlightFences[currentFrame]);
+      }
+      framesSubmitted++;
+
+      VkPresentInfoKHR present{};
+      present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+      present.waitSemaphoreCount = 1;
+      present.pWaitSemaphores = signalSem;
+      present.swapchainCount = 1;
+      present.pSwapchains = &swapChain.handle;
+      present.pImageIndices = &imageIndex;
+
+      {
+        PROFILE_SCOPE("present");
+        std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - inputSampled;
+        inputLatencies.push_back(latency.count());
+        pacer.frameDone(latency.count());
+        result = vkQueuePresentKHR(presentQueue, &present);
+      }
+
+      if (!firstFramePresented) {
+        reportTimeToFirstFrame(startupBegin, warmCache, opts.startupReportPath);
+        firstFramePresented = true;
+      }
+
+      needsRecreate = result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized;
+      if (result != VK_SUCCESS && !needsRecreate) {
+        logLine() << "Failed to present swap chain image";
+        break;
+      }
+
+      currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    }
 
-    VkSemaphore waitSem[] = {imageAvailableSemaphore};
-    VkPipelineStageFlags waitStages[] = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-    };
+    if (needsRecreate) {
+      PROFILE_SCOPE("recreate swapchain");
+      framebufferResized = false;
+
+      // The old swapchain, views, framebuffers and transients are retired
+      // behind the frames in flight, so the GPU is never drained here
+      VkResult recreated = recreateSwapChain(window, physicalDevice, device, surface, indices, opts.present,
+                                             &swapChain, &deletion);
+      // Closed while minimized, shut down with the old swapchain
+      if (recreated == VK_NOT_READY)
+        break;
+      if (recreated != VK_SUCCESS) {
+        logLine() << "Failed to recreate swap chain";
+        break;
+      }
+
+      // Render passes survive, so builds in flight keep a valid one
+      graph.setImportedViews(backbuffer, swapChain.imageViews);
+      if (graph.resize(swapChain.extent, &deletion) != VK_SUCCESS) {
+        logLine() << "Failed to resize render graph";
+        break;
+      }
+      if (opts.dynamicResolution) {
+        upscaler.setSource(graph.imageView(scene), graph.imageExtent(scene));
+      }
+
+      // Frames are recorded against the current framebuffers, only the image count may have changed
+      imagesInFlight.assign(swapChain.images.size(), VK_NULL_HANDLE);
+    }
 
-    submit.waitSemaphoreCount = 1;
-    submit.pWaitSemaphores = waitSem;
-    submit.pWaitDstStageMask = waitStages;
-    submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &commandBuffers[imageIndex];
+    // Anything logged during the frame goes out in one write
+    flushLog();
 
-    VkSemaphore signalSem[] = {renderFinishedSemaphore};
-    submit.signalSemaphoreCount = 1;
-    submit.pSignalSemaphores = signalSem;
+    frameCount++;
+    if (opts.resizeStress > 0) {
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - frameStart;
+      stressFrameTimes.push_back(elapsed.count());
+    }
+  }
 
-    vkQueueSubmit(graphicsQueue, 1, &submit, inFlightFence);
+  if (!headless && runFrames) {
+    printFrameStats("Input to present", inputLatencies);
+  }
 
-    VkPresentInfoKHR present{};
-    present.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    present.waitSemaphoreCount = 1;
-    present.pWaitSemaphores = signalSem;
-    present.swapchainCount = 1;
-    present.pSwapchains = &swapChain;
-    present.pImageIndices = &imageIndex;
+  int exitCode = 0;
+  if (opts.resizeStress > 0) {
+    // Growth after warm-up means something extent-dependent is not being released
+    const double maxRssGrowthMb = 4.0;
+    const double maxSpikeMs = 250.0;
 
-    vkQueuePresentKHR(graphicsQueue, &present);
+    double rssGrowthMb = stressRssBegin ? ((double)currentRssBytes() - (double)stressRssBegin) / (1024.0 * 1024.0) : 0.0;
+    double worstFrameMs = stressFrameTimes.empty() ? 0.0 : *std::max_element(stressFrameTimes.begin(), stressFrameTimes.end());
+
+    logLine() << "Resize stress: " << resizesDone << " resizes, RSS growth " << rssGrowthMb << " MB, "
+              << deletion.destroyed << " objects retired without a device wait";
+    printFrameStats("Resize stress frame time", stressFrameTimes);
+
+    if (rssGrowthMb > maxRssGrowthMb || worstFrameMs > maxSpikeMs) {
+      logLine() << "Resize stress FAILED (limits: " << maxRssGrowthMb << " MB growth, "
+                << maxSpikeMs << " ms frame)";
+      exitCode = 1;
+    }
+  }
+
+  // Shutdown: stop everything that can still submit or create objects, wait
+  // for the GPU once, then destroy in reverse order of creation.
+  // A build may still be running; it finishes, anything queued behind it is dropped
+  pipelineCompiler.stop();
+  jobs.stop();
+
+  // Frames may still be executing, wait for them before tearing anything down.
+  // A lost device still allows destruction, so cleanup goes ahead either way.
+  if (vkDeviceWaitIdle(device) != VK_SUCCESS) {
+    logLine() << "Device lost before shutdown";
+  }
+  deletion.flush();
+  // Every copy has landed; the writer drains what is left before it stops
+  if (capturing) {
+    capture.finish();
+    capture.report();
+  }
+
+  if (profiler().enabled) {
+    exportProfile(opts.profilePath);
   }
 
   // Cleanup
-  vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
-  vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
-  vkDestroyFence(device, inFlightFence, nullptr);
+  destroyGpuProfiler(device, &gpuProfiler);
+
+  capture.destroy();
+  culler.destroy();
+  bindless.destroy();
+  spriteRenderer.destroy(&allocator);
+  textures.destroy();
+  destroyInstanceBuffers(&allocator, &instances);
+  destroyMesh(&allocator, &triangle);
+  uniforms.destroy(&allocator);
+  staging.destroy(&allocator);
+  graph.destroy();
+  allocator.printStats();
+  allocator.destroy();
+
+  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+    vkDestroyFence(device, inFlightFences[i], nullptr);
+  }
   
-  vkDestroyCommandPool(device, commandPool, nullptr);
-
-  for (auto fb : swapChainFramebuffers) {
-    vkDestroyFramebuffer(device, fb, nullptr);
+  recorder.destroy();
+  uploads.destroy();
+
+  pipelineCompiler.destroySlot(&trianglePipeline);
+  pipelineCompiler.destroySlot(&cullPipeline);
+  pipelineCompiler.destroySlot(&bindlessPipeline);
+  pipelineCompiler.destroySlot(&upscalePipeline);
+  upscaler.destroy();
+  for (PipelineSlot& slot : spritePipelines) {
+    pipelineCompiler.destroySlot(&slot);
   }
-  vkDestroyRenderPass(device, renderPass, nullptr);
+  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(device, drawSetLayout, nullptr);
+
+  savePipelineCache(device, pipelineCache, opts.pipelineCachePath);
+  vkDestroyPipelineCache(device, pipelineCache, nullptr);
+
+  destroyImageViews(device, &swapChain);
 
-  for (auto view : swapChainImageViews) {
-    vkDestroyImageView(device, view, nullptr);
+  if (headless) {
+    for (size_t i = 0; i < swapChain.images.size(); i++) {
+      vkDestroyImage(device, swapChain.images[i], nullptr);
+      vkFreeMemory(device, offscreenMemory[i], nullptr);
+    }
+  } else {
+    vkDestroySwapchainKHR(device, swapChain.handle, nullptr);
   }
-  vkDestroySwapchainKHR(device, swapChain, nullptr);
   vkDestroyDevice(device, nullptr);
-  vkDestroySurfaceKHR(instance, surface, nullptr);
+
+  if (!headless) {
+    vkDestroySurfaceKHR(instance, surface, nullptr);
+  }
   vkDestroyInstance(instance, nullptr);
-  glfwDestroyWindow(window);
-  glfwTerminate();
 
-  return 0;
+  if (!headless) {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+  }
+
+  return exitCode;
 }
@@ -0,0 +1,324 @@
+#pragma once
+
+// Binary mesh container (.lvm) and the OBJ reader used to produce it.
+//
+// Every blob starts at a MESH_FILE_ALIGN boundary from the start of the file:
+//
+//   MeshFileHeader
+//   MeshFileRange[rangeCount]   runs of triangles with their own bounds, by LOD
+//   vertices                    vertexCount * vertexStride bytes
+//   indices                     indexCount * indexSize bytes
+//
+// Vertices are stored in the exact layout the vertex input reads, so loading
+// is an mmap, a header check, one pass over the indices to make sure none
+// points past the vertices, and a copy from the mapping into the staging
+// ring. All parsing happens offline in meshconv. The renderer is 2D: OBJ
+// positions are projected onto xy and bounds are xy boxes.
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define MESH_FILE_MAGIC 0x314d564cu   // "LVM1" in file byte order
+#define MESH_FILE_VERSION 1
+#define MESH_FILE_ALIGN 64
+// Triangles per range; small enough for ranges to cull usefully, large enough to draw in few calls
+#define MESH_RANGE_TRIANGLES 256
+
+enum MeshVertexFormat : uint32_t {
+  MESH_VERTEX_POS2_COLOR3 = 1,   // float x, y, r, g, b
+};
+
+// Matches the app's Vertex, see the static_assert next to it
+struct MeshVertex {
+  float pos[2];
+  float color[3];
+};
+
+struct MeshFileRange {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  uint32_t lod;        // 0 is the full detail mesh
+  uint32_t reserved;
+  float boundsMin[2];
+  float boundsMax[2];
+};
+
+struct MeshFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vertexFormat;
+  uint32_t vertexStride;
+  uint32_t indexSize;   // 2 or 4 bytes
+  uint32_t maxIndex;    // largest index, below vertexCount
+  uint32_t rangeCount;
+  uint32_t lodCount;
+  uint64_t vertexCount;
+  uint64_t indexCount;
+  uint64_t rangeOffset;
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  float boundsMin[2];
+  float boundsMax[2];
+};
+
+// Pointers into a mapped .lvm file, valid while the mapping is
+struct MeshFileView {
+  const MeshFileHeader* header = nullptr;
+  const MeshFileRange* ranges = nullptr;
+  const void* vertices = nullptr;
+  const void* indices = nullptr;
+  uint64_t vertexBytes = 0;
+  uint64_t indexBytes = 0;
+};
+
+// Largest of `count` indices of `indexSize` bytes each
+inline uint32_t meshMaxIndex(const void* indices, uint64_t count, uint32_t indexSize) {
+  uint32_t largest = 0;
+  if (indexSize == 2) {
+    const uint16_t* narrow = static_cast<const uint16_t*>(indices);
+    for (uint64_t i = 0; i < count; i++) {
+      largest = std::max<uint32_t>(largest, narrow[i]);
+    }
+  } else {
+    const uint32_t* wide = static_cast<const uint32_t*>(indices);
+    for (uint64_t i = 0; i < count; i++) {
+      largest = std::max(largest, wide[i]);
+    }
+  }
+  return largest;
+}
+
+// Checks the header, that every blob lies inside the `size` bytes at `data`,
+// that every range lies inside the indices and that the indices stay inside
+// the vertices, so the GPU never fetches past them
+inline bool openMeshFile(const void* data, size_t size, MeshFileView* view) {
+  if (data == nullptr || size < sizeof(MeshFileHeader))
+    return false;
+
+  const MeshFileHeader* header = static_cast<const MeshFileHeader*>(data);
+  if (header->magic != MESH_FILE_MAGIC || header->version != MESH_FILE_VERSION ||
+      header->vertexFormat != MESH_VERTEX_POS2_COLOR3 || header->vertexStride != sizeof(MeshVertex) ||
+      (header->indexSize != 2 && header->indexSize != 4))
+    return false;
+
+  // Counts are bounded by the file size first, so the products below cannot overflow
+  if (header->vertexCount > size || header->indexCount > size || header->rangeCount > size ||
+      header->maxIndex >= header->vertexCount)
+    return false;
+
+  uint64_t rangeBytes = (uint64_t)header->rangeCount * sizeof(MeshFileRange);
+  uint64_t vertexBytes = header->vertexCount * header->vertexStride;
+  uint64_t indexBytes = header->indexCount * header->indexSize;
+  auto inside = [size](uint64_t offset, uint64_t bytes) {
+    return offset % MESH_FILE_ALIGN == 0 && offset <= size && bytes <= size - offset;
+  };
+  if (!inside(header->rangeOffset, rangeBytes) || !inside(header->vertexOffset, vertexBytes) ||
+      !inside(header->indexOffset, indexBytes))
+    return false;
+
+  const char* base = static_cast<const char*>(data);
+  const MeshFileRange* ranges = reinterpret_cast<const MeshFileRange*>(base + header->rangeOffset);
+  for (uint32_t r = 0; r < header->rangeCount; r++) {
+    if (ranges[r].lod >= header->lodCount ||
+        (uint64_t)ranges[r].firstIndex + ranges[r].indexCount > header->indexCount)
+      return false;
+  }
+  if (meshMaxIndex(base + header->indexOffset, header->indexCount, header->indexSize) != header->maxIndex)
+    return false;
+
+  view->header = header;
+  view->ranges = ranges;
+  view->vertices = base + header->vertexOffset;
+  view->indices = base + header->indexOffset;
+  view->vertexBytes = vertexBytes;
+  view->indexBytes = indexBytes;
+  return true;
+}
+
+// Geometry as parsed from OBJ, one vertex per position
+struct ObjMesh {
+  std::vector<MeshVertex> vertices;
+  std::vector<uint32_t> indices;
+};
+
+// Reads `v x y z [r g b]` and `f` lines; faces are fan-triangulated and
+// `v/vt/vn` references use only the position. Everything else is skipped.
+inline bool parseObj(const char* path, ObjMesh* mesh) {
+  FILE* file = std::fopen(path, "rb");
+  if (file == nullptr)
+    return false;
+
+  std::fseek(file, 0, SEEK_END);
+  long length = std::ftell(file);
+  std::fseek(file, 0, SEEK_SET);
+  if (length <= 0) {
+    std::fclose(file);
+    return false;
+  }
+
+  // One read and a terminator, so strtof/strtol can never run off the end
+  std::vector<char> text((size_t)length + 1);
+  size_t read = std::fread(text.data(), 1, (size_t)length, file);
+  std::fclose(file);
+  if (read != (size_t)length)
+    return false;
+  text[read] = '\0';
+
+  mesh->vertices.clear();
+  mesh->indices.clear();
+
+  std::vector<uint32_t> face;
+  char* cursor = text.data();
+  char* end = text.data() + read;
+  while (cursor < end) {
+    char* lineEnd = static_cast<char*>(std::memchr(cursor, '\n', (size_t)(end - cursor)));
+    if (lineEnd == nullptr)
+      lineEnd = end;
+    *lineEnd = '\0';
+
+    if (cursor[0] == 'v' && cursor[1] == ' ') {
+      MeshVertex v{{0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}};
+      char* p = cursor + 2;
+      v.pos[0] = std::strtof(p, &p);
+      v.pos[1] = std::strtof(p, &p);
+      std::strtof(p, &p);   // z, dropped
+      char* colorEnd;
+      float r = std::strtof(p, &colorEnd);
+      if (colorEnd != p) {
+        p = colorEnd;
+        v.color[0] = r;
+        v.color[1] = std::strtof(p, &p);
+        v.color[2] = std::strtof(p, &p);
+      }
+      mesh->vertices.push_back(v);
+    } else if (cursor[0] == 'f' && cursor[1] == ' ') {
+      face.clear();
+      char* p = cursor + 2;
+      while (true) {
+        char* next;
+        long index = std::strtol(p, &next, 10);
+        if (next == p)
+          break;
+        // Negative indices count back from the last vertex
+        long resolved = index < 0 ? (long)mesh->vertices.size() + index : index - 1;
+        if (resolved < 0 || resolved >= (long)mesh->vertices.size())
+          return false;
+        face.push_back((uint32_t)resolved);
+        // Skip the /vt/vn part
+        p = next;
+        while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r')
+          p++;
+      }
+      for (size_t i = 2; i < face.size(); i++) {
+        mesh->indices.push_back(face[0]);
+        mesh->indices.push_back(face[i - 1]);
+        mesh->indices.push_back(face[i]);
+      }
+    }
+
+    cursor = lineEnd + 1;
+  }
+
+  return !mesh->vertices.empty() && !mesh->indices.empty();
+}
+
+// Radius of the bounding circle around the origin, as used for culling
+inline float meshBoundsRadius(const float boundsMin[2], const float boundsMax[2]) {
+  float x = std::max(std::abs(boundsMin[0]), std::abs(boundsMax[0]));
+  float y = std::max(std::abs(boundsMin[1]), std::abs(boundsMax[1]));
+  return std::sqrt(x * x + y * y);
+}
+
+// Writes `mesh` as a single LOD split into MESH_RANGE_TRIANGLES ranges,
+// failing when an index points past the vertices. `error`, when set, gets
+// the reason for a failure.
+inline bool writeMeshFile(const char* path, const ObjMesh& mesh, const char** error = nullptr) {
+  auto align = [](uint64_t offset) { return (offset + MESH_FILE_ALIGN - 1) / MESH_FILE_ALIGN * MESH_FILE_ALIGN; };
+  auto fail = [error](const char* reason) {
+    if (error)
+      *error = reason;
+    return false;
+  };
+
+  if (mesh.vertices.empty())
+    return fail("no vertices");
+  uint32_t maxIndex = meshMaxIndex(mesh.indices.data(), mesh.indices.size(), sizeof(uint32_t));
+  if (maxIndex >= mesh.vertices.size())
+    return fail("an index points past the last vertex");
+
+  MeshFileHeader header{};
+  header.magic = MESH_FILE_MAGIC;
+  header.version = MESH_FILE_VERSION;
+  header.vertexFormat = MESH_VERTEX_POS2_COLOR3;
+  header.vertexStride = sizeof(MeshVertex);
+  // 16-bit indices whenever they reach every vertex, halving the index blob
+  header.indexSize = mesh.vertices.size() <= 0x10000 ? 2 : 4;
+  header.maxIndex = maxIndex;
+  header.lodCount = 1;
+  header.vertexCount = mesh.vertices.size();
+  header.indexCount = mesh.indices.size();
+  // Over every vertex, so the culling radius also covers ones no triangle uses
+  header.boundsMin[0] = header.boundsMin[1] = FLT_MAX;
+  header.boundsMax[0] = header.boundsMax[1] = -FLT_MAX;
+  for (const MeshVertex& v : mesh.vertices) {
+    for (int axis = 0; axis < 2; axis++) {
+      header.boundsMin[axis] = std::min(header.boundsMin[axis], v.pos[axis]);
+      header.boundsMax[axis] = std::max(header.boundsMax[axis], v.pos[axis]);
+    }
+  }
+
+  std::vector<MeshFileRange> ranges;
+  const uint32_t rangeIndices = MESH_RANGE_TRIANGLES * 3;
+  for (size_t first = 0; first < mesh.indices.size(); first += rangeIndices) {
+    MeshFileRange range{};
+    range.firstIndex = (uint32_t)first;
+    range.indexCount = (uint32_t)std::min<size_t>(rangeIndices, mesh.indices.size() - first);
+    range.boundsMin[0] = range.boundsMin[1] = FLT_MAX;
+    range.boundsMax[0] = range.boundsMax[1] = -FLT_MAX;
+    for (uint32_t i = 0; i < range.indexCount; i++) {
+      const MeshVertex& v = mesh.vertices[mesh.indices[first + i]];
+      for (int axis = 0; axis < 2; axis++) {
+        range.boundsMin[axis] = std::min(range.boundsMin[axis], v.pos[axis]);
+        range.boundsMax[axis] = std::max(range.boundsMax[axis], v.pos[axis]);
+      }
+    }
+    ranges.push_back(range);
+  }
+  header.rangeCount = (uint32_t)ranges.size();
+
+  header.rangeOffset = align(sizeof(MeshFileHeader));
+  header.vertexOffset = align(header.rangeOffset + ranges.size() * sizeof(MeshFileRange));
+  header.indexOffset = align(header.vertexOffset + mesh.vertices.size() * sizeof(MeshVertex));
+
+  FILE* file = std::fopen(path, "wb");
+  if (file == nullptr)
+    return fail("cannot open the output file");
+
+  const char zeros[MESH_FILE_ALIGN] = {};
+  uint64_t written = 0;
+  auto write = [&](uint64_t offset, const void* data, size_t bytes) {
+    std::fwrite(zeros, 1, offset - written, file);
+    std::fwrite(data, 1, bytes, file);
+    written = offset + bytes;
+  };
+  write(0, &header, sizeof(header));
+  write(header.rangeOffset, ranges.data(), ranges.size() * sizeof(MeshFileRange));
+  write(header.vertexOffset, mesh.vertices.data(), mesh.vertices.size() * sizeof(MeshVertex));
+  if (header.indexSize == 2) {
+    std::vector<uint16_t> narrow(mesh.indices.begin(), mesh.indices.end());
+    write(header.indexOffset, narrow.data(), narrow.size() * sizeof(uint16_t));
+  } else {
+    write(header.indexOffset, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+  }
+
+  bool ok = std::ferror(file) == 0;
+  if (std::fclose(file) != 0 || !ok)
+    return fail("write error");
+  return true;
+}
@@ -0,0 +1,31 @@
+// Offline OBJ to .lvm converter: meshconv input.obj output.lvm
+
+#include "mesh.h"
+
+#include <chrono>
+#include <cstdio>
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::fprintf(stderr, "Usage: meshconv input.obj output.lvm\n");
+    return 1;
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+
+  ObjMesh mesh;
+  if (!parseObj(argv[1], &mesh)) {
+    std::fprintf(stderr, "Failed to read OBJ: %s\n", argv[1]);
+    return 1;
+  }
+  const char* error = "";
+  if (!writeMeshFile(argv[2], mesh, &error)) {
+    std::fprintf(stderr, "Failed to write mesh %s: %s\n", argv[2], error);
+    return 1;
+  }
+
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+  std::printf("%s: %zu vertices, %zu triangles in %.1f ms\n", argv[2], mesh.vertices.size(),
+              mesh.indices.size() / 3, elapsed.count());
+  return 0;
+}
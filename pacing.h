@@ -0,0 +1,92 @@
+#pragma once
+
+// Frame pacing.
+//
+// FramePacer caps the frame rate and can start each frame's CPU work as late
+// as its slot allows. Input is sampled once the pacer lets the frame start,
+// so work that would otherwise sit in a queue waiting for the display is
+// replaced by a sleep ahead of the sample, and the presented frame shows
+// fresher input. How long the work takes is learned from recent frames.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Recent frames whose CPU work time bounds the expected one
+#define PACER_HISTORY 32
+// Slack left between the predicted end of the work and the end of the slot
+#define PACER_MARGIN_MS 1.0
+// Sleeps end this early and spin the rest, OS timers overshoot by about this much
+#define PACER_SPIN_MS 1.0
+
+class FramePacer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // `intervalMs` is the frame slot, 0 leaves the rate uncapped. With
+  // `delayWork` each frame starts as late in its slot as the expected work allows.
+  void init(double intervalMs, bool delayWork) {
+    interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(intervalMs));
+    this->delayWork = delayWork;
+    next = Clock::time_point{};
+    std::fill(history, history + PACER_HISTORY, 0.0);
+    historyIndex = 0;
+  }
+
+  bool active() const { return interval.count() > 0; }
+
+  // Blocks until the next frame may start sampling input
+  void wait() {
+    if (!active())
+      return;
+
+    Clock::time_point now = Clock::now();
+    // Behind by more than a slot: start over from now instead of rushing to catch up
+    if (next == Clock::time_point{} || now > next + interval) {
+      next = now;
+    }
+
+    Clock::time_point target = next;
+    if (delayWork) {
+      std::chrono::duration<double, std::milli> slack =
+        std::chrono::duration<double, std::milli>(interval) -
+        std::chrono::duration<double, std::milli>(expectedWorkMs() + PACER_MARGIN_MS);
+      if (slack.count() > 0.0) {
+        target += std::chrono::duration_cast<Clock::duration>(slack);
+      }
+    }
+    next += interval;
+
+    sleepUntil(target);
+  }
+
+  // CPU time from wait() returning to the frame being handed to present
+  void frameDone(double workMs) {
+    history[historyIndex] = workMs;
+    historyIndex = (historyIndex + 1) % PACER_HISTORY;
+  }
+
+  // Worst of the recent frames; a late frame costs more than a little extra latency
+  double expectedWorkMs() const {
+    return *std::max_element(history, history + PACER_HISTORY);
+  }
+
+private:
+  static void sleepUntil(Clock::time_point target) {
+    Clock::time_point coarse = target - std::chrono::duration_cast<Clock::duration>(
+                                          std::chrono::duration<double, std::milli>(PACER_SPIN_MS));
+    if (Clock::now() < coarse) {
+      std::this_thread::sleep_until(coarse);
+    }
+    while (Clock::now() < target) {
+      std::this_thread::yield();
+    }
+  }
+
+  Clock::duration interval{0};
+  bool delayWork = false;
+  Clock::time_point next{};
+  double history[PACER_HISTORY] = {};
+  uint32_t historyIndex = 0;
+};
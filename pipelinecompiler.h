@@ -0,0 +1,236 @@
+#pragma once
+
+// Background pipeline compilation with .spv hot-reload.
+//
+// Builds run on one worker thread, so shader loading and vkCreate*Pipelines
+// never stall the render thread. A finished pipeline is published to its
+// PipelineSlot and swapped in by the render thread at the start of a frame;
+// until the first build lands the slot is null and the frame draws without
+// it. The pipeline it replaces goes to the DeletionQueue, which destroys it
+// once every frame that could still reference it has retired.
+//
+// Watched files are polled by mtime and only rebuilt once the mtime has held
+// still for a full poll, so a shader compiler that is still writing the file
+// is not picked up half way.
+
+#include <vulkan/vulkan.h>
+
+#include "deletion.h"
+#include "logger.h"
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define PIPELINE_WATCH_INTERVAL_MS 250
+
+struct PipelineSlot {
+  // Render thread only
+  VkPipeline current = VK_NULL_HANDLE;
+  uint32_t generation = 0;   // bumped on every swap
+
+  // Written by the worker, claimed by the render thread
+  std::atomic<VkPipeline> pending{VK_NULL_HANDLE};
+  std::atomic<double> pendingCompileMs{0.0};
+  double compileMs = 0.0;    // of `current`
+};
+
+class PipelineCompiler {
+public:
+  using BuildFn = std::function<VkResult(VkPipeline*)>;
+
+  ~PipelineCompiler() { stop(); }
+
+  void start(VkDevice device) {
+    this->device = device;
+    quit = false;
+    worker = std::thread(&PipelineCompiler::workerLoop, this);
+  }
+
+  // Finishes the build in progress, drops the rest of the queue
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+      busy -= (uint32_t)jobs.size();
+      jobs.clear();
+    }
+    wake.notify_all();
+    if (worker.joinable())
+      worker.join();
+  }
+
+  void submit(PipelineSlot* slot, BuildFn build) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back({slot, std::move(build)});
+      busy++;
+    }
+    wake.notify_all();
+  }
+
+  // Resubmits `build` whenever any of `paths` changes on disk
+  void watch(PipelineSlot* slot, const std::vector<std::string>& paths, BuildFn build) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Watch w;
+    w.slot = slot;
+    w.build = std::move(build);
+    for (const std::string& path : paths) {
+      int64_t mtime = modifiedNs(path);
+      w.files.push_back({path, mtime, mtime});
+    }
+    watches.push_back(std::move(w));
+  }
+
+  // Blocks until the queue is empty and no build is running
+  void waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return busy == 0; });
+  }
+
+  // Render thread, once per frame after `retire` has collected and before
+  // recording. Returns true when a new pipeline was swapped in.
+  bool update(PipelineSlot* slot, DeletionQueue* retire) {
+    VkPipeline fresh = slot->pending.exchange(VK_NULL_HANDLE);
+    if (fresh == VK_NULL_HANDLE)
+      return false;
+
+    if (slot->current != VK_NULL_HANDLE)
+      retire->destroyPipeline(slot->current);
+    slot->current = fresh;
+    slot->compileMs = slot->pendingCompileMs.load();
+    slot->generation++;
+    return true;
+  }
+
+  // The device must be idle and the compiler stopped
+  void destroySlot(PipelineSlot* slot) {
+    VkPipeline pending = slot->pending.exchange(VK_NULL_HANDLE);
+    if (pending != VK_NULL_HANDLE)
+      vkDestroyPipeline(device, pending, nullptr);
+    if (slot->current != VK_NULL_HANDLE)
+      vkDestroyPipeline(device, slot->current, nullptr);
+    slot->current = VK_NULL_HANDLE;
+  }
+
+private:
+  struct Job {
+    PipelineSlot* slot;
+    BuildFn build;
+  };
+
+  struct WatchedFile {
+    std::string path;
+    int64_t built;       // mtime the current pipeline was built from
+    int64_t candidate;   // mtime seen at the previous poll
+  };
+
+  struct Watch {
+    PipelineSlot* slot;
+    BuildFn build;
+    std::vector<WatchedFile> files;
+  };
+
+  static int64_t modifiedNs(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+      return -1;
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  }
+
+  void workerLoop() {
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait_for(lock, std::chrono::milliseconds(PIPELINE_WATCH_INTERVAL_MS),
+                      [&] { return quit || !jobs.empty(); });
+        if (quit)
+          return;
+
+        if (jobs.empty()) {
+          pollWatches();
+          continue;
+        }
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+
+      run(job);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy == 0)
+        idle.notify_all();
+    }
+  }
+
+  // Called with the mutex held; queues a rebuild for every settled change
+  void pollWatches() {
+    for (Watch& w : watches) {
+      bool changed = false;
+      bool settled = true;
+      for (WatchedFile& file : w.files) {
+        int64_t mtime = modifiedNs(file.path);
+        if (mtime != file.built) {
+          changed = true;
+          settled = settled && mtime == file.candidate && mtime != -1;
+        }
+        file.candidate = mtime;
+      }
+      if (!changed || !settled)
+        continue;
+
+      for (WatchedFile& file : w.files) {
+        file.built = file.candidate;
+      }
+      logLine() << "Shader change detected, recompiling pipeline";
+      jobs.push_back({w.slot, w.build});
+      busy++;
+    }
+  }
+
+  void run(const Job& job) {
+    auto begin = std::chrono::steady_clock::now();
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result;
+    try {
+      result = job.build(&pipeline);
+    } catch (const std::exception& e) {
+      logLine() << "Pipeline build failed: " << e.what();
+      return;
+    }
+    if (result != VK_SUCCESS) {
+      logLine() << "Pipeline build failed (VkResult " << result << "), keeping the previous one";
+      return;
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+    job.slot->pendingCompileMs.store(elapsed.count());
+
+    // Never claimed by the render thread, so nothing can be using it
+    VkPipeline unclaimed = job.slot->pending.exchange(pipeline);
+    if (unclaimed != VK_NULL_HANDLE)
+      vkDestroyPipeline(device, unclaimed, nullptr);
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  std::thread worker;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  std::deque<Job> jobs;
+  std::vector<Watch> watches;
+  uint32_t busy = 0;   // queued plus running jobs
+  bool quit = false;
+};
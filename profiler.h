@@ -0,0 +1,428 @@
+#pragma once
+
+// Frame profiler: CPU scoped timers plus GPU timestamp queries, collected into
+// a lock-free ring and exported as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev) or CSV.
+//
+// When disabled a PROFILE_SCOPE costs one predictable branch, and no
+// timestamp commands are recorded at all, so it stays compiled in.
+
+#include <vulkan/vulkan.h>
+
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ProfileEvent {
+  const char* name;   // must outlive the profiler, string literals only
+  uint64_t startNs;   // relative to the profiler epoch
+  uint64_t durationNs;
+  uint32_t threadId;
+  bool gpu;
+};
+
+// Fixed-size multi-producer ring. Writers claim a slot with one fetch_add and
+// publish it through a per-slot sequence number, so nothing ever blocks. When
+// full, the oldest events are overwritten.
+class ProfileRing {
+public:
+  explicit ProfileRing(size_t capacityPow2)
+    : slots(new Slot[capacityPow2]), mask(capacityPow2 - 1) {}
+
+  void push(const ProfileEvent& event) {
+    uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots[index & mask];
+    // Odd sequence marks the slot as being written
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event = event;
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+  }
+
+  // Copies out every fully published event, oldest first
+  std::vector<ProfileEvent> snapshot() const {
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > mask + 1 ? end - (mask + 1) : 0;
+
+    std::vector<ProfileEvent> events;
+    events.reserve(end - begin);
+    for (uint64_t i = begin; i < end; i++) {
+      const Slot& slot = slots[i & mask];
+      uint64_t before = slot.seq.load(std::memory_order_acquire);
+      if (before != 2 * i + 2)
+        continue;
+      ProfileEvent event = slot.event;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) == before)
+        events.push_back(event);
+    }
+    return events;
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    ProfileEvent event{};
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  uint64_t mask;
+  std::atomic<uint64_t> head{0};
+};
+
+struct Profiler {
+  bool enabled = false;
+  std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+  ProfileRing ring{1 << 16};
+};
+
+inline Profiler& profiler() {
+  static Profiler instance;
+  return instance;
+}
+
+inline uint64_t profilerNowNs() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - profiler().epoch).count();
+}
+
+// Small stable id per thread, nicer to read in trace viewers than hashed ids
+inline uint32_t profilerThreadId() {
+  static std::atomic<uint32_t> nextId{0};
+  thread_local uint32_t id = nextId.fetch_add(1);
+  return id;
+}
+
+class ProfileScope {
+public:
+  explicit ProfileScope(const char* name) : name(name), active(profiler().enabled) {
+    if (active) startNs = profilerNowNs();
+  }
+
+  ~ProfileScope() {
+    if (active) {
+      profiler().ring.push({name, startNs, profilerNowNs() - startNs, profilerThreadId(), false});
+    }
+  }
+
+private:
+  const char* name;
+  bool active;
+  uint64_t startNs = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+// Startup breakdown. Every init phase records its wall-clock span, from
+// whichever thread ran it, into one timeline that is reported once when the
+// first frame goes out. Phases finishing after the report are ignored, so
+// hot-reload rebuilds do not show up as startup work.
+struct StartupPhaseRecord {
+  const char* name;   // string literals only
+  double startMs;     // since the timeline epoch
+  double durationMs;
+  uint32_t threadId;
+};
+
+class StartupTimeline {
+public:
+  std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+  void record(const char* name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (reported)
+      return;
+    std::chrono::duration<double, std::milli> start = begin - epoch;
+    std::chrono::duration<double, std::milli> duration = end - begin;
+    phases.push_back({name, start.count(), duration.count(), profilerThreadId()});
+  }
+
+  // Prints the breakdown and, when `path` is set, writes it as JSON so runs
+  // of different builds can be compared
+  void report(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (reported)
+      return;
+    reported = true;
+
+    std::chrono::duration<double, std::milli> total = std::chrono::steady_clock::now() - epoch;
+    std::sort(phases.begin(), phases.end(), [](const StartupPhaseRecord& a, const StartupPhaseRecord& b) {
+      return a.startMs < b.startMs;
+    });
+
+    double serial = 0.0;
+    logLine() << "Startup breakdown (ms):";
+    for (const StartupPhaseRecord& p : phases) {
+      char line[128];
+      snprintf(line, sizeof(line), "  %-28s start %8.2f  took %8.2f  thread %u",
+               p.name, p.startMs, p.durationMs, p.threadId);
+      logLine() << line;
+      serial += p.durationMs;
+    }
+    // Phases overlap, so their sum can exceed the wall-clock total
+    logLine() << "  total " << total.count() << " ms, phases sum to " << serial << " ms";
+
+    if (path.empty())
+      return;
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+      logLine() << "Failed to write startup report: " << path;
+      return;
+    }
+    file << "{\"total_ms\":" << total.count() << ",\"phases\":[";
+    for (size_t i = 0; i < phases.size(); i++) {
+      const StartupPhaseRecord& p = phases[i];
+      file << (i ? ",\n" : "\n") << "{\"name\":\"" << p.name << "\",\"start_ms\":" << p.startMs
+           << ",\"duration_ms\":" << p.durationMs << ",\"thread\":" << p.threadId << "}";
+    }
+    file << "\n]}\n";
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<StartupPhaseRecord> phases;
+  bool reported = false;
+};
+
+inline StartupTimeline& startupTimeline() {
+  static StartupTimeline instance;
+  return instance;
+}
+
+// Times one phase until end(), next() or destruction. next() chains phases of
+// straight-line init code through a single object. Phases also land in the
+// profile ring, so they show up in --profile traces.
+class StartupPhase {
+public:
+  explicit StartupPhase(const char* name) : name(name), begin(std::chrono::steady_clock::now()) {}
+  ~StartupPhase() { end(); }
+
+  void next(const char* nextName) {
+    end();
+    name = nextName;
+    begin = std::chrono::steady_clock::now();
+  }
+
+  void end() {
+    if (!name)
+      return;
+    auto now = std::chrono::steady_clock::now();
+    startupTimeline().record(name, begin, now);
+    if (profiler().enabled) {
+      int64_t startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - profiler().epoch).count();
+      uint64_t durationNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - begin).count();
+      profiler().ring.push({name, (uint64_t)std::max<int64_t>(startNs, 0), durationNs, profilerThreadId(), false});
+    }
+    name = nullptr;
+  }
+
+private:
+  const char* name;
+  std::chrono::steady_clock::time_point begin;
+};
+
+// GPU side. Each recording slot (one per frame in flight) owns a range of
+// GPU_PROFILER_QUERIES timestamps in a single query pool: a begin/end pair
+// around the whole frame, the cull dispatch and the sprites, one per render
+// graph pass and one per draw group (the draws of one recording thread).
+#define GPU_PROFILER_MAX_SLOTS 16
+#define GPU_PROFILER_MAX_PASSES 4
+#define GPU_PROFILER_MAX_DRAW_GROUPS 8
+
+enum GpuTimestamp {
+  GPU_TS_FRAME_BEGIN,
+  GPU_TS_FRAME_END,
+  GPU_TS_CULL_BEGIN,
+  GPU_TS_CULL_END,
+  GPU_TS_SPRITES_BEGIN,
+  GPU_TS_SPRITES_END,
+  GPU_TS_PASSES,   // GPU_PROFILER_MAX_PASSES begin/end pairs
+  GPU_TS_DRAW_GROUPS = GPU_TS_PASSES + GPU_PROFILER_MAX_PASSES * 2,
+  GPU_PROFILER_QUERIES = GPU_TS_DRAW_GROUPS + GPU_PROFILER_MAX_DRAW_GROUPS * 2
+};
+
+// Pairs past the fixed ones; out of range for passes or groups beyond the maximum
+inline uint32_t gpuPassTimestamp(uint32_t pass, bool end) {
+  return pass < GPU_PROFILER_MAX_PASSES ? GPU_TS_PASSES + pass * 2 + end : GPU_PROFILER_QUERIES;
+}
+
+inline uint32_t gpuDrawGroupTimestamp(uint32_t group, bool end) {
+  return group < GPU_PROFILER_MAX_DRAW_GROUPS ? GPU_TS_DRAW_GROUPS + group * 2 + end : GPU_PROFILER_QUERIES;
+}
+
+struct GpuProfiler {
+  VkQueryPool pool = VK_NULL_HANDLE;
+  double nsPerTick = 1.0;
+  uint64_t validMask = ~0ull;
+  // GPU and CPU clocks are not calibrated against each other; the first
+  // readback pins GPU time to "now" and later samples reuse that offset.
+  bool haveOffset = false;
+  int64_t gpuToCpuNs = 0;
+  // Render pass time of the last collected frame, also kept when the trace is off
+  double passMs = 0.0;
+  // Trace names of the render graph passes, string literals; unnamed passes are not traced
+  const char* passNames[GPU_PROFILER_MAX_PASSES] = {};
+};
+
+// Leaves gpu->pool null when profiling is off and nothing else asked for
+// timings (`required`), or when the queue cannot write timestamps
+inline VkResult createGpuProfiler(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, GpuProfiler* gpu,
+                                  bool required = false) {
+  if (!profiler().enabled && !required)
+    return VK_SUCCESS;
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+  uint32_t validBits = families[queueFamily].timestampValidBits;
+  if (validBits == 0) {
+    logLine() << "Queue family has no timestamp support, GPU profiling disabled";
+    return VK_SUCCESS;
+  }
+  gpu->validMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(physicalDevice, &props);
+  gpu->nsPerTick = props.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo info{};
+  info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  info.queryCount = GPU_PROFILER_MAX_SLOTS * GPU_PROFILER_QUERIES;
+
+  return vkCreateQueryPool(device, &info, nullptr, &gpu->pool);
+}
+
+inline void destroyGpuProfiler(VkDevice device, GpuProfiler* gpu) {
+  if (gpu->pool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(device, gpu->pool, nullptr);
+    gpu->pool = VK_NULL_HANDLE;
+  }
+}
+
+inline bool gpuProfilerActive(const GpuProfiler* gpu, uint32_t slot) {
+  return gpu && gpu->pool != VK_NULL_HANDLE && slot < GPU_PROFILER_MAX_SLOTS;
+}
+
+// Must be recorded outside a render pass, before any gpuProfilerTimestamp for the slot
+inline void gpuProfilerReset(VkCommandBuffer cmd, const GpuProfiler* gpu, uint32_t slot) {
+  if (gpuProfilerActive(gpu, slot))
+    vkCmdResetQueryPool(cmd, gpu->pool, slot * GPU_PROFILER_QUERIES, GPU_PROFILER_QUERIES);
+}
+
+// `which` is a GpuTimestamp or comes from gpuPassTimestamp / gpuDrawGroupTimestamp
+inline void gpuProfilerTimestamp(VkCommandBuffer cmd, const GpuProfiler* gpu, uint32_t slot,
+                                 uint32_t which, VkPipelineStageFlagBits stage) {
+  if (gpuProfilerActive(gpu, slot) && which < GPU_PROFILER_QUERIES)
+    vkCmdWriteTimestamp(cmd, stage, gpu->pool, slot * GPU_PROFILER_QUERIES + which);
+}
+
+// Call once the fence of the submission that used `slot` has signaled. Never
+// blocks: results that are not yet available are skipped. Every pair is
+// checked on its own, since a frame only writes the ones it ran (no draws
+// while the pipeline compiles or with --clear-only, no cull without --cull
+// gpu). Returns whether gpu->passMs was updated.
+inline bool gpuProfilerCollect(VkDevice device, GpuProfiler* gpu, uint32_t slot) {
+  if (!gpuProfilerActive(gpu, slot))
+    return false;
+
+  // Value / availability pairs. NOT_READY only means some are unavailable,
+  // the availability words say which.
+  uint64_t results[GPU_PROFILER_QUERIES * 2];
+  VkResult result = vkGetQueryPoolResults(
+    device, gpu->pool, slot * GPU_PROFILER_QUERIES, GPU_PROFILER_QUERIES,
+    sizeof(results), results, 2 * sizeof(uint64_t),
+    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+  );
+  if (result != VK_SUCCESS && result != VK_NOT_READY)
+    return false;
+
+  uint64_t ns[GPU_PROFILER_QUERIES];
+  bool available[GPU_PROFILER_QUERIES];
+  for (uint32_t i = 0; i < GPU_PROFILER_QUERIES; i++) {
+    available[i] = results[i * 2 + 1] != 0;
+    ns[i] = (uint64_t)((double)(results[i * 2] & gpu->validMask) * gpu->nsPerTick);
+  }
+  auto valid = [&](uint32_t begin, uint32_t end) {
+    return available[begin] && available[end] && ns[end] >= ns[begin];
+  };
+
+  if (!valid(GPU_TS_FRAME_BEGIN, GPU_TS_FRAME_END))
+    return false;
+  gpu->passMs = (double)(ns[GPU_TS_FRAME_END] - ns[GPU_TS_FRAME_BEGIN]) / 1e6;
+  if (!profiler().enabled)
+    return true;
+
+  if (!gpu->haveOffset) {
+    gpu->gpuToCpuNs = (int64_t)profilerNowNs() - (int64_t)ns[GPU_TS_FRAME_END];
+    gpu->haveOffset = true;
+  }
+
+  auto push = [&](const char* name, uint32_t begin, uint32_t end) {
+    if (name == nullptr || !valid(begin, end))
+      return;
+    int64_t start = (int64_t)ns[begin] + gpu->gpuToCpuNs;
+    profiler().ring.push({name, (uint64_t)std::max<int64_t>(start, 0), ns[end] - ns[begin], 0, true});
+  };
+  static const char* const drawGroupNames[GPU_PROFILER_MAX_DRAW_GROUPS] = {
+    "gpu draws 0", "gpu draws 1", "gpu draws 2", "gpu draws 3",
+    "gpu draws 4", "gpu draws 5", "gpu draws 6", "gpu draws 7",
+  };
+  push("gpu frame", GPU_TS_FRAME_BEGIN, GPU_TS_FRAME_END);
+  push("gpu cull", GPU_TS_CULL_BEGIN, GPU_TS_CULL_END);
+  for (uint32_t p = 0; p < GPU_PROFILER_MAX_PASSES; p++) {
+    push(gpu->passNames[p], gpuPassTimestamp(p, false), gpuPassTimestamp(p, true));
+  }
+  for (uint32_t g = 0; g < GPU_PROFILER_MAX_DRAW_GROUPS; g++) {
+    push(drawGroupNames[g], gpuDrawGroupTimestamp(g, false), gpuDrawGroupTimestamp(g, true));
+  }
+  push("gpu sprites", GPU_TS_SPRITES_BEGIN, GPU_TS_SPRITES_END);
+  return true;
+}
+
+// Writes everything in the ring. Paths ending in ".csv" get CSV, anything else Chrome trace JSON.
+inline bool exportProfile(const std::string& path) {
+  std::vector<ProfileEvent> events = profiler().ring.snapshot();
+
+  std::ofstream file(path, std::ios::trunc);
+  if (!file.is_open()) {
+    logLine() << "Failed to write profile: " << path;
+    return false;
+  }
+
+  bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+  if (csv) {
+    file << "name,track,thread,start_us,duration_us\n";
+    for (const auto& e : events) {
+      file << e.name << ',' << (e.gpu ? "gpu" : "cpu") << ',' << e.threadId << ','
+           << e.startNs / 1000.0 << ',' << e.durationNs / 1000.0 << '\n';
+    }
+  } else {
+    // Complete ("X") events; the GPU gets its own process row
+    file << "{\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"CPU\"}},\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GPU\"}}";
+    for (const auto& e : events) {
+      file << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << (e.gpu ? "gpu" : "cpu")
+           << "\",\"ph\":\"X\",\"pid\":" << (e.gpu ? 1 : 0) << ",\"tid\":" << e.threadId
+           << ",\"ts\":" << e.startNs / 1000.0 << ",\"dur\":" << e.durationNs / 1000.0 << "}";
+    }
+    file << "\n]}\n";
+  }
+
+  logLine() << "Wrote " << events.size() << " profile events to " << path;
+  return true;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+// Work recorded on one queue family and consumed on another.
+//
+// Buffers are created VK_SHARING_MODE_EXCLUSIVE, so one filled on a dedicated
+// transfer (or async compute) queue has to be released by that family and
+// acquired by the family that reads it next. QueueHandoff records the
+// release barriers into its source command buffer and the matching acquires
+// into a small command buffer on the destination queue, and links the two
+// submissions with a binary semaphore. Later submissions to the destination
+// queue are ordered behind the acquire, so the frame loop never has to know
+// where a buffer was filled.
+//
+// When both sides are the same family (devices without dedicated queues, or
+// --single-queue) there is nothing to acquire and a handoff is a plain
+// buffer barrier in the source command buffer.
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+class QueueHandoff {
+public:
+  VkResult init(VkDevice device, uint32_t srcFamily, VkQueue srcQueue, uint32_t dstFamily, VkQueue dstQueue) {
+    this->device = device;
+    this->srcFamily = srcFamily;
+    this->srcQueue = srcQueue;
+    this->dstFamily = dstFamily;
+    this->dstQueue = dstQueue;
+
+    VkResult result = createPool(srcFamily, &srcPool, &srcCmd);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    result = vkCreateFence(device, &fenceInfo, nullptr, &done);
+    if (result != VK_SUCCESS || !crossesFamilies())
+      return result;
+
+    result = createPool(dstFamily, &dstPool, &dstCmd);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkSemaphoreCreateInfo semInfo{};
+    semInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    return vkCreateSemaphore(device, &semInfo, nullptr, &handoff);
+  }
+
+  // The device must be idle
+  void destroy() {
+    if (handoff != VK_NULL_HANDLE)
+      vkDestroySemaphore(device, handoff, nullptr);
+    if (done != VK_NULL_HANDLE)
+      vkDestroyFence(device, done, nullptr);
+    if (dstPool != VK_NULL_HANDLE)
+      vkDestroyCommandPool(device, dstPool, nullptr);
+    if (srcPool != VK_NULL_HANDLE)
+      vkDestroyCommandPool(device, srcPool, nullptr);
+    handoff = VK_NULL_HANDLE;
+    done = VK_NULL_HANDLE;
+    dstPool = VK_NULL_HANDLE;
+    srcPool = VK_NULL_HANDLE;
+  }
+
+  bool crossesFamilies() const { return srcFamily != dstFamily; }
+
+  // Waits for the previous batch, then returns the source command buffer,
+  // begun. Batches complete in the background otherwise, so this is the point
+  // where whatever they read from (a staging ring) can be reused.
+  VkCommandBuffer begin() {
+    wait();
+    vkResetFences(device, 1, &done);
+    recording = true;
+    vkResetCommandPool(device, srcPool, 0);
+    if (dstPool != VK_NULL_HANDLE)
+      vkResetCommandPool(device, dstPool, 0);
+    acquires.clear();
+    acquireStages = 0;
+
+    VkCommandBufferBeginInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(srcCmd, &info);
+    return srcCmd;
+  }
+
+  // Makes the writes recorded so far into `buffer` visible to `dstStage` /
+  // `dstAccess` on the destination queue, moving ownership if needed
+  void handOff(VkBuffer buffer, VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+               VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    if (!crossesFamilies()) {
+      vkCmdPipelineBarrier(srcCmd, srcStage, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+      return;
+    }
+
+    // Release: the destination access mask is ignored on this side
+    barrier.srcQueueFamilyIndex = srcFamily;
+    barrier.dstQueueFamilyIndex = dstFamily;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(srcCmd, srcStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    // Acquire: the source access mask is ignored on this side
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dstAccess;
+    acquires.push_back(barrier);
+    acquireStages |= dstStage;
+  }
+
+  // Ends and submits the batch opened by begin(). On failure nothing is left
+  // for wait() to block on.
+  VkResult submit() {
+    if (!recording)
+      return VK_ERROR_INITIALIZATION_FAILED;
+    recording = false;
+    VkResult result = vkEndCommandBuffer(srcCmd);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkSubmitInfo submit{};
+    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit.commandBufferCount = 1;
+    submit.pCommandBuffers = &srcCmd;
+
+    if (acquires.empty()) {
+      result = vkQueueSubmit(srcQueue, 1, &submit, done);
+      submitted = result == VK_SUCCESS;
+      return result;
+    }
+
+    submit.signalSemaphoreCount = 1;
+    submit.pSignalSemaphores = &handoff;
+    result = vkQueueSubmit(srcQueue, 1, &submit, VK_NULL_HANDLE);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkCommandBufferBeginInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(dstCmd, &info);
+    // The semaphore wait blocks acquireStages, the barrier chains off the same stages
+    vkCmdPipelineBarrier(dstCmd, acquireStages, acquireStages, 0, 0, nullptr,
+                         (uint32_t)acquires.size(), acquires.data(), 0, nullptr);
+    vkEndCommandBuffer(dstCmd);
+
+    VkSubmitInfo acquire{};
+    acquire.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    acquire.waitSemaphoreCount = 1;
+    acquire.pWaitSemaphores = &handoff;
+    acquire.pWaitDstStageMask = &acquireStages;
+    acquire.commandBufferCount = 1;
+    acquire.pCommandBuffers = &dstCmd;
+    // Signaled only after the source submission, which the semaphore waits on
+    result = vkQueueSubmit(dstQueue, 1, &acquire, done);
+    submitted = result == VK_SUCCESS;
+    if (!submitted) {
+      // The source half is already running and has no fence of its own
+      vkQueueWaitIdle(srcQueue);
+    }
+    return result;
+  }
+
+  // Drops the batch opened by begin() without submitting it
+  void cancel() {
+    if (recording)
+      vkEndCommandBuffer(srcCmd);
+    recording = false;
+  }
+
+  // Blocks until the last submitted batch has finished on both queues
+  void wait() {
+    if (submitted)
+      vkWaitForFences(device, 1, &done, VK_TRUE, UINT64_MAX);
+    submitted = false;
+  }
+
+private:
+  VkResult createPool(uint32_t family, VkCommandPool* pool, VkCommandBuffer* cmd) {
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = family;
+
+    VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, pool);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkCommandBufferAllocateInfo alloc{};
+    alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc.commandPool = *pool;
+    alloc.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc.commandBufferCount = 1;
+    return vkAllocateCommandBuffers(device, &alloc, cmd);
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t srcFamily = 0;
+  uint32_t dstFamily = 0;
+  VkQueue srcQueue = VK_NULL_HANDLE;
+  VkQueue dstQueue = VK_NULL_HANDLE;
+
+  VkCommandPool srcPool = VK_NULL_HANDLE;
+  VkCommandPool dstPool = VK_NULL_HANDLE;
+  VkCommandBuffer srcCmd = VK_NULL_HANDLE;
+  VkCommandBuffer dstCmd = VK_NULL_HANDLE;
+  VkSemaphore handoff = VK_NULL_HANDLE;
+  VkFence done = VK_NULL_HANDLE;
+
+  std::vector<VkBufferMemoryBarrier> acquires;
+  VkPipelineStageFlags acquireStages = 0;
+  bool recording = false;   // begin() was called, submit() or cancel() was not
+  bool submitted = false;   // `done` will signal for the last batch
+};
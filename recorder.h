@@ -0,0 +1,198 @@
+#pragma once
+
+// Per-frame command recording spread over a small worker pool.
+//
+// Every frame in flight owns one primary buffer plus one transient command
+// pool and secondary buffer per recording thread. Pools are never shared
+// between threads, so recording needs no locking, and a whole frame's worth
+// of buffers is recycled with one vkResetCommandPool each once that frame's
+// fence has signaled. The calling thread records chunk 0 itself.
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FrameRecorder {
+public:
+  // Records chunk `chunk` of `chunkCount` into an already begun secondary buffer
+  using RecordFn = std::function<void(VkCommandBuffer cmd, uint32_t chunk, uint32_t chunkCount)>;
+
+  VkResult init(VkDevice device, uint32_t queueFamily, uint32_t frameCount, uint32_t threadCount) {
+    this->device = device;
+    threads = std::max(1u, threadCount);
+    quit = false;
+    frames.resize(frameCount);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = queueFamily;
+
+    VkCommandBufferAllocateInfo alloc{};
+    alloc.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc.commandBufferCount = 1;
+
+    for (Frame& frame : frames) {
+      if (vkCreateCommandPool(device, &poolInfo, nullptr, &frame.primaryPool) != VK_SUCCESS)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+      alloc.commandPool = frame.primaryPool;
+      alloc.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      if (vkAllocateCommandBuffers(device, &alloc, &frame.primary) != VK_SUCCESS)
+        return VK_ERROR_INITIALIZATION_FAILED;
+
+      frame.threadPools.assign(threads, VK_NULL_HANDLE);
+      frame.secondaries.assign(threads, VK_NULL_HANDLE);
+      for (uint32_t t = 0; t < threads; t++) {
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &frame.threadPools[t]) != VK_SUCCESS)
+          return VK_ERROR_INITIALIZATION_FAILED;
+
+        alloc.commandPool = frame.threadPools[t];
+        alloc.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        if (vkAllocateCommandBuffers(device, &alloc, &frame.secondaries[t]) != VK_SUCCESS)
+          return VK_ERROR_INITIALIZATION_FAILED;
+      }
+    }
+
+    // Workers start from the current generation, taken before any of them
+    // runs, so a job posted before a worker first locks the mutex is still
+    // seen. A recorder that was destroyed and re-initialized keeps counting.
+    uint64_t start;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      start = generation;
+    }
+    for (uint32_t t = 1; t < threads; t++) {
+      workers.emplace_back(&FrameRecorder::workerLoop, this, t, start);
+    }
+    return VK_SUCCESS;
+  }
+
+  // Early exits still have to join the workers
+  ~FrameRecorder() { stopWorkers(); }
+
+  // The device must be idle, or at least done with every frame
+  void destroy() {
+    stopWorkers();
+
+    // Destroying a pool frees its buffers too
+    for (Frame& frame : frames) {
+      for (VkCommandPool pool : frame.threadPools) {
+        if (pool != VK_NULL_HANDLE)
+          vkDestroyCommandPool(device, pool, nullptr);
+      }
+      if (frame.primaryPool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(device, frame.primaryPool, nullptr);
+    }
+    frames.clear();
+  }
+
+  uint32_t threadCount() const { return threads; }
+
+  // Recycles every buffer of `frame`; only call once its fence has signaled.
+  // Returns the primary buffer, reset and ready to begin.
+  VkCommandBuffer beginFrame(uint32_t frame) {
+    Frame& f = frames[frame];
+    vkResetCommandPool(device, f.primaryPool, 0);
+    for (VkCommandPool pool : f.threadPools) {
+      vkResetCommandPool(device, pool, 0);
+    }
+    return f.primary;
+  }
+
+  // Records one secondary buffer per thread and returns them in chunk order,
+  // ready for vkCmdExecuteCommands
+  const std::vector<VkCommandBuffer>& recordSecondaries(uint32_t frame, const VkCommandBufferInheritanceInfo& inheritance,
+                                                        const RecordFn& fn) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobFrame = frame;
+      jobInheritance = &inheritance;
+      jobFn = &fn;
+      pending = threads - 1;
+      generation++;
+    }
+    if (threads > 1)
+      wake.notify_all();
+
+    recordChunk(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return pending == 0; });
+    return frames[frame].secondaries;
+  }
+
+private:
+  struct Frame {
+    VkCommandPool primaryPool = VK_NULL_HANDLE;
+    VkCommandBuffer primary = VK_NULL_HANDLE;
+    std::vector<VkCommandPool> threadPools;   // one per thread, index 0 is the caller
+    std::vector<VkCommandBuffer> secondaries;
+  };
+
+  void stopWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    workers.clear();
+  }
+
+  void recordChunk(uint32_t chunk) {
+    VkCommandBuffer cmd = frames[jobFrame].secondaries[chunk];
+
+    VkCommandBufferBeginInfo begin{};
+    begin.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin.pInheritanceInfo = jobInheritance;
+
+    vkBeginCommandBuffer(cmd, &begin);
+    (*jobFn)(cmd, chunk, threads);
+    vkEndCommandBuffer(cmd);
+  }
+
+  void workerLoop(uint32_t chunk, uint64_t seen) {
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return quit || generation != seen; });
+        if (quit)
+          return;
+        seen = generation;
+      }
+
+      recordChunk(chunk);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pending == 0)
+        done.notify_one();
+    }
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t threads = 1;
+  std::vector<Frame> frames;
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  uint64_t generation = 0;
+  uint32_t pending = 0;
+  bool quit = false;
+
+  // Current job, written under the mutex before workers are woken
+  uint32_t jobFrame = 0;
+  const VkCommandBufferInheritanceInfo* jobInheritance = nullptr;
+  const RecordFn* jobFn = nullptr;
+};
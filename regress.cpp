@@ -0,0 +1,294 @@
+// Headless performance regression suite.
+//
+//   regress [--baseline bench_baseline.json] [--update-baseline] [--frames N] [--runs N] [--main ./main]
+//
+// Renders each scene offscreen with ./main --headless, a few times, and
+// takes the median of every metric from its --frame-report. The medians are
+// compared against the baseline: anything slower or bigger than the
+// baseline's tolerance fails the run, and so does any metric the baseline
+// has no value for. --update-baseline writes the measured medians back
+// instead, keeping the tolerances.
+//
+// ./build.sh --regress builds everything first and then runs it. The
+// committed bench_baseline.json only holds tolerances, so record the medians
+// with ./build.sh --regress --update-baseline before relying on it as a gate.
+//
+// Unless VK_ICD_FILENAMES is already set, the software rasterizer
+// (lavapipe) is used when installed, so numbers do not depend on the GPU.
+// Record the baseline with the same ICD the runs will use.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Scene {
+  const char* name;
+  std::vector<std::string> args;
+};
+
+// Fixed arguments only, so every run renders the same frames
+const Scene scenes[] = {
+  {"empty", {"--clear-only"}},
+  {"triangle", {}},
+  {"draws", {"--draws", "1000", "--instances", "1000"}},
+  {"instances", {"--instances", "100000"}},
+};
+
+struct Metric {
+  const char* key;
+  const char* tolerance;   // baseline key holding the allowed relative growth
+  double slack;            // absolute growth always allowed, so tiny values do not flap
+};
+
+const Metric metrics[] = {
+  {"frame_p50_ms", "tolerance.frame", 0.05},
+  {"frame_p90_ms", "tolerance.frame", 0.05},
+  {"frame_p99_ms", "tolerance.frame_p99", 0.2},
+  {"startup_ms", "tolerance.startup", 20.0},
+  {"peak_rss_mb", "tolerance.memory", 2.0},
+};
+
+const std::map<std::string, double> defaultTolerances = {
+  {"tolerance.frame", 0.10},
+  {"tolerance.frame_p99", 0.25},
+  {"tolerance.startup", 0.20},
+  {"tolerance.memory", 0.10},
+};
+
+// Reads a flat JSON object of numbers, which is all main and this tool write
+std::map<std::string, double> readFlatJson(const std::string& path) {
+  std::map<std::string, double> values;
+  std::ifstream file(path);
+  if (!file.is_open())
+    return values;
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  std::string text = buffer.str();
+
+  size_t pos = 0;
+  while ((pos = text.find('"', pos)) != std::string::npos) {
+    size_t end = text.find('"', pos + 1);
+    if (end == std::string::npos)
+      break;
+    std::string key = text.substr(pos + 1, end - pos - 1);
+    size_t colon = text.find_first_not_of(" \t\r\n", end + 1);
+    pos = end + 1;
+    if (colon == std::string::npos || text[colon] != ':')
+      continue;
+    const char* number = text.c_str() + colon + 1;
+    char* numberEnd;
+    double value = std::strtod(number, &numberEnd);
+    if (numberEnd != number) {
+      values[key] = value;
+      pos = numberEnd - text.c_str();
+    }
+  }
+  return values;
+}
+
+bool writeFlatJson(const std::string& path, const std::map<std::string, double>& values) {
+  std::ofstream file(path, std::ios::trunc);
+  if (!file.is_open())
+    return false;
+  file << "{";
+  const char* separator = "\n";
+  for (const auto& entry : values) {
+    file << separator << "  \"" << entry.first << "\": " << entry.second;
+    separator = ",\n";
+  }
+  file << "\n}\n";
+  return true;
+}
+
+// Counts on the command line, parsed as in main: false unless the whole
+// argument is a number above zero, so a bad value gets the usage message
+bool parseCount(const char* text, uint32_t* value) {
+  char* end = nullptr;
+  errno = 0;
+  unsigned long parsed = strtoul(text, &end, 10);
+  if (end == text || *end != '\0' || errno == ERANGE || text[0] == '-' || parsed == 0 || parsed > UINT32_MAX)
+    return false;
+  *value = (uint32_t)parsed;
+  return true;
+}
+
+// Runs main with its output going to `logPath`; returns whether it exited cleanly
+bool runMain(const std::string& mainPath, const std::vector<std::string>& args, const std::string& logPath) {
+  pid_t pid = fork();
+  if (pid < 0)
+    return false;
+
+  if (pid == 0) {
+    int log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log >= 0) {
+      dup2(log, STDOUT_FILENO);
+      dup2(log, STDERR_FILENO);
+      close(log);
+    }
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(mainPath.c_str()));
+    for (const std::string& arg : args) {
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    execv(mainPath.c_str(), argv.data());
+    _exit(127);
+  }
+
+  int status = 0;
+  if (waitpid(pid, &status, 0) != pid)
+    return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Picks lavapipe unless the caller chose an ICD
+void selectSoftwareIcd() {
+  const char* chosen = std::getenv("VK_ICD_FILENAMES");
+  if (chosen != nullptr) {
+    std::printf("Using VK_ICD_FILENAMES=%s\n", chosen);
+    return;
+  }
+
+  const char* patterns[] = {
+    "/usr/share/vulkan/icd.d/lvp_icd*.json",
+    "/usr/local/share/vulkan/icd.d/lvp_icd*.json",
+    "/etc/vulkan/icd.d/lvp_icd*.json",
+  };
+  for (const char* pattern : patterns) {
+    glob_t matches{};
+    if (glob(pattern, 0, nullptr, &matches) == 0 && matches.gl_pathc > 0) {
+      setenv("VK_ICD_FILENAMES", matches.gl_pathv[0], 1);
+      std::printf("Using software ICD %s\n", matches.gl_pathv[0]);
+      globfree(&matches);
+      return;
+    }
+    globfree(&matches);
+  }
+  std::printf("No software ICD found, results depend on the installed GPU driver\n");
+}
+
+int main(int argc, char** argv) {
+  std::string baselinePath = "bench_baseline.json";
+  std::string mainPath = "./main";
+  bool update = false;
+  uint32_t frames = 500;
+  uint32_t runs = 3;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--baseline" && i + 1 < argc) {
+      baselinePath = argv[++i];
+    } else if (arg == "--update-baseline") {
+      update = true;
+    } else if (arg == "--frames" && i + 1 < argc && parseCount(argv[i + 1], &frames)) {
+      i++;
+    } else if (arg == "--runs" && i + 1 < argc && parseCount(argv[i + 1], &runs)) {
+      i++;
+    } else if (arg == "--main" && i + 1 < argc) {
+      mainPath = argv[++i];
+    } else {
+      std::fprintf(stderr, "Usage: regress [--baseline PATH] [--update-baseline] [--frames N] [--runs N] [--main PATH]\n");
+      return 1;
+    }
+  }
+
+  selectSoftwareIcd();
+
+  std::map<std::string, double> baseline = readFlatJson(baselinePath);
+  bool recorded = false;
+  for (const auto& entry : baseline) {
+    recorded |= entry.first.compare(0, 10, "tolerance.") != 0;
+  }
+  if (!update && !recorded) {
+    std::printf("%s has no recorded medians, run with --update-baseline on the ICD the runs use first\n",
+                baselinePath.c_str());
+    return 1;
+  }
+  for (const auto& tolerance : defaultTolerances) {
+    baseline.emplace(tolerance.first, tolerance.second);
+  }
+
+  int regressions = 0;
+  int missing = 0;
+  for (const Scene& scene : scenes) {
+    std::string report = std::string("regress_") + scene.name + ".json";
+    std::string log = std::string("regress_") + scene.name + ".log";
+
+    std::map<std::string, std::vector<double>> samples;
+    for (uint32_t run = 0; run < runs; run++) {
+      // A cold pipeline cache every run, so startup measures the same work
+      std::vector<std::string> args = {"--headless", "--frames", std::to_string(frames), "--cold-cache",
+                                       "--pipeline-cache", "regress_cache.bin", "--frame-report", report};
+      args.insert(args.end(), scene.args.begin(), scene.args.end());
+
+      std::remove(report.c_str());
+      if (!runMain(mainPath, args, log)) {
+        std::printf("%-10s FAILED to run, see %s\n", scene.name, log.c_str());
+        return 1;
+      }
+      std::map<std::string, double> values = readFlatJson(report);
+      for (const Metric& metric : metrics) {
+        if (values.count(metric.key) == 0) {
+          std::printf("%-10s FAILED, %s missing from %s\n", scene.name, metric.key, report.c_str());
+          return 1;
+        }
+        samples[metric.key].push_back(values[metric.key]);
+      }
+    }
+
+    for (const Metric& metric : metrics) {
+      std::vector<double>& values = samples[metric.key];
+      std::sort(values.begin(), values.end());
+      double median = values[values.size() / 2];
+      std::string key = std::string(scene.name) + "." + metric.key;
+
+      auto expected = baseline.find(key);
+      if (update || expected == baseline.end()) {
+        std::printf("%-10s %-14s %10.3f%s\n", scene.name, metric.key, median, update ? "" : "  NO BASELINE");
+        missing += expected == baseline.end();
+        baseline[key] = median;
+        continue;
+      }
+
+      double limit = expected->second * (1.0 + baseline[metric.tolerance]) + metric.slack;
+      bool regressed = median > limit;
+      regressions += regressed;
+      std::printf("%-10s %-14s %10.3f  baseline %10.3f  limit %10.3f  %s\n", scene.name, metric.key, median,
+                  expected->second, limit, regressed ? "REGRESSED" : "ok");
+    }
+  }
+  std::remove("regress_cache.bin");
+
+  if (update) {
+    if (!writeFlatJson(baselinePath, baseline)) {
+      std::fprintf(stderr, "Failed to write %s\n", baselinePath.c_str());
+      return 1;
+    }
+    std::printf("Baseline written to %s\n", baselinePath.c_str());
+    return 0;
+  }
+  if (missing > 0) {
+    std::printf("%d metrics have no baseline, record them with --update-baseline on the ICD the runs use\n",
+                missing);
+  }
+  if (regressions > 0) {
+    std::printf("%d metrics regressed past tolerance\n", regressions);
+  }
+  if (missing > 0 || regressions > 0)
+    return 1;
+  std::printf("No regressions\n");
+  return 0;
+}
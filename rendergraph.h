@@ -0,0 +1,642 @@
+#pragma once
+
+// Minimal render graph. Passes declare which images they write as color
+// attachments and which they sample; compile() derives everything else:
+//
+//  - passes whose results never reach an imported image are culled
+//  - one VkRenderPass per pass, with attachment layouts chosen so that each
+//    pass leaves its images in the layout the next user wants (no separate
+//    transition barriers), and subpass dependencies to/from VK_SUBPASS_EXTERNAL
+//    derived from the previous and next use of every image
+//  - framebuffers, one per variant of the imported views (e.g. per swapchain image)
+//  - transient images, whose memory is aliased when their lifetimes within the
+//    frame do not overlap
+//
+// Declaration happens once. compilePasses() builds the render passes, which
+// only depend on formats; resize() rebuilds transients and framebuffers
+// whenever the extent or imported views change, and leaves the render passes
+// (and every pipeline built against them) alone. compile() does both.
+// Passes run in declaration order. A pass may render into only the top-left
+// part of its attachments (setRenderScale), e.g. for dynamic resolution.
+// Given a DeletionQueue, resize() hands the old framebuffers and transients
+// to it instead of destroying them, so frames in flight keep valid ones.
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.h"
+#include "deletion.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef uint32_t RenderGraphResource;
+typedef uint32_t RenderGraphPass;
+
+struct RenderGraphPassInfo {
+  VkRenderPass renderPass;
+  VkFramebuffer framebuffer;
+  VkExtent2D extent;   // render area, anchored at the origin
+};
+
+class RenderGraph {
+public:
+  using RecordFn = std::function<void(RenderGraphPass pass, VkCommandBuffer cmd, const RenderGraphPassInfo& info)>;
+  // Called around each pass outside its render pass, e.g. for timestamps a
+  // pass recorded from secondaries cannot take inline
+  using EdgeFn = std::function<void(RenderGraphPass pass, VkCommandBuffer cmd, bool end)>;
+
+  // An image owned outside the graph. Its contents are not kept between
+  // frames, and after the last pass that uses it it is left in `finalLayout`.
+  RenderGraphResource importImage(const char* name, VkFormat format, VkImageLayout finalLayout) {
+    Resource resource;
+    resource.name = name;
+    resource.format = format;
+    resource.imported = true;
+    resource.finalLayout = finalLayout;
+    resources.push_back(resource);
+    return (RenderGraphResource)(resources.size() - 1);
+  }
+
+  // An image created by the graph at `scale` times the compiled extent
+  RenderGraphResource createImage(const char* name, VkFormat format, float scale = 1.0f) {
+    Resource resource;
+    resource.name = name;
+    resource.format = format;
+    resource.scale = scale;
+    resources.push_back(resource);
+    return (RenderGraphResource)(resources.size() - 1);
+  }
+
+  RenderGraphPass addPass(const char* name, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE) {
+    Pass pass;
+    pass.name = name;
+    pass.contents = contents;
+    passes.push_back(pass);
+    return (RenderGraphPass)(passes.size() - 1);
+  }
+
+  void writeColor(RenderGraphPass pass, RenderGraphResource image, VkAttachmentLoadOp loadOp,
+                  VkClearColorValue clear = {}) {
+    passes[pass].writes.push_back({image, loadOp, clear});
+  }
+
+  void readTexture(RenderGraphPass pass, RenderGraphResource image) {
+    passes[pass].reads.push_back(image);
+  }
+
+  // Fraction of the attachment extent rendered from the next execute() on; readers still see the whole image
+  void setRenderScale(RenderGraphPass pass, float scale) {
+    passes[pass].renderScale = scale;
+  }
+
+  // One view per variant; every imported image needs the same number of variants
+  void setImportedViews(RenderGraphResource image, const std::vector<VkImageView>& views) {
+    resources[image].importedViews = views;
+  }
+
+  // Culls and builds the render passes. They depend only on the declarations
+  // and formats, so pipelines can be compiled against them before any image
+  // or extent exists.
+  VkResult compilePasses(VkDevice device, DeviceAllocator* allocator) {
+    destroy();
+    this->device = device;
+    this->allocator = allocator;
+
+    cull();
+
+    std::vector<VkImageLayout> layouts(resources.size(), VK_IMAGE_LAYOUT_UNDEFINED);
+    for (RenderGraphPass p = 0; p < passes.size(); p++) {
+      if (passes[p].culled)
+        continue;
+      VkResult result = buildRenderPass(p, &layouts);
+      if (result != VK_SUCCESS)
+        return result;
+    }
+    return VK_SUCCESS;
+  }
+
+  // (Re)creates transients and framebuffers for `extent` and the current
+  // imported views. Render passes are left alone.
+  // Without `retire` nothing may still be using the old objects
+  VkResult resize(VkExtent2D extent, DeletionQueue* retire = nullptr) {
+    destroySized(retire);
+    this->extent = extent;
+
+    VkResult result = createTransients();
+    if (result != VK_SUCCESS)
+      return result;
+
+    variants = 1;
+    for (const Resource& r : resources) {
+      if (r.imported && r.used)
+        variants = std::max<uint32_t>(variants, (uint32_t)r.importedViews.size());
+    }
+
+    for (RenderGraphPass p = 0; p < passes.size(); p++) {
+      if (passes[p].culled)
+        continue;
+      result = buildFramebuffers(p);
+      if (result != VK_SUCCESS)
+        return result;
+    }
+    return VK_SUCCESS;
+  }
+
+  VkResult compile(VkDevice device, DeviceAllocator* allocator, VkExtent2D extent) {
+    VkResult result = compilePasses(device, allocator);
+    if (result != VK_SUCCESS)
+      return result;
+    return resize(extent);
+  }
+
+  // Records every surviving pass inside its render pass; `recordPass` fills in the draws
+  void execute(VkCommandBuffer cmd, uint32_t variant, const RecordFn& recordPass,
+               const EdgeFn& passEdge = nullptr) const {
+    for (RenderGraphPass p = 0; p < passes.size(); p++) {
+      const Pass& pass = passes[p];
+      if (pass.culled)
+        continue;
+
+      VkExtent2D area = pass.extent;
+      if (pass.renderScale != 1.0f) {
+        area.width = std::min(area.width, std::max(1u, (uint32_t)(area.width * pass.renderScale)));
+        area.height = std::min(area.height, std::max(1u, (uint32_t)(area.height * pass.renderScale)));
+      }
+      RenderGraphPassInfo info{pass.renderPass, pass.framebuffers[variant % pass.framebuffers.size()], area};
+
+      VkRenderPassBeginInfo begin{};
+      begin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+      begin.renderPass = info.renderPass;
+      begin.framebuffer = info.framebuffer;
+      begin.renderArea.offset = {0, 0};
+      begin.renderArea.extent = info.extent;
+      begin.clearValueCount = (uint32_t)pass.clearValues.size();
+      begin.pClearValues = pass.clearValues.data();
+
+      if (passEdge)
+        passEdge(p, cmd, false);
+      vkCmdBeginRenderPass(cmd, &begin, pass.contents);
+      recordPass(p, cmd, info);
+      vkCmdEndRenderPass(cmd);
+      if (passEdge)
+        passEdge(p, cmd, true);
+    }
+  }
+
+  // Valid after compilePasses() and unchanged by resize()
+  VkRenderPass renderPass(RenderGraphPass pass) const { return passes[pass].renderPass; }
+
+  bool culled(RenderGraphPass pass) const { return passes[pass].culled; }
+
+  // Transient images and their full extent; valid after resize() until the next one
+  VkImageView imageView(RenderGraphResource image) const { return resources[image].view; }
+  VkExtent2D imageExtent(RenderGraphResource image) const { return resources[image].extent; }
+
+  void printSummary() const {
+    uint32_t culledCount = 0;
+    for (const Pass& pass : passes) {
+      if (pass.culled) {
+        culledCount++;
+        logLine() << "Render graph: culled pass " << pass.name;
+      }
+    }
+    logLine() << "Render graph: " << passes.size() - culledCount << " passes (" << culledCount << " culled), "
+              << aliases.size() << " transient allocations, " << transientBytes / 1024 << " KiB requested, "
+              << aliasedBytes / 1024 << " KiB after aliasing";
+  }
+
+  // Releases everything compile() created; declarations are kept
+  void destroy() {
+    if (device == VK_NULL_HANDLE)
+      return;
+
+    destroySized();
+    for (Pass& pass : passes) {
+      if (pass.renderPass != VK_NULL_HANDLE)
+        vkDestroyRenderPass(device, pass.renderPass, nullptr);
+      pass.renderPass = VK_NULL_HANDLE;
+    }
+  }
+
+private:
+  // Releases what resize() created, now or through `retire`
+  void destroySized(DeletionQueue* retire = nullptr) {
+    if (device == VK_NULL_HANDLE)
+      return;
+
+    for (Pass& pass : passes) {
+      for (VkFramebuffer fb : pass.framebuffers) {
+        if (retire)
+          retire->destroyFramebuffer(fb);
+        else
+          vkDestroyFramebuffer(device, fb, nullptr);
+      }
+      pass.framebuffers.clear();
+    }
+
+    for (Resource& r : resources) {
+      if (r.view != VK_NULL_HANDLE) {
+        if (retire)
+          retire->destroyImageView(r.view);
+        else
+          vkDestroyImageView(device, r.view, nullptr);
+      }
+      if (r.image != VK_NULL_HANDLE) {
+        if (retire)
+          retire->destroyImage(r.image);
+        else
+          vkDestroyImage(device, r.image, nullptr);
+      }
+      r.view = VK_NULL_HANDLE;
+      r.image = VK_NULL_HANDLE;
+    }
+
+    // Queued after the images bound to them, so they are freed after them too
+    for (const Alias& alias : aliases) {
+      if (retire)
+        retire->free(alias.alloc);
+      else
+        allocator->free(alias.alloc);
+    }
+    aliases.clear();
+    transientBytes = 0;
+    aliasedBytes = 0;
+  }
+
+  struct Write {
+    RenderGraphResource image;
+    VkAttachmentLoadOp loadOp;
+    VkClearColorValue clear;
+  };
+
+  struct Pass {
+    std::string name;
+    VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE;
+    std::vector<Write> writes;
+    std::vector<RenderGraphResource> reads;
+
+    bool culled = false;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    std::vector<RenderGraphResource> attachments;   // in attachment order
+    std::vector<VkFramebuffer> framebuffers;
+    std::vector<VkClearValue> clearValues;
+    VkExtent2D extent{};
+    float renderScale = 1.0f;
+  };
+
+  struct Resource {
+    std::string name;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    bool imported = false;
+    VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    std::vector<VkImageView> importedViews;
+    float scale = 1.0f;
+
+    // Compiled state
+    bool used = false;
+    uint32_t firstUse = 0;
+    uint32_t lastUse = 0;
+    VkImageUsageFlags usage = 0;
+    VkExtent2D extent{};
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+  };
+
+  // One memory range shared by transients with disjoint lifetimes
+  struct Alias {
+    Allocation alloc;
+    uint32_t lastUse;
+  };
+
+  enum Access { ACCESS_NONE, ACCESS_WRITE, ACCESS_READ };
+
+  // Walks passes backwards from the imported images. A pass survives if it
+  // writes something still needed; a clear ends the need for older contents.
+  void cull() {
+    std::vector<bool> needed(resources.size(), false);
+    for (size_t r = 0; r < resources.size(); r++) {
+      needed[r] = resources[r].imported;
+      resources[r].used = false;
+      resources[r].usage = 0;
+    }
+
+    for (size_t i = passes.size(); i-- > 0;) {
+      Pass& pass = passes[i];
+      pass.culled = true;
+      for (const Write& w : pass.writes) {
+        if (needed[w.image])
+          pass.culled = false;
+      }
+      if (pass.culled)
+        continue;
+
+      for (const Write& w : pass.writes) {
+        needed[w.image] = w.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD;
+      }
+      for (RenderGraphResource r : pass.reads) {
+        needed[r] = true;
+      }
+    }
+
+    for (uint32_t p = 0; p < passes.size(); p++) {
+      if (passes[p].culled)
+        continue;
+      for (const Write& w : passes[p].writes) {
+        markUse(w.image, p, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+      }
+      for (RenderGraphResource r : passes[p].reads) {
+        markUse(r, p, VK_IMAGE_USAGE_SAMPLED_BIT);
+      }
+    }
+  }
+
+  void markUse(RenderGraphResource r, uint32_t pass, VkImageUsageFlags usage) {
+    Resource& resource = resources[r];
+    if (!resource.used)
+      resource.firstUse = pass;
+    resource.used = true;
+    resource.lastUse = pass;
+    resource.usage |= usage;
+  }
+
+  Access accessIn(const Pass& pass, RenderGraphResource r) const {
+    for (const Write& w : pass.writes) {
+      if (w.image == r)
+        return ACCESS_WRITE;
+    }
+    for (RenderGraphResource read : pass.reads) {
+      if (read == r)
+        return ACCESS_READ;
+    }
+    return ACCESS_NONE;
+  }
+
+  // Closest surviving pass before (step -1) or after (step +1) `pass` touching `r`
+  Access neighbourAccess(RenderGraphResource r, uint32_t pass, int step) const {
+    for (int64_t p = (int64_t)pass + step; p >= 0 && p < (int64_t)passes.size(); p += step) {
+      if (passes[p].culled)
+        continue;
+      Access access = accessIn(passes[p], r);
+      if (access != ACCESS_NONE)
+        return access;
+    }
+    return ACCESS_NONE;
+  }
+
+  static VkImageLayout layoutFor(Access access) {
+    return access == ACCESS_READ ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  }
+
+  static VkPipelineStageFlags stageFor(Access access) {
+    return access == ACCESS_READ ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  }
+
+  // Only writes need to be made available; reads just need execution ordering
+  static VkAccessFlags srcAccessFor(Access access) {
+    return access == ACCESS_WRITE ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0;
+  }
+
+  static VkAccessFlags dstAccessFor(Access access) {
+    return access == ACCESS_READ ? VK_ACCESS_SHADER_READ_BIT : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  }
+
+  VkResult createTransients() {
+    std::vector<RenderGraphResource> order;
+    for (RenderGraphResource r = 0; r < resources.size(); r++) {
+      Resource& resource = resources[r];
+      resource.extent = extent;
+      if (resource.imported || !resource.used)
+        continue;
+
+      resource.extent.width = std::max(1u, (uint32_t)(extent.width * resource.scale));
+      resource.extent.height = std::max(1u, (uint32_t)(extent.height * resource.scale));
+
+      VkImageCreateInfo info{};
+      info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+      info.imageType = VK_IMAGE_TYPE_2D;
+      info.format = resource.format;
+      info.extent = {resource.extent.width, resource.extent.height, 1};
+      info.mipLevels = 1;
+      info.arrayLayers = 1;
+      info.samples = VK_SAMPLE_COUNT_1_BIT;
+      info.tiling = VK_IMAGE_TILING_OPTIMAL;
+      info.usage = resource.usage;
+      info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+      VkResult result = vkCreateImage(device, &info, nullptr, &resource.image);
+      if (result != VK_SUCCESS)
+        return result;
+      order.push_back(r);
+    }
+
+    // Greedy interval packing: each transient reuses the first range whose
+    // previous owner is finished and whose memory types fit
+    std::sort(order.begin(), order.end(), [&](RenderGraphResource a, RenderGraphResource b) {
+      return resources[a].firstUse < resources[b].firstUse;
+    });
+
+    std::vector<VkMemoryRequirements> aliasReqs;
+    std::vector<std::vector<RenderGraphResource>> aliasMembers;
+    for (RenderGraphResource r : order) {
+      VkMemoryRequirements reqs;
+      vkGetImageMemoryRequirements(device, resources[r].image, &reqs);
+      transientBytes += reqs.size;
+
+      size_t slot = 0;
+      for (; slot < aliases.size(); slot++) {
+        if (aliases[slot].lastUse < resources[r].firstUse && (aliasReqs[slot].memoryTypeBits & reqs.memoryTypeBits))
+          break;
+      }
+      if (slot == aliases.size()) {
+        aliases.push_back({Allocation{}, 0});
+        aliasReqs.push_back(reqs);
+        aliasMembers.emplace_back();
+      }
+
+      VkMemoryRequirements& merged = aliasReqs[slot];
+      merged.size = std::max(merged.size, reqs.size);
+      merged.alignment = std::max(merged.alignment, reqs.alignment);
+      merged.memoryTypeBits &= reqs.memoryTypeBits;
+      aliases[slot].lastUse = resources[r].lastUse;
+      aliasMembers[slot].push_back(r);
+    }
+
+    for (size_t slot = 0; slot < aliases.size(); slot++) {
+      VkResult result = allocator->allocate(aliasReqs[slot], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, &aliases[slot].alloc);
+      if (result != VK_SUCCESS)
+        return result;
+      aliasedBytes += aliasReqs[slot].size;
+
+      for (RenderGraphResource r : aliasMembers[slot]) {
+        Resource& resource = resources[r];
+        result = vkBindImageMemory(device, resource.image, aliases[slot].alloc.memory, aliases[slot].alloc.offset);
+        if (result != VK_SUCCESS)
+          return result;
+
+        VkImageViewCreateInfo view{};
+        view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view.image = resource.image;
+        view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view.format = resource.format;
+        view.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        view.subresourceRange.levelCount = 1;
+        view.subresourceRange.layerCount = 1;
+
+        result = vkCreateImageView(device, &view, nullptr, &resource.view);
+        if (result != VK_SUCCESS)
+          return result;
+      }
+    }
+    return VK_SUCCESS;
+  }
+
+  VkResult buildRenderPass(RenderGraphPass p, std::vector<VkImageLayout>* layouts) {
+    Pass& pass = passes[p];
+
+    std::vector<VkAttachmentDescription> attachments;
+    std::vector<VkAttachmentReference> colorRefs;
+    pass.clearValues.clear();
+
+    VkSubpassDependency before{};
+    before.srcSubpass = VK_SUBPASS_EXTERNAL;
+    before.dstSubpass = 0;
+    VkSubpassDependency after{};
+    after.srcSubpass = 0;
+    after.dstSubpass = VK_SUBPASS_EXTERNAL;
+
+    // Orders this pass after whatever touched `r` last, and the next user after this pass
+    auto addDependencies = [&](RenderGraphResource r, Access access) {
+      Access previous = neighbourAccess(r, p, -1);
+      if (previous != ACCESS_NONE) {
+        before.srcStageMask |= stageFor(previous);
+        before.srcAccessMask |= srcAccessFor(previous);
+      } else if (resources[r].imported) {
+        // Imported images are handed over by a semaphore wait at color output
+        before.srcStageMask |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      } else {
+        // Last frame's uses, or another transient aliasing the same memory
+        before.srcStageMask |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        before.srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      }
+      before.dstStageMask |= stageFor(access);
+      before.dstAccessMask |= dstAccessFor(access);
+
+      Access next = neighbourAccess(r, p, 1);
+      if (next != ACCESS_NONE) {
+        after.srcStageMask |= stageFor(access);
+        after.srcAccessMask |= srcAccessFor(access);
+        after.dstStageMask |= stageFor(next);
+        after.dstAccessMask |= dstAccessFor(next);
+      }
+    };
+
+    pass.attachments.clear();
+
+    for (const Write& w : pass.writes) {
+      const Resource& resource = resources[w.image];
+
+      Access next = neighbourAccess(w.image, p, 1);
+      VkImageLayout finalLayout = next != ACCESS_NONE ? layoutFor(next)
+                                : resource.imported ? resource.finalLayout
+                                : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+      VkAttachmentDescription attachment{};
+      attachment.format = resource.format;
+      attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+      attachment.loadOp = w.loadOp;
+      attachment.storeOp = next != ACCESS_NONE || resource.imported
+                         ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+      attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      // Anything not loaded may be discarded, which also allows aliasing
+      attachment.initialLayout = w.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD ? (*layouts)[w.image] : VK_IMAGE_LAYOUT_UNDEFINED;
+      attachment.finalLayout = finalLayout;
+      (*layouts)[w.image] = finalLayout;
+
+      colorRefs.push_back({(uint32_t)attachments.size(), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL});
+      attachments.push_back(attachment);
+
+      VkClearValue clear;
+      clear.color = w.clear;
+      pass.clearValues.push_back(clear);
+
+      pass.attachments.push_back(w.image);
+
+      addDependencies(w.image, ACCESS_WRITE);
+    }
+
+    // The writer already left sampled images in SHADER_READ_ONLY_OPTIMAL
+    for (RenderGraphResource r : pass.reads) {
+      if ((*layouts)[r] != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        logLine() << "Render graph: pass " << pass.name << " reads " << resources[r].name
+                  << " before anything wrote it";
+        return VK_ERROR_INITIALIZATION_FAILED;
+      }
+      addDependencies(r, ACCESS_READ);
+    }
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = (uint32_t)colorRefs.size();
+    subpass.pColorAttachments = colorRefs.data();
+
+    VkSubpassDependency dependencies[2] = {before, after};
+
+    VkRenderPassCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    info.attachmentCount = (uint32_t)attachments.size();
+    info.pAttachments = attachments.data();
+    info.subpassCount = 1;
+    info.pSubpasses = &subpass;
+    // The implicit dependency covers the end of the frame
+    info.dependencyCount = after.dstStageMask ? 2 : 1;
+    info.pDependencies = dependencies;
+
+    return vkCreateRenderPass(device, &info, nullptr, &pass.renderPass);
+  }
+
+  // The pass takes the extent of its first attachment
+  VkResult buildFramebuffers(RenderGraphPass p) {
+    Pass& pass = passes[p];
+    pass.extent = resources[pass.attachments[0]].extent;
+
+    pass.framebuffers.resize(variants, VK_NULL_HANDLE);
+    for (uint32_t v = 0; v < variants; v++) {
+      std::vector<VkImageView> views;
+      for (RenderGraphResource r : pass.attachments) {
+        const Resource& resource = resources[r];
+        views.push_back(resource.imported ? resource.importedViews[v % resource.importedViews.size()] : resource.view);
+      }
+
+      VkFramebufferCreateInfo fb{};
+      fb.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      fb.renderPass = pass.renderPass;
+      fb.attachmentCount = (uint32_t)views.size();
+      fb.pAttachments = views.data();
+      fb.width = pass.extent.width;
+      fb.height = pass.extent.height;
+      fb.layers = 1;
+
+      VkResult result = vkCreateFramebuffer(device, &fb, nullptr, &pass.framebuffers[v]);
+      if (result != VK_SUCCESS)
+        return result;
+    }
+    return VK_SUCCESS;
+  }
+
+  std::vector<Pass> passes;
+  std::vector<Resource> resources;
+  std::vector<Alias> aliases;
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator* allocator = nullptr;
+  VkExtent2D extent{};
+  uint32_t variants = 1;
+  VkDeviceSize transientBytes = 0;
+  VkDeviceSize aliasedBytes = 0;
+};
@@ -0,0 +1,210 @@
+#pragma once
+
+// Dynamic resolution.
+//
+// The scene renders into an offscreen target sized for the largest scale,
+// using only its top-left `scale` fraction each frame; an upscale pass then
+// filters that region onto the backbuffer. Changing the scale therefore only
+// changes a render area and a few push constants, never an image.
+//
+// ResolutionController picks the scale from the GPU time of retired frames.
+// Cost is taken to grow with pixel count, i.e. with scale squared. Going over
+// budget drops straight to the predicted scale, while recovering is gradual
+// and waits for headroom: a blurrier frame is preferred to a missed one.
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#define DYNAMIC_RES_MIN_SCALE 0.5f
+#define DYNAMIC_RES_MAX_SCALE 1.0f
+#define DYNAMIC_RES_BUDGET_MS 15.0f
+// Aim this far below the budget so normal variance does not trip it
+#define DYNAMIC_RES_HEADROOM 0.9f
+// Fraction of the way to the predicted scale taken per frame when raising it
+#define DYNAMIC_RES_RAISE_RATE 0.1f
+// Scales are snapped to this step so small noise does not move the render area
+#define DYNAMIC_RES_STEP (1.0f / 64.0f)
+
+// Must match the push constant block in upscale.frag
+struct UpscalePushConstants {
+  float uvScale[2];   // rendered fraction of the scene image
+  float uvMax[2];     // last texel centre inside it, so filtering never reads outside
+};
+
+struct ResolutionController {
+  float minScale = DYNAMIC_RES_MIN_SCALE;
+  float maxScale = DYNAMIC_RES_MAX_SCALE;
+  float budgetMs = DYNAMIC_RES_BUDGET_MS;
+  float scale = DYNAMIC_RES_MAX_SCALE;
+
+  // `gpuMs` is the measured time of a frame rendered at `renderedScale`
+  float update(double gpuMs, float renderedScale) {
+    if (gpuMs <= 0.0)
+      return scale;
+
+    double target = budgetMs * DYNAMIC_RES_HEADROOM;
+    float predicted = renderedScale * (float)std::sqrt(target / gpuMs);
+    predicted = std::min(std::max(predicted, minScale), maxScale);
+
+    if (gpuMs > budgetMs || predicted < scale) {
+      scale = std::min(scale, predicted);
+    } else {
+      // At least one step, or snapping would stall the approach
+      scale = std::min(predicted, scale + std::max((predicted - scale) * DYNAMIC_RES_RAISE_RATE, DYNAMIC_RES_STEP));
+    }
+    scale = std::floor(scale / DYNAMIC_RES_STEP) * DYNAMIC_RES_STEP;
+    scale = std::min(std::max(scale, minScale), maxScale);
+    return scale;
+  }
+};
+
+// Descriptor and pipeline layout of the upscale pass. The pipeline itself is
+// built by the caller against `pipelineLayout`. Each frame slot has its own
+// set, rewritten when that slot next records after the source changed, so a
+// resize never touches a set a frame in flight is using.
+class Upscaler {
+public:
+  VkResult init(VkDevice device, uint32_t frameCount) {
+    this->device = device;
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+    VkResult result = vkCreateSampler(device, &samplerInfo, nullptr, &sampler);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    result = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkPushConstantRange push{VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(UpscalePushConstants)};
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &push;
+
+    result = vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frameCount};
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = frameCount;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool);
+    if (result != VK_SUCCESS)
+      return result;
+
+    std::vector<VkDescriptorSetLayout> layouts(frameCount, setLayout);
+    sets.assign(frameCount, VK_NULL_HANDLE);
+    setGenerations.assign(frameCount, 0);
+
+    VkDescriptorSetAllocateInfo alloc{};
+    alloc.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc.descriptorPool = pool;
+    alloc.descriptorSetCount = frameCount;
+    alloc.pSetLayouts = layouts.data();
+
+    return vkAllocateDescriptorSets(device, &alloc, sets.data());
+  }
+
+  // Points the pass at the scene image; call after every render graph resize
+  void setSource(VkImageView view, VkExtent2D extent) {
+    sourceView = view;
+    sourceExtent = extent;
+    generation++;
+  }
+
+  // Draws a full-screen triangle over `target` sampling the `rendered` corner of the source.
+  // The previous frame recorded in `slot` must have retired.
+  void record(VkCommandBuffer cmd, uint32_t slot, VkPipeline pipeline, VkExtent2D target, VkExtent2D rendered) {
+    if (setGenerations[slot] != generation) {
+      VkDescriptorImageInfo imageInfo{sampler, sourceView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+
+      VkWriteDescriptorSet write{};
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = sets[slot];
+      write.dstBinding = 0;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      write.pImageInfo = &imageInfo;
+      vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+      setGenerations[slot] = generation;
+    }
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    VkViewport viewport{0.0f, 0.0f, (float)target.width, (float)target.height, 0.0f, 1.0f};
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    VkRect2D scissor{{0, 0}, target};
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    float width = (float)sourceExtent.width;
+    float height = (float)sourceExtent.height;
+    UpscalePushConstants push{
+      {rendered.width / width, rendered.height / height},
+      {(rendered.width - 0.5f) / width, (rendered.height - 0.5f) / height},
+    };
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(push), &push);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &sets[slot], 0, nullptr);
+    vkCmdDraw(cmd, 3, 1, 0, 0);
+  }
+
+  // The device must be idle
+  void destroy() {
+    if (pool != VK_NULL_HANDLE)
+      vkDestroyDescriptorPool(device, pool, nullptr);
+    if (pipelineLayout != VK_NULL_HANDLE)
+      vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    if (setLayout != VK_NULL_HANDLE)
+      vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    if (sampler != VK_NULL_HANDLE)
+      vkDestroySampler(device, sampler, nullptr);
+    pool = VK_NULL_HANDLE;
+    pipelineLayout = VK_NULL_HANDLE;
+    setLayout = VK_NULL_HANDLE;
+    sampler = VK_NULL_HANDLE;
+  }
+
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> sets;
+  std::vector<uint32_t> setGenerations;
+  VkImageView sourceView = VK_NULL_HANDLE;
+  VkExtent2D sourceExtent{1, 1};
+  uint32_t generation = 0;
+};
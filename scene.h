@@ -0,0 +1,223 @@
+#pragma once
+
+// Per-frame scene update.
+//
+// Objects live in structure-of-arrays form: one array per property, so the
+// kernels load four (SSE) or eight (AVX, when the CPU has it) objects per
+// instruction. Every frame each object spins and circles through its home
+// position, where it starts at time 0, so the first frame is the plain grid;
+// update() computes the resulting per-instance transforms in parallel chunks
+// on the JobSystem and writes them straight into the frame's mapped instance
+// buffer with streaming stores, so the write-combined memory is never read
+// back into the cache. The vertex shader expands the packed transform
+// (offset, scale, rotation) and applies the camera, which is per draw.
+
+#include "cpu.h"
+#include "jobs.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Objects per job; large enough to hide the scheduling, small enough to balance 100k objects over many cores
+#define SCENE_UPDATE_GRAIN 4096
+// Furthest an orbit strays from home, as a fraction of the grid cell; keeps neighbours from overlapping
+#define SCENE_ORBIT_FRACTION 0.25f
+
+// Matches the app's InstanceData, see the static_assert next to it
+struct SceneInstance {
+  float transform[4];   // xy offset, z scale, w rotation in radians
+  float color[4];
+};
+
+class SceneTransforms {
+public:
+  // `count` objects on a square grid filling [-1, 1], each in its own cell
+  void layoutGrid(uint32_t count) {
+    for (std::vector<float>* v : {&homeX, &homeY, &scale, &radius, &orbitSpeed, &spin}) {
+      v->resize(count);
+    }
+
+    uint32_t side = (uint32_t)std::ceil(std::sqrt((double)count));
+    float cell = 2.0f / side;
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t x = i % side;
+      uint32_t y = i / side;
+      homeX[i] = side == 1 ? 0.0f : -1.0f + cell * (x + 0.5f);
+      homeY[i] = side == 1 ? 0.0f : -1.0f + cell * (y + 0.5f);
+      scale[i] = 1.0f / side;
+      radius[i] = side == 1 ? 0.0f : cell * SCENE_ORBIT_FRACTION * 0.5f;
+      orbitSpeed[i] = 0.5f + (i % 5) * 0.25f;
+      spin[i] = 1.0f + (i & 7) * 0.25f;
+    }
+  }
+
+  uint32_t size() const { return (uint32_t)homeX.size(); }
+
+  // Writes every object's transform at `time` seconds to `dst`, which must
+  // have room for size() instances. `simd` = false runs the scalar kernel, for comparison.
+  void update(JobSystem* jobs, float time, SceneInstance* dst, bool simd = true) {
+    jobs->parallelFor(size(), SCENE_UPDATE_GRAIN, [&](uint32_t begin, uint32_t end) {
+      updateRange(begin, end, time, dst, simd);
+    });
+  }
+
+  // One chunk, on whichever thread runs it
+  void updateRange(uint32_t begin, uint32_t end, float time, SceneInstance* dst, bool simd) const {
+    uint32_t i = begin;
+#if defined(__SSE2__)
+    // Streaming stores need 16 byte alignment, which mapped buffers always have
+    if (simd && reinterpret_cast<uintptr_t>(dst) % 16 == 0) {
+#if HAVE_AVX_KERNELS
+      if (cpuHasAvx()) {
+        i = update8(dst, i, end, time);
+      }
+#endif
+      for (; i + 4 <= end; i += 4) {
+        update4(dst + i, i, time);
+      }
+      // Streaming stores are weakly ordered; finish them before the job counts as done
+      _mm_sfence();
+    }
+#endif
+    for (; i < end; i++) {
+      update1(dst + i, i, time);
+    }
+  }
+
+private:
+  void update1(SceneInstance* dst, uint32_t i, float time) const {
+    float angle = orbitSpeed[i] * time;
+    *dst = {{homeX[i] + radius[i] * std::sin(angle), homeY[i] + radius[i] * (1.0f - std::cos(angle)), scale[i],
+             spin[i] * time},
+            {1.0f, 1.0f, 1.0f, 1.0f}};
+  }
+
+#if defined(__SSE2__)
+  // Folds x into [-pi/2, pi/2] around the nearest multiple of pi, where the
+  // Taylor series below are accurate to float precision. cos changes sign
+  // with the fold, sin does not.
+  static void sincos4(__m128 x, __m128* s, __m128* c) {
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    __m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.159154943f))));
+    // 2 pi in two parts, so large angles keep their precision
+    x = _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(6.28125f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(1.93530717e-3f)));
+
+    __m128 sign = _mm_and_ps(x, signBit);
+    __m128 folded = _mm_cmpgt_ps(_mm_andnot_ps(signBit, x), _mm_set1_ps(1.57079633f));
+    __m128 mirrored = _mm_sub_ps(_mm_or_ps(_mm_set1_ps(3.14159265f), sign), x);
+    x = _mm_or_ps(_mm_and_ps(folded, mirrored), _mm_andnot_ps(folded, x));
+
+    __m128 x2 = _mm_mul_ps(x, x);
+    __m128 ps = _mm_set1_ps(-2.50521084e-8f);
+    ps = _mm_add_ps(_mm_mul_ps(ps, x2), _mm_set1_ps(2.75573192e-6f));
+    ps = _mm_add_ps(_mm_mul_ps(ps, x2), _mm_set1_ps(-1.98412698e-4f));
+    ps = _mm_add_ps(_mm_mul_ps(ps, x2), _mm_set1_ps(8.33333333e-3f));
+    ps = _mm_add_ps(_mm_mul_ps(ps, x2), _mm_set1_ps(-1.66666667e-1f));
+    *s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, x2), x), x);
+
+    __m128 pc = _mm_set1_ps(-2.75573192e-7f);
+    pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(2.48015873e-5f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(-1.38888889e-3f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(4.16666667e-2f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(-0.5f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(1.0f));
+    *c = _mm_xor_ps(pc, _mm_and_ps(folded, signBit));
+  }
+
+  // Transposes four objects' (x, y, scale, rotation) lanes into one transform register each
+  static void storeInstances(SceneInstance* dst, __m128 x, __m128 y, __m128 size, __m128 rotation) {
+    __m128 transforms[4] = {x, y, size, rotation};
+    _MM_TRANSPOSE4_PS(transforms[0], transforms[1], transforms[2], transforms[3]);
+    __m128 white = _mm_set1_ps(1.0f);
+    float* out = reinterpret_cast<float*>(dst);
+    for (int k = 0; k < 4; k++) {
+      _mm_stream_ps(out + k * 8, transforms[k]);
+      _mm_stream_ps(out + k * 8 + 4, white);
+    }
+  }
+
+  void update4(SceneInstance* dst, uint32_t i, float time) const {
+    __m128 t = _mm_set1_ps(time);
+    __m128 angle = _mm_mul_ps(_mm_loadu_ps(&orbitSpeed[i]), t);
+    __m128 s, c;
+    sincos4(angle, &s, &c);
+    __m128 r = _mm_loadu_ps(&radius[i]);
+    __m128 x = _mm_add_ps(_mm_loadu_ps(&homeX[i]), _mm_mul_ps(r, s));
+    __m128 y = _mm_add_ps(_mm_loadu_ps(&homeY[i]), _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.0f), c)));
+    __m128 rotation = _mm_mul_ps(_mm_loadu_ps(&spin[i]), t);
+    storeInstances(dst, x, y, _mm_loadu_ps(&scale[i]), rotation);
+  }
+#endif
+
+#if HAVE_AVX_KERNELS
+  // sincos4 eight lanes wide
+  AVX_KERNEL static void sincos8(__m256 x, __m256* s, __m256* c) {
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    __m256 turns = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(0.159154943f)), _MM_FROUND_TO_NEAREST_INT);
+    x = _mm256_sub_ps(x, _mm256_mul_ps(turns, _mm256_set1_ps(6.28125f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(turns, _mm256_set1_ps(1.93530717e-3f)));
+
+    __m256 sign = _mm256_and_ps(x, signBit);
+    __m256 folded = _mm256_cmp_ps(_mm256_andnot_ps(signBit, x), _mm256_set1_ps(1.57079633f), _CMP_GT_OQ);
+    __m256 mirrored = _mm256_sub_ps(_mm256_or_ps(_mm256_set1_ps(3.14159265f), sign), x);
+    x = _mm256_blendv_ps(x, mirrored, folded);
+
+    __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 ps = _mm256_set1_ps(-2.50521084e-8f);
+    ps = _mm256_add_ps(_mm256_mul_ps(ps, x2), _mm256_set1_ps(2.75573192e-6f));
+    ps = _mm256_add_ps(_mm256_mul_ps(ps, x2), _mm256_set1_ps(-1.98412698e-4f));
+    ps = _mm256_add_ps(_mm256_mul_ps(ps, x2), _mm256_set1_ps(8.33333333e-3f));
+    ps = _mm256_add_ps(_mm256_mul_ps(ps, x2), _mm256_set1_ps(-1.66666667e-1f));
+    *s = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(ps, x2), x), x);
+
+    __m256 pc = _mm256_set1_ps(-2.75573192e-7f);
+    pc = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(2.48015873e-5f));
+    pc = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(-1.38888889e-3f));
+    pc = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(4.16666667e-2f));
+    pc = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(-0.5f));
+    pc = _mm256_add_ps(_mm256_mul_ps(pc, x2), _mm256_set1_ps(1.0f));
+    *c = _mm256_xor_ps(pc, _mm256_and_ps(folded, signBit));
+  }
+
+  // Eight objects of arithmetic per instruction, stored as two SSE halves.
+  // Runs whole groups of eight from `i` and returns where it stopped.
+  AVX_KERNEL uint32_t update8(SceneInstance* dst, uint32_t i, uint32_t end, float time) const {
+    __m256 t = _mm256_set1_ps(time);
+    for (; i + 8 <= end; i += 8) {
+      __m256 angle = _mm256_mul_ps(_mm256_loadu_ps(&orbitSpeed[i]), t);
+      __m256 s, c;
+      sincos8(angle, &s, &c);
+      __m256 r = _mm256_loadu_ps(&radius[i]);
+      __m256 x = _mm256_add_ps(_mm256_loadu_ps(&homeX[i]), _mm256_mul_ps(r, s));
+      __m256 y = _mm256_add_ps(_mm256_loadu_ps(&homeY[i]), _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(1.0f), c)));
+      __m256 size = _mm256_loadu_ps(&scale[i]);
+      __m256 rotation = _mm256_mul_ps(_mm256_loadu_ps(&spin[i]), t);
+
+      storeInstances(dst + i, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(size),
+                     _mm256_castps256_ps128(rotation));
+      storeInstances(dst + i + 4, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1),
+                     _mm256_extractf128_ps(size, 1), _mm256_extractf128_ps(rotation, 1));
+    }
+    return i;
+  }
+#endif
+
+  std::vector<float> homeX, homeY, scale;
+  std::vector<float> radius, orbitSpeed;   // orbit through the home position, reached again every turn
+  std::vector<float> spin;                 // radians per second
+};
+
+// Which transform kernel update() uses with `simd` set, for logs
+inline const char* sceneKernelName() {
+#if defined(__SSE2__)
+  return cpuHasAvx() ? "avx" : "sse";
+#else
+  return "scalar";
+#endif
+}
@@ -1,7 +1,13 @@
 #version 450
 
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUV;
+
+// White 1x1 until a streamed texture is resident
+layout(set = 1, binding = 0) uniform sampler2D tex;
+
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(1.0, 0.0, 0.0, 1.0);
+    outColor = vec4(fragColor, 1.0) * texture(tex, fragUV);
 }
@@ -1,11 +1,27 @@
 #version 450
 
-vec2 positions[3] = vec2[](
-    vec2( 0.0, -0.5),
-    vec2( 0.5,  0.5),
-    vec2(-0.5,  0.5)
-);
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// Per instance: xy offset, z scale, w rotation
+layout(location = 2) in vec4 inTransform;
+layout(location = 3) in vec4 inInstanceColor;
+
+layout(set = 0, binding = 0) uniform DrawUniforms {
+    mat4 transform;
+    vec4 tint;
+} draw;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUV;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
+    float c = cos(inTransform.w);
+    float s = sin(inTransform.w);
+    vec2 position = mat2(c, s, -s, c) * (inPosition * inTransform.z) + inTransform.xy;
+
+    gl_Position = draw.transform * vec4(position, 0.0, 1.0);
+    fragColor = inColor * inInstanceColor.rgb * draw.tint.rgb;
+    // The mesh spans [-0.5, 0.5], so the texture covers it once
+    fragUV = inPosition + 0.5;
 }
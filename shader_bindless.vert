@@ -0,0 +1,40 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// shader.vert with its uniforms fetched from the bindless table
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// Per instance: xy offset, z scale, w rotation
+layout(location = 2) in vec4 inTransform;
+layout(location = 3) in vec4 inInstanceColor;
+
+// DrawUniforms entries, addressed in vec4s so any ring alignment works
+layout(set = 0, binding = 1) readonly buffer DrawData {
+    vec4 data[];
+} buffers[];
+
+layout(push_constant) uniform Bindless {
+    uint drawBuffer;
+    uint drawOffset;
+    uint texture;
+} bindless;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUV;
+
+void main() {
+    uint o = bindless.drawOffset;
+    mat4 transform = mat4(buffers[bindless.drawBuffer].data[o], buffers[bindless.drawBuffer].data[o + 1],
+                          buffers[bindless.drawBuffer].data[o + 2], buffers[bindless.drawBuffer].data[o + 3]);
+    vec4 tint = buffers[bindless.drawBuffer].data[o + 4];
+
+    float c = cos(inTransform.w);
+    float s = sin(inTransform.w);
+    vec2 position = mat2(c, s, -s, c) * (inPosition * inTransform.z) + inTransform.xy;
+
+    gl_Position = transform * vec4(position, 0.0, 1.0);
+    fragColor = inColor * inInstanceColor.rgb * tint.rgb;
+    fragUV = inPosition + 0.5;
+}
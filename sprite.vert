@@ -0,0 +1,20 @@
+#version 450
+
+// Pre-expanded sprite corners from the sprite batcher, already rotated and placed
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inUV;
+layout(location = 2) in vec4 inColor;
+
+layout(set = 0, binding = 0) uniform DrawUniforms {
+    mat4 transform;
+    vec4 tint;
+} draw;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragUV;
+
+void main() {
+    gl_Position = draw.transform * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor * draw.tint;
+    fragUV = inUV;
+}
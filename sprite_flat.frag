@@ -0,0 +1,11 @@
+#version 450
+
+// Untextured quads; nothing is read from set 1
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragUV;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = fragColor;
+}
@@ -0,0 +1,442 @@
+#pragma once
+
+// Batched 2D quads and sprites.
+//
+// SpriteBatch collects quads and sprites on the CPU, sorts them by a packed
+// 64-bit state key (pipeline, texture, depth) and expands each into four
+// vertices with SSE, or AVX when the CPU has it. Sorting groups every
+// sprite sharing a pipeline and texture into one run, so a frame needs one
+// state change and one draw per run instead of per sprite. SpriteRenderer
+// writes the vertices straight into a per-frame mapped vertex ring and draws
+// each run against a static quad index buffer.
+
+#include <vulkan/vulkan.h>
+
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+
+#include "allocator.h"
+#include "cpu.h"
+#include "queues.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Quads covered by the static index buffer; longer runs are split into several draws
+#define SPRITE_MAX_PER_DRAW 65536
+
+// Pipelines addressed by the key. Untextured quads draw with the flat one
+#define SPRITE_PIPELINE_TEXTURED 0
+#define SPRITE_PIPELINE_FLAT 1
+#define SPRITE_PIPELINE_COUNT 2
+
+// One 16 byte vertex, so a corner is a single SSE store
+struct alignas(16) SpriteVertex {
+  float x, y;
+  uint32_t uv;      // R16G16_UNORM
+  uint32_t color;   // R8G8B8A8_UNORM
+};
+
+// Sprites sharing a pipeline and texture, drawn with one vkCmdDrawIndexed
+struct SpriteRun {
+  uint32_t pipeline;
+  uint32_t texture;
+  uint32_t first;   // in sprites, into the built vertices
+  uint32_t count;
+};
+
+// Bits 63..56 pipeline, 55..32 texture, 31..0 depth. Sorting the keys puts
+// each pipeline/texture pair together and orders each run by depth, lowest first.
+inline uint64_t spriteKey(uint32_t pipeline, uint32_t texture, float depth) {
+  uint32_t bits;
+  memcpy(&bits, &depth, sizeof(bits));
+  // Flip so the unsigned order matches the float order, negatives included
+  bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+  return ((uint64_t)(pipeline & 0xff) << 56) | ((uint64_t)(texture & 0xffffff) << 32) | bits;
+}
+
+inline uint32_t packColor(const glm::vec4& c) {
+  auto unorm = [](float v) { return (uint32_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f); };
+  return unorm(c.x) | unorm(c.y) << 8 | unorm(c.z) << 16 | unorm(c.w) << 24;
+}
+
+inline uint32_t packUv(float u, float v) {
+  auto unorm = [](float x) { return (uint32_t)(std::min(std::max(x, 0.0f), 1.0f) * 65535.0f + 0.5f); };
+  return unorm(u) | unorm(v) << 16;
+}
+
+class SpriteBatch {
+public:
+  void clear() {
+    sprites.clear();
+    keys.clear();
+  }
+
+  // Untextured quad of `size` around `center`, rotated by `rotation` radians
+  void quad(glm::vec2 center, glm::vec2 size, float rotation, const glm::vec4& color, float depth) {
+    add(SPRITE_PIPELINE_FLAT, 0, center, size, rotation, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f), color, depth);
+  }
+
+  // Textured quad; `uv` is the (u0, v0, u1, v1) rectangle of `texture` it shows
+  void sprite(uint32_t texture, glm::vec2 center, glm::vec2 size, float rotation, const glm::vec4& uv,
+              const glm::vec4& color, float depth) {
+    add(SPRITE_PIPELINE_TEXTURED, texture, center, size, rotation, uv, color, depth);
+  }
+
+  uint32_t size() const { return (uint32_t)sprites.size(); }
+
+  // Sorts by state key and writes four vertices per sprite to `dst`, which
+  // must be 16 byte aligned with room for size() * 4. Returns the runs in
+  // draw order. `simd` = false runs the scalar kernel, for comparison.
+  const std::vector<SpriteRun>& build(SpriteVertex* dst, bool simd = true) {
+    runs.clear();
+    uint32_t count = size();
+    if (count == 0)
+      return runs;
+
+    sortKeys();
+    gather();
+
+    uint32_t i = 0;
+#if defined(__SSE2__)
+    if (simd) {
+#if HAVE_AVX_KERNELS
+      if (cpuHasAvx()) {
+        i = expand8(dst, i, count);
+      }
+#endif
+      for (; i + 4 <= count; i += 4) {
+        expand4(dst + i * 4, i);
+      }
+      _mm_sfence();
+    }
+#endif
+    for (; i < count; i++) {
+      expand1(dst + i * 4, i);
+    }
+
+    // A new run wherever pipeline or texture changes, or the index buffer runs out
+    uint32_t runState = 0;
+    for (uint32_t s = 0; s < count; s++) {
+      uint32_t state = (uint32_t)(sortedKeys[s] >> 32);
+      if (runs.empty() || state != runState || runs.back().count == SPRITE_MAX_PER_DRAW) {
+        runs.push_back({state >> 24, state & 0xffffff, s, 0});
+        runState = state;
+      }
+      runs.back().count++;
+    }
+    return runs;
+  }
+
+private:
+  // As submitted; the rotation is baked into the two half axes
+  struct Sprite {
+    float x, y;
+    float ax, ay;   // half width along the rotated x axis
+    float bx, by;   // half height along the rotated y axis
+    uint32_t uvMin, uvMax, color;
+  };
+
+  void add(uint32_t pipeline, uint32_t texture, glm::vec2 center, glm::vec2 size, float rotation,
+           const glm::vec4& uv, const glm::vec4& color, float depth) {
+    float c = std::cos(rotation);
+    float s = std::sin(rotation);
+    float hw = size.x * 0.5f;
+    float hh = size.y * 0.5f;
+    sprites.push_back({center.x, center.y, hw * c, hw * s, -hh * s, hh * c,
+                       packUv(uv.x, uv.y), packUv(uv.z, uv.w), packColor(color)});
+    keys.push_back(spriteKey(pipeline, texture, depth));
+  }
+
+  // LSD radix sort of the keys, 11 bits per pass. Digits every key shares
+  // (usually all of pipeline and most of texture) are skipped, so a typical
+  // frame takes four passes over the data instead of a comparison sort.
+  void sortKeys() {
+    const uint32_t radixBits = 11;
+    const uint32_t passes = (64 + radixBits - 1) / radixBits;
+    const uint32_t buckets = 1u << radixBits;
+
+    uint32_t count = size();
+    sortedKeys.assign(keys.begin(), keys.end());
+    order.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+      order[i] = i;
+    }
+    scratchKeys.resize(count);
+    scratchOrder.resize(count);
+
+    histograms.assign(passes * buckets, 0);
+    for (uint32_t i = 0; i < count; i++) {
+      uint64_t key = sortedKeys[i];
+      for (uint32_t pass = 0; pass < passes; pass++) {
+        histograms[pass * buckets + ((key >> (pass * radixBits)) & (buckets - 1))]++;
+      }
+    }
+
+    for (uint32_t pass = 0; pass < passes; pass++) {
+      uint32_t* histogram = &histograms[pass * buckets];
+      uint32_t shift = pass * radixBits;
+      if (histogram[(sortedKeys[0] >> shift) & (buckets - 1)] == count)
+        continue;
+
+      uint32_t sum = 0;
+      for (uint32_t b = 0; b < buckets; b++) {
+        uint32_t n = histogram[b];
+        histogram[b] = sum;
+        sum += n;
+      }
+      for (uint32_t i = 0; i < count; i++) {
+        uint32_t dstIndex = histogram[(sortedKeys[i] >> shift) & (buckets - 1)]++;
+        scratchKeys[dstIndex] = sortedKeys[i];
+        scratchOrder[dstIndex] = order[i];
+      }
+      sortedKeys.swap(scratchKeys);
+      order.swap(scratchOrder);
+    }
+  }
+
+  // Sorted sprites into structure-of-arrays form for the kernels
+  void gather() {
+    uint32_t count = size();
+    for (std::vector<float>* v : {&px, &py, &pax, &pay, &pbx, &pby}) {
+      v->resize(count);
+    }
+    for (std::vector<uint32_t>* v : {&puvMin, &puvMax, &pcolor}) {
+      v->resize(count);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+#if defined(__SSE2__)
+      // Sorted order is a random walk through `sprites`; fetch ahead of it
+      if (i + 16 < count) {
+        _mm_prefetch(reinterpret_cast<const char*>(&sprites[order[i + 16]]), _MM_HINT_T0);
+      }
+#endif
+      const Sprite& s = sprites[order[i]];
+      px[i] = s.x;
+      py[i] = s.y;
+      pax[i] = s.ax;
+      pay[i] = s.ay;
+      pbx[i] = s.bx;
+      pby[i] = s.by;
+      puvMin[i] = s.uvMin;
+      puvMax[i] = s.uvMax;
+      pcolor[i] = s.color;
+    }
+  }
+
+  // Corners in order center - a - b, + a - b, + a + b, - a + b, indexed 0 1 2 / 2 3 0
+  void expand1(SpriteVertex* dst, uint32_t i) const {
+    float x = px[i], y = py[i];
+    float ax = pax[i], ay = pay[i], bx = pbx[i], by = pby[i];
+    uint32_t uvMin = puvMin[i], uvMax = puvMax[i];
+    dst[0] = {x - ax - bx, y - ay - by, uvMin, pcolor[i]};
+    dst[1] = {x + ax - bx, y + ay - by, (uvMax & 0xffff) | (uvMin & 0xffff0000u), pcolor[i]};
+    dst[2] = {x + ax + bx, y + ay + by, uvMax, pcolor[i]};
+    dst[3] = {x - ax + bx, y - ay + by, (uvMin & 0xffff) | (uvMax & 0xffff0000u), pcolor[i]};
+  }
+
+#if defined(__SSE2__)
+  // Transposes one corner of four sprites (lanes) into four vertices, one per register
+  static void transposeCorner(__m128 x, __m128 y, __m128 uv, __m128 color, __m128 out[4]) {
+    __m128 xy0 = _mm_unpacklo_ps(x, y);
+    __m128 xy1 = _mm_unpackhi_ps(x, y);
+    __m128 uc0 = _mm_unpacklo_ps(uv, color);
+    __m128 uc1 = _mm_unpackhi_ps(uv, color);
+    out[0] = _mm_movelh_ps(xy0, uc0);
+    out[1] = _mm_movehl_ps(uc0, xy0);
+    out[2] = _mm_movelh_ps(xy1, uc1);
+    out[3] = _mm_movehl_ps(uc1, xy1);
+  }
+
+  // Writes 16 finished vertices sprite by sprite. Streaming stores keep the
+  // write-combined ring from being read back into the cache.
+  static void storeCorners(SpriteVertex* dst, __m128 x[4], __m128 y[4], __m128 uv[4], __m128 color) {
+    __m128 corners[4][4];
+    for (int c = 0; c < 4; c++) {
+      transposeCorner(x[c], y[c], uv[c], color, corners[c]);
+    }
+    float* out = reinterpret_cast<float*>(dst);
+    for (int s = 0; s < 4; s++) {
+      for (int c = 0; c < 4; c++) {
+        _mm_stream_ps(out + (s * 4 + c) * 4, corners[c][s]);
+      }
+    }
+  }
+
+  void expand4(SpriteVertex* dst, uint32_t i) const {
+    __m128 x = _mm_loadu_ps(&px[i]), y = _mm_loadu_ps(&py[i]);
+    __m128 ax = _mm_loadu_ps(&pax[i]), ay = _mm_loadu_ps(&pay[i]);
+    __m128 bx = _mm_loadu_ps(&pbx[i]), by = _mm_loadu_ps(&pby[i]);
+    __m128 uvMin = _mm_loadu_ps(reinterpret_cast<const float*>(&puvMin[i]));
+    __m128 uvMax = _mm_loadu_ps(reinterpret_cast<const float*>(&puvMax[i]));
+    __m128 color = _mm_loadu_ps(reinterpret_cast<const float*>(&pcolor[i]));
+    __m128 lowHalf = _mm_castsi128_ps(_mm_set1_epi32(0xffff));
+
+    __m128 xm = _mm_sub_ps(x, ax), xp = _mm_add_ps(x, ax);
+    __m128 ym = _mm_sub_ps(y, ay), yp = _mm_add_ps(y, ay);
+    __m128 cx[4] = {_mm_sub_ps(xm, bx), _mm_sub_ps(xp, bx), _mm_add_ps(xp, bx), _mm_add_ps(xm, bx)};
+    __m128 cy[4] = {_mm_sub_ps(ym, by), _mm_sub_ps(yp, by), _mm_add_ps(yp, by), _mm_add_ps(ym, by)};
+    __m128 cuv[4] = {
+      uvMin,
+      _mm_or_ps(_mm_and_ps(uvMax, lowHalf), _mm_andnot_ps(lowHalf, uvMin)),
+      uvMax,
+      _mm_or_ps(_mm_and_ps(uvMin, lowHalf), _mm_andnot_ps(lowHalf, uvMax)),
+    };
+    storeCorners(dst, cx, cy, cuv, color);
+  }
+#endif
+
+#if HAVE_AVX_KERNELS
+  // Eight sprites of arithmetic per instruction, stored as two SSE halves.
+  // Runs whole groups of eight from `i` and returns where it stopped.
+  AVX_KERNEL uint32_t expand8(SpriteVertex* dst, uint32_t i, uint32_t count) const {
+    __m256 lowHalf = _mm256_castsi256_ps(_mm256_set1_epi32(0xffff));
+    for (; i + 8 <= count; i += 8) {
+      __m256 x = _mm256_loadu_ps(&px[i]), y = _mm256_loadu_ps(&py[i]);
+      __m256 ax = _mm256_loadu_ps(&pax[i]), ay = _mm256_loadu_ps(&pay[i]);
+      __m256 bx = _mm256_loadu_ps(&pbx[i]), by = _mm256_loadu_ps(&pby[i]);
+      __m256 uvMin = _mm256_loadu_ps(reinterpret_cast<const float*>(&puvMin[i]));
+      __m256 uvMax = _mm256_loadu_ps(reinterpret_cast<const float*>(&puvMax[i]));
+      __m256 color = _mm256_loadu_ps(reinterpret_cast<const float*>(&pcolor[i]));
+
+      __m256 xm = _mm256_sub_ps(x, ax), xp = _mm256_add_ps(x, ax);
+      __m256 ym = _mm256_sub_ps(y, ay), yp = _mm256_add_ps(y, ay);
+      __m256 cx[4] = {_mm256_sub_ps(xm, bx), _mm256_sub_ps(xp, bx), _mm256_add_ps(xp, bx), _mm256_add_ps(xm, bx)};
+      __m256 cy[4] = {_mm256_sub_ps(ym, by), _mm256_sub_ps(yp, by), _mm256_add_ps(yp, by), _mm256_add_ps(ym, by)};
+      __m256 cuv[4] = {
+        uvMin,
+        _mm256_or_ps(_mm256_and_ps(uvMax, lowHalf), _mm256_andnot_ps(lowHalf, uvMin)),
+        uvMax,
+        _mm256_or_ps(_mm256_and_ps(uvMin, lowHalf), _mm256_andnot_ps(lowHalf, uvMax)),
+      };
+
+      for (int half = 0; half < 2; half++) {
+        __m128 hx[4], hy[4], huv[4];
+        for (int c = 0; c < 4; c++) {
+          hx[c] = half ? _mm256_extractf128_ps(cx[c], 1) : _mm256_castps256_ps128(cx[c]);
+          hy[c] = half ? _mm256_extractf128_ps(cy[c], 1) : _mm256_castps256_ps128(cy[c]);
+          huv[c] = half ? _mm256_extractf128_ps(cuv[c], 1) : _mm256_castps256_ps128(cuv[c]);
+        }
+        __m128 hcolor = half ? _mm256_extractf128_ps(color, 1) : _mm256_castps256_ps128(color);
+        storeCorners(dst + i * 4 + half * 16, hx, hy, huv, hcolor);
+      }
+    }
+    return i;
+  }
+#endif
+
+  std::vector<Sprite> sprites;
+  std::vector<uint64_t> keys;
+  std::vector<uint64_t> sortedKeys, scratchKeys;
+  std::vector<uint32_t> order, scratchOrder;
+  std::vector<uint32_t> histograms;
+  std::vector<float> px, py, pax, pay, pbx, pby;
+  std::vector<uint32_t> puvMin, puvMax, pcolor;
+  std::vector<SpriteRun> runs;
+};
+
+// Which vertex kernel build() uses with `simd` set, for logs
+inline const char* spriteKernelName() {
+#if defined(__SSE2__)
+  return cpuHasAvx() ? "avx" : "sse";
+#else
+  return "scalar";
+#endif
+}
+
+class SpriteRenderer {
+public:
+  // Room for `maxSprites` per frame in the vertex ring. The quad index buffer
+  // is uploaded through `staging` on the upload queue without waiting for it.
+  VkResult init(QueueHandoff* uploads, DeviceAllocator* allocator, StagingRing* staging, uint32_t frameCount,
+                uint32_t maxSprites) {
+    VkResult result = vertices.init(allocator, 16, frameCount, (VkDeviceSize)maxSprites * 4 * sizeof(SpriteVertex),
+                                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    if (result != VK_SUCCESS)
+      return result;
+
+    std::vector<uint32_t> indices(SPRITE_MAX_PER_DRAW * 6);
+    for (uint32_t q = 0; q < SPRITE_MAX_PER_DRAW; q++) {
+      const uint32_t corners[6] = {0, 1, 2, 2, 3, 0};
+      for (uint32_t c = 0; c < 6; c++) {
+        indices[q * 6 + c] = q * 4 + corners[c];
+      }
+    }
+    VkDeviceSize indexSize = sizeof(uint32_t) * indices.size();
+
+    result = allocator->createBuffer(
+      indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexAlloc
+    );
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkCommandBuffer cmd = uploads->begin();
+    staging->reset();
+    if (!staging->upload(cmd, indexBuffer, 0, indices.data(), indexSize)) {
+      uploads->cancel();
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+    uploads->handOff(indexBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                     VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+    return uploads->submit();
+  }
+
+  void destroy(DeviceAllocator* allocator) {
+    vertices.destroy(allocator);
+    if (indexBuffer != VK_NULL_HANDLE)
+      allocator->destroyBuffer(indexBuffer, indexAlloc);
+    indexBuffer = VK_NULL_HANDLE;
+  }
+
+  // Call once the slot's fence has signalled, like UniformRing::beginFrame
+  void beginFrame(uint32_t slot) {
+    vertices.beginFrame(slot);
+  }
+
+  // Builds `batch` into this frame's ring and records one draw per run. The
+  // keys index `pipelines` and `textureSets` (bound at set 1 of `layout`);
+  // the caller has bound everything else the pipelines read. A batch that
+  // does not fit in the ring is skipped.
+  void record(VkCommandBuffer cmd, SpriteBatch* batch, const VkPipeline* pipelines,
+              const VkDescriptorSet* textureSets, VkPipelineLayout layout) {
+    uint32_t offset = 0;
+    void* dst = batch->size() ? vertices.allocate(sizeof(SpriteVertex) * 4, batch->size(), &offset) : nullptr;
+    if (!dst)
+      return;
+
+    const std::vector<SpriteRun>& runs = batch->build(static_cast<SpriteVertex*>(dst));
+
+    VkDeviceSize vertexOffset = offset;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &vertices.buffer, &vertexOffset);
+    vkCmdBindIndexBuffer(cmd, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+    uint32_t boundPipeline = UINT32_MAX;
+    uint32_t boundTexture = UINT32_MAX;
+    for (const SpriteRun& run : runs) {
+      if (run.pipeline != boundPipeline) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[run.pipeline]);
+        boundPipeline = run.pipeline;
+      }
+      // The flat pipeline never samples, so it keeps whatever is bound
+      if (run.pipeline != SPRITE_PIPELINE_FLAT && run.texture != boundTexture) {
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &textureSets[run.texture],
+                                0, nullptr);
+        boundTexture = run.texture;
+      }
+      vkCmdDrawIndexed(cmd, run.count * 6, 1, 0, (int32_t)(run.first * 4), 0);
+    }
+  }
+
+private:
+  UniformRing vertices;
+  VkBuffer indexBuffer = VK_NULL_HANDLE;
+  Allocation indexAlloc;
+};
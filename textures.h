@@ -0,0 +1,777 @@
+#pragma once
+
+// Streamed, mipmapped textures kept under a memory budget.
+//
+// Files are decoded on a worker thread, so the render thread never touches
+// the disk. Each texture owns one image holding the mip chain from its
+// finest resident level down to 1x1: the worker first hands back a small
+// preview level, which is uploaded as soon as it arrives, and then the finest
+// level the budget allows. Only that top level is staged; the rest of the
+// chain is generated on the GPU with vkCmdBlitImage.
+//
+// Changing residency means a new image: promotions re-upload from a fresh
+// decode, evictions copy the coarser levels of the least recently shown
+// textures into a smaller image. Replaced images go to the DeletionQueue,
+// which destroys them once every frame that could sample them has retired.
+// All GPU work is recorded into the frame's command buffer by update(),
+// ahead of the render passes.
+//
+// Decoding understands binary PPM (P6, 8 bits per channel); there is no
+// image library in this tree.
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.h"
+#include "deletion.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TEXTURE_BUDGET_MB 64
+// Largest edge of the preview level uploaded before the full chain
+#define TEXTURE_PREVIEW_SIZE 32
+// Staging space for texture uploads, also caps the finest level that can be streamed
+#define TEXTURE_STAGING_SIZE (64ull * 1024 * 1024)
+// Upload bytes per frame; the first upload of a frame may go over it
+#define TEXTURE_UPLOAD_PER_FRAME (8ull * 1024 * 1024)
+// Frames a texture must go unshown before its mips can be evicted
+#define TEXTURE_EVICT_AGE 30
+
+#define TEXTURE_FORMAT VK_FORMAT_R8G8B8A8_SRGB
+
+// RGBA8 pixels, tightly packed
+struct DecodedImage {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint8_t> pixels;
+};
+
+inline bool decodePpm(const std::string& path, DecodedImage* out) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+
+  // Header fields are separated by whitespace and may be interleaved with # comments
+  auto readField = [file](uint32_t* value) {
+    int c = fgetc(file);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      if (c == '#') {
+        while (c != '\n' && c != EOF) c = fgetc(file);
+      }
+      c = fgetc(file);
+    }
+    if (c < '0' || c > '9')
+      return false;
+    *value = 0;
+    while (c >= '0' && c <= '9') {
+      *value = *value * 10 + (uint32_t)(c - '0');
+      c = fgetc(file);
+    }
+    // The single whitespace after the last field is consumed here
+    return true;
+  };
+
+  char magic[2];
+  uint32_t width = 0, height = 0, maxValue = 0;
+  bool valid = fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && magic[1] == '6' &&
+               readField(&width) && readField(&height) && readField(&maxValue) &&
+               width > 0 && height > 0 && maxValue == 255;
+
+  std::vector<uint8_t> rgb;
+  if (valid) {
+    rgb.resize((size_t)width * height * 3);
+    valid = fread(rgb.data(), 1, rgb.size(), file) == rgb.size();
+  }
+  fclose(file);
+  if (!valid)
+    return false;
+
+  out->width = width;
+  out->height = height;
+  out->pixels.resize((size_t)width * height * 4);
+  for (size_t i = 0, n = (size_t)width * height; i < n; i++) {
+    out->pixels[i * 4 + 0] = rgb[i * 3 + 0];
+    out->pixels[i * 4 + 1] = rgb[i * 3 + 1];
+    out->pixels[i * 4 + 2] = rgb[i * 3 + 2];
+    out->pixels[i * 4 + 3] = 255;
+  }
+  return true;
+}
+
+// Next mip level with a 2x2 box filter; odd edges repeat their last texel
+inline DecodedImage halveImage(const DecodedImage& src) {
+  DecodedImage dst;
+  dst.width = std::max(1u, src.width / 2);
+  dst.height = std::max(1u, src.height / 2);
+  dst.pixels.resize((size_t)dst.width * dst.height * 4);
+
+  for (uint32_t y = 0; y < dst.height; y++) {
+    uint32_t y0 = std::min(y * 2, src.height - 1);
+    uint32_t y1 = std::min(y * 2 + 1, src.height - 1);
+    for (uint32_t x = 0; x < dst.width; x++) {
+      uint32_t x0 = std::min(x * 2, src.width - 1);
+      uint32_t x1 = std::min(x * 2 + 1, src.width - 1);
+      for (uint32_t c = 0; c < 4; c++) {
+        uint32_t sum = src.pixels[((size_t)y0 * src.width + x0) * 4 + c] +
+                       src.pixels[((size_t)y0 * src.width + x1) * 4 + c] +
+                       src.pixels[((size_t)y1 * src.width + x0) * 4 + c] +
+                       src.pixels[((size_t)y1 * src.width + x1) * 4 + c];
+        dst.pixels[((size_t)y * dst.width + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+      }
+    }
+  }
+  return dst;
+}
+
+inline uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+  uint32_t levels = 1;
+  while ((width | height) >> levels) levels++;
+  return levels;
+}
+
+// Texel bytes of levels [mip, levels) of a width x height chain
+inline VkDeviceSize mipChainBytes(uint32_t width, uint32_t height, uint32_t levels, uint32_t mip) {
+  VkDeviceSize bytes = 0;
+  for (uint32_t level = mip; level < levels; level++) {
+    bytes += (VkDeviceSize)std::max(1u, width >> level) * std::max(1u, height >> level) * 4;
+  }
+  return bytes;
+}
+
+using TextureHandle = uint32_t;
+
+#define TEXTURE_NOT_RESIDENT UINT32_MAX
+
+class TextureStreamer {
+public:
+  ~TextureStreamer() { stopWorker(); }
+
+  VkResult init(VkDevice device, DeviceAllocator* allocator, DeletionQueue* retire, uint32_t frameCount,
+                VkDeviceSize budget) {
+    this->device = device;
+    this->allocator = allocator;
+    this->retire = retire;
+    this->budget = budget;
+
+    VkResult result = staging.init(allocator, TEXTURE_STAGING_SIZE);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    result = vkCreateSampler(device, &samplerInfo, nullptr, &sampler);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    result = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout);
+    if (result != VK_SUCCESS)
+      return result;
+
+    // One set per frame in flight, so rewriting it never touches a set the GPU may be reading
+    VkDescriptorPoolSize poolSize{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frameCount};
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = frameCount;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool);
+    if (result != VK_SUCCESS)
+      return result;
+
+    std::vector<VkDescriptorSetLayout> layouts(frameCount, setLayout);
+    sets.resize(frameCount);
+
+    VkDescriptorSetAllocateInfo alloc{};
+    alloc.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc.descriptorPool = pool;
+    alloc.descriptorSetCount = frameCount;
+    alloc.pSetLayouts = layouts.data();
+
+    result = vkAllocateDescriptorSets(device, &alloc, sets.data());
+    if (result != VK_SUCCESS)
+      return result;
+
+    // Bound until a real texture is resident, uploaded by the first update()
+    result = createChain(1, 1, 1, &placeholder);
+    if (result != VK_SUCCESS)
+      return result;
+
+    worker = std::thread(&TextureStreamer::workerLoop, this);
+    return VK_SUCCESS;
+  }
+
+  // Never blocks: the decode is queued and the texture samples as the
+  // placeholder until its preview level lands
+  TextureHandle load(const std::string& path) {
+    Texture texture;
+    texture.path = path;
+    textures.push_back(texture);
+    TextureHandle handle = (TextureHandle)textures.size() - 1;
+    queueDecode(handle, 0);
+    return handle;
+  }
+
+  // Texture bound by the following update() calls
+  void show(TextureHandle handle) {
+    shown = handle;
+  }
+
+  // Call once per frame after waiting on `frame`'s fence, outside a render
+  // pass. Records pending uploads and evictions into `cmd` and returns the
+  // frame's descriptor set pointing at the shown texture.
+  VkDescriptorSet update(VkCommandBuffer cmd, uint32_t frame) {
+    frameNumber++;
+    staging.beginFrame(frame);
+
+    if (!placeholderReady) {
+      const uint8_t white[4] = {255, 255, 255, 255};
+      DecodedImage pixel;
+      pixel.width = 1;
+      pixel.height = 1;
+      pixel.pixels.assign(white, white + 4);
+      placeholderReady = uploadChain(cmd, &placeholder, pixel);
+    }
+
+    if (shown < textures.size()) {
+      textures[shown].lastShown = frameNumber;
+    }
+
+    applyResults(cmd);
+    requestPromotions();
+    staging.endFrame();
+
+    VkDescriptorImageInfo imageInfo = shownImage();
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = sets[frame];
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+    return sets[frame];
+  }
+
+  // The shown texture, or the placeholder while it is not resident. The view
+  // changes whenever residency does, so re-read it after every update().
+  VkDescriptorImageInfo shownImage() const {
+    const Chain& chain = shown < textures.size() && textures[shown].chain.image != VK_NULL_HANDLE
+                           ? textures[shown].chain : placeholder;
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.sampler = sampler;
+    imageInfo.imageView = chain.view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return imageInfo;
+  }
+
+  // The device must be idle
+  void destroy() {
+    stopWorker();
+    for (Texture& texture : textures) {
+      destroyChain(&texture.chain);
+    }
+    textures.clear();
+    destroyChain(&placeholder);
+    staging.destroy(allocator);
+
+    if (pool != VK_NULL_HANDLE)
+      vkDestroyDescriptorPool(device, pool, nullptr);
+    if (setLayout != VK_NULL_HANDLE)
+      vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+    if (sampler != VK_NULL_HANDLE)
+      vkDestroySampler(device, sampler, nullptr);
+    pool = VK_NULL_HANDLE;
+    setLayout = VK_NULL_HANDLE;
+    sampler = VK_NULL_HANDLE;
+  }
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  // Texel bytes of every resident mip chain
+  VkDeviceSize residentBytes = 0;
+
+private:
+  // An image with its view, holding levels [mip, mip + levels) of a texture
+  struct Chain {
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    Allocation alloc;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levels = 0;
+  };
+
+  struct Texture {
+    std::string path;
+    // Full resolution and chain length, known after the first decode
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levels = 0;
+    Chain chain;
+    uint32_t residentMip = TEXTURE_NOT_RESIDENT;
+    uint64_t lastShown = 0;
+    bool decoding = false;
+    bool failed = false;
+  };
+
+  struct Job {
+    TextureHandle handle;
+    std::string path;
+    uint32_t mip;       // finest level wanted
+    bool preview;       // also send a small level ahead of it
+  };
+
+  struct Result {
+    TextureHandle handle;
+    bool ok = false;
+    bool last = true;   // the job has nothing more to send
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mip = 0;
+    DecodedImage level;
+  };
+
+  uint32_t previewMip(const Texture& texture) const {
+    uint32_t mip = 0;
+    while (mip + 1 < texture.levels && std::max(texture.width >> mip, texture.height >> mip) > TEXTURE_PREVIEW_SIZE) {
+      mip++;
+    }
+    return mip;
+  }
+
+  VkDeviceSize chainBytes(const Texture& texture, uint32_t mip) const {
+    return mipChainBytes(texture.width, texture.height, texture.levels, mip);
+  }
+
+  void queueDecode(TextureHandle handle, uint32_t mip) {
+    Texture& texture = textures[handle];
+    texture.decoding = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back({handle, texture.path, mip, texture.residentMip == TEXTURE_NOT_RESIDENT});
+    }
+    wake.notify_one();
+  }
+
+  void workerLoop() {
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return quit || !jobs.empty(); });
+        if (quit)
+          return;
+        job = jobs.front();
+        jobs.pop_front();
+      }
+
+      Result result;
+      result.handle = job.handle;
+      DecodedImage image;
+      result.ok = decodePpm(job.path, &image);
+      if (!result.ok) {
+        publish(std::move(result));
+        continue;
+      }
+
+      result.width = image.width;
+      result.height = image.height;
+      uint32_t levels = mipLevelCount(image.width, image.height);
+      uint32_t mip = 0;
+      for (; mip < job.mip && mip + 1 < levels; mip++) {
+        image = halveImage(image);
+      }
+
+      if (job.preview) {
+        Result preview = result;
+        preview.last = false;
+        preview.level = image;
+        preview.mip = mip;
+        while (std::max(preview.level.width, preview.level.height) > TEXTURE_PREVIEW_SIZE) {
+          preview.level = halveImage(preview.level);
+          preview.mip++;
+        }
+        if (preview.mip > mip) {
+          publish(std::move(preview));
+        }
+      }
+
+      result.mip = mip;
+      result.level = std::move(image);
+      publish(std::move(result));
+    }
+  }
+
+  void publish(Result result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    results.push_back(std::move(result));
+  }
+
+  void stopWorker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+      jobs.clear();
+    }
+    wake.notify_all();
+    if (worker.joinable())
+      worker.join();
+  }
+
+  // Uploads arrived levels, oldest first, until the frame's upload budget is spent
+  void applyResults(VkCommandBuffer cmd) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      while (!results.empty()) {
+        arrived.push_back(std::move(results.front()));
+        results.pop_front();
+      }
+    }
+
+    VkDeviceSize uploaded = 0;
+    while (!arrived.empty()) {
+      Result& result = arrived.front();
+      Texture& texture = textures[result.handle];
+
+      if (!result.ok) {
+        logLine() << "Failed to decode texture " << texture.path;
+        texture.failed = true;
+        texture.decoding = false;
+        arrived.pop_front();
+        continue;
+      }
+
+      texture.width = result.width;
+      texture.height = result.height;
+      texture.levels = mipLevelCount(result.width, result.height);
+
+      VkDeviceSize size = result.level.pixels.size();
+      bool finer = texture.residentMip == TEXTURE_NOT_RESIDENT || result.mip < texture.residentMip;
+      if (finer && uploaded > 0 && uploaded + size > TEXTURE_UPLOAD_PER_FRAME)
+        break;
+
+      // A level that no longer fits is dropped; requestPromotions() asks for a coarser one
+      VkDeviceSize current = texture.residentMip == TEXTURE_NOT_RESIDENT ? 0 : chainBytes(texture, texture.residentMip);
+      if (finer && makeRoom(cmd, result.handle, chainBytes(texture, result.mip) - current)) {
+        Chain chain;
+        VkResult created = createChain(result.level.width, result.level.height, texture.levels - result.mip, &chain);
+        if (created == VK_SUCCESS && !uploadChain(cmd, &chain, result.level)) {
+          // Staging is full, try again next frame
+          destroyChain(&chain);
+          break;
+        }
+        if (created == VK_SUCCESS) {
+          replaceChain(&texture, chain, result.mip);
+          uploaded += size;
+          logLine() << "Texture " << texture.path << ": mip " << result.mip << " (" << result.level.width << "x"
+                    << result.level.height << ") resident, " << residentBytes / (1024 * 1024) << " of "
+                    << budget / (1024 * 1024) << " MiB";
+        } else {
+          logLine() << "Failed to create image for texture " << texture.path;
+        }
+      }
+
+      if (result.last) {
+        texture.decoding = false;
+      }
+      arrived.pop_front();
+    }
+  }
+
+  // Streams in the finest level of the shown texture that fits, counting
+  // what evicting stale textures would free
+  void requestPromotions() {
+    if (shown >= textures.size())
+      return;
+    Texture& texture = textures[shown];
+    if (texture.decoding || texture.failed || texture.levels == 0 || texture.residentMip == 0)
+      return;
+
+    VkDeviceSize evictable = 0;
+    for (size_t i = 0; i < textures.size(); i++) {
+      const Texture& other = textures[i];
+      if (i != shown && other.residentMip != TEXTURE_NOT_RESIDENT && other.residentMip < previewMip(other) &&
+          other.lastShown + TEXTURE_EVICT_AGE < frameNumber) {
+        evictable += chainBytes(other, other.residentMip) - chainBytes(other, previewMip(other));
+      }
+    }
+
+    VkDeviceSize current = texture.residentMip == TEXTURE_NOT_RESIDENT ? 0 : chainBytes(texture, texture.residentMip);
+    VkDeviceSize others = residentBytes - current;
+    VkDeviceSize committed = others > evictable ? others - evictable : 0;
+    VkDeviceSize available = budget > committed ? budget - committed : 0;
+    uint32_t mip = 0;
+    // The top level has to fit in staging next to frames still in flight
+    while (mip + 1 < texture.levels &&
+           (chainBytes(texture, mip) > available ||
+            (VkDeviceSize)std::max(1u, texture.width >> mip) * std::max(1u, texture.height >> mip) * 4 >
+              TEXTURE_STAGING_SIZE / 2)) {
+      mip++;
+    }
+
+    if (mip < texture.residentMip && chainBytes(texture, mip) <= available) {
+      queueDecode(shown, mip);
+    }
+  }
+
+  // Evicts the finest mips of the least recently shown textures until
+  // `needed` more bytes fit in the budget. False if that is not possible.
+  bool makeRoom(VkCommandBuffer cmd, TextureHandle keep, VkDeviceSize needed) {
+    while (residentBytes + needed > budget) {
+      TextureHandle victim = TEXTURE_NOT_RESIDENT;
+      for (size_t i = 0; i < textures.size(); i++) {
+        const Texture& other = textures[i];
+        if (i == keep || other.residentMip == TEXTURE_NOT_RESIDENT || other.residentMip >= previewMip(other) ||
+            other.lastShown + TEXTURE_EVICT_AGE >= frameNumber)
+          continue;
+        if (victim == TEXTURE_NOT_RESIDENT || other.lastShown < textures[victim].lastShown)
+          victim = (TextureHandle)i;
+      }
+      if (victim == TEXTURE_NOT_RESIDENT)
+        return false;
+
+      // Drop just enough levels, never past the preview
+      Texture& texture = textures[victim];
+      VkDeviceSize excess = residentBytes + needed - budget;
+      uint32_t mip = texture.residentMip + 1;
+      while (mip < previewMip(texture) &&
+             chainBytes(texture, texture.residentMip) - chainBytes(texture, mip) < excess) {
+        mip++;
+      }
+      if (!demote(cmd, &texture, mip))
+        return false;
+      logLine() << "Texture " << texture.path << ": evicted to mip " << mip << ", "
+                << residentBytes / (1024 * 1024) << " of " << budget / (1024 * 1024) << " MiB";
+    }
+    return true;
+  }
+
+  // Copies levels [mip, levels) of the texture's chain into a smaller image
+  bool demote(VkCommandBuffer cmd, Texture* texture, uint32_t mip) {
+    const Chain& old = texture->chain;
+    uint32_t skip = mip - texture->residentMip;
+
+    Chain chain;
+    if (createChain(std::max(1u, old.width >> skip), std::max(1u, old.height >> skip), old.levels - skip,
+                    &chain) != VK_SUCCESS)
+      return false;
+
+    VkImageMemoryBarrier barriers[2]{};
+    barriers[0] = imageBarrier(old.image, 0, old.levels, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    barriers[1] = imageBarrier(chain.image, 0, chain.levels, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                               VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 2, barriers);
+
+    std::vector<VkImageCopy> copies(chain.levels);
+    for (uint32_t level = 0; level < chain.levels; level++) {
+      VkImageCopy& copy = copies[level];
+      copy.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level + skip, 0, 1};
+      copy.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+      copy.extent = {std::max(1u, chain.width >> level), std::max(1u, chain.height >> level), 1};
+    }
+    vkCmdCopyImage(cmd, old.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, chain.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)copies.size(), copies.data());
+
+    VkImageMemoryBarrier toShader = imageBarrier(chain.image, 0, chain.levels, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                 VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &toShader);
+
+    replaceChain(texture, chain, mip);
+    return true;
+  }
+
+  // Replaces the texture's chain, retiring the old image
+  void replaceChain(Texture* texture, const Chain& chain, uint32_t mip) {
+    if (texture->chain.image != VK_NULL_HANDLE) {
+      residentBytes -= chainBytes(*texture, texture->residentMip);
+      retire->destroyImageView(texture->chain.view);
+      retire->destroyImage(texture->chain.image, texture->chain.alloc);
+    }
+    texture->chain = chain;
+    texture->residentMip = mip;
+    residentBytes += chainBytes(*texture, mip);
+  }
+
+  VkResult createChain(uint32_t width, uint32_t height, uint32_t levels, Chain* chain) {
+    chain->width = width;
+    chain->height = height;
+    chain->levels = levels;
+
+    VkImageCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    info.imageType = VK_IMAGE_TYPE_2D;
+    info.format = TEXTURE_FORMAT;
+    info.extent = {width, height, 1};
+    info.mipLevels = levels;
+    info.arrayLayers = 1;
+    info.samples = VK_SAMPLE_COUNT_1_BIT;
+    info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(device, &info, nullptr, &chain->image);
+    if (result != VK_SUCCESS)
+      return result;
+
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(device, chain->image, &reqs);
+    result = allocator->allocate(reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, &chain->alloc);
+    if (result == VK_SUCCESS)
+      result = vkBindImageMemory(device, chain->image, chain->alloc.memory, chain->alloc.offset);
+
+    if (result == VK_SUCCESS) {
+      VkImageViewCreateInfo view{};
+      view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      view.image = chain->image;
+      view.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      view.format = TEXTURE_FORMAT;
+      view.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levels, 0, 1};
+      result = vkCreateImageView(device, &view, nullptr, &chain->view);
+    }
+
+    if (result != VK_SUCCESS)
+      destroyChain(chain);
+    return result;
+  }
+
+  void destroyChain(Chain* chain) {
+    if (chain->view != VK_NULL_HANDLE)
+      vkDestroyImageView(device, chain->view, nullptr);
+    if (chain->image != VK_NULL_HANDLE)
+      vkDestroyImage(device, chain->image, nullptr);
+    allocator->free(chain->alloc);
+    *chain = Chain{};
+  }
+
+  // Stages `top` into level 0 and blits it down the rest of the chain.
+  // False when the staging ring is full.
+  bool uploadChain(VkCommandBuffer cmd, Chain* chain, const DecodedImage& top) {
+    VkDeviceSize offset = 0;
+    void* dst = staging.allocate(top.pixels.size(), 16, &offset);
+    if (!dst)
+      return false;
+    memcpy(dst, top.pixels.data(), top.pixels.size());
+
+    VkImageMemoryBarrier toTransfer = imageBarrier(chain->image, 0, chain->levels, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                   VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &toTransfer);
+
+    VkBufferImageCopy copy{};
+    copy.bufferOffset = offset;
+    copy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    copy.imageExtent = {top.width, top.height, 1};
+    vkCmdCopyBufferToImage(cmd, staging.buffer, chain->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+
+    // Each level is read once it has been written, then left for the shader
+    for (uint32_t level = 1; level < chain->levels; level++) {
+      VkImageMemoryBarrier toSource = imageBarrier(chain->image, level - 1, 1, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                   VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                           0, nullptr, 0, nullptr, 1, &toSource);
+
+      VkImageBlit blit{};
+      blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+      blit.srcOffsets[1] = {(int32_t)std::max(1u, chain->width >> (level - 1)),
+                            (int32_t)std::max(1u, chain->height >> (level - 1)), 1};
+      blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+      blit.dstOffsets[1] = {(int32_t)std::max(1u, chain->width >> level),
+                            (int32_t)std::max(1u, chain->height >> level), 1};
+      vkCmdBlitImage(cmd, chain->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, chain->image,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+      VkImageMemoryBarrier toShader = imageBarrier(chain->image, level - 1, 1, VK_ACCESS_TRANSFER_READ_BIT,
+                                                   VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                           0, nullptr, 0, nullptr, 1, &toShader);
+    }
+
+    VkImageMemoryBarrier last = imageBarrier(chain->image, chain->levels - 1, 1, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                             VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &last);
+    return true;
+  }
+
+  static VkImageMemoryBarrier imageBarrier(VkImage image, uint32_t baseLevel, uint32_t levels,
+                                           VkAccessFlags srcAccess, VkAccessFlags dstAccess,
+                                           VkImageLayout oldLayout, VkImageLayout newLayout) {
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levels, 0, 1};
+    return barrier;
+  }
+
+  VkDevice device = VK_NULL_HANDLE;
+  DeviceAllocator* allocator = nullptr;
+  DeletionQueue* retire = nullptr;
+  VkDeviceSize budget = 0;
+  StagingRing staging;
+
+  VkSampler sampler = VK_NULL_HANDLE;
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  std::vector<VkDescriptorSet> sets;
+
+  Chain placeholder;
+  bool placeholderReady = false;
+
+  // Render thread only
+  std::vector<Texture> textures;
+  TextureHandle shown = TEXTURE_NOT_RESIDENT;
+  uint64_t frameNumber = 0;
+  std::deque<Result> arrived;
+
+  // Shared with the worker
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Job> jobs;
+  std::deque<Result> results;
+  bool quit = false;
+};
@@ -0,0 +1,17 @@
+#version 450
+
+// Bilinear upscale of the rendered corner of the scene image
+layout(location = 0) in vec2 fragUV;
+
+layout(set = 0, binding = 0) uniform sampler2D scene;
+
+layout(push_constant) uniform Upscale {
+    vec2 uvScale;
+    vec2 uvMax;
+} upscale;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(scene, min(fragUV * upscale.uvScale, upscale.uvMax));
+}